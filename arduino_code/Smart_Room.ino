@@ -1,19 +1,31 @@
 #include <YunClient.h>
 #include <Console.h>
 #include <Bridge.h>
+#include <DatastoreCache.h>
 #include <BridgeServer.h>
 #include <Mailbox.h>
 #include <BridgeSSLClient.h>
 #include <HttpClient.h>
-#include <FileIO.h>
 #include <Process.h>
+#include <FileIO.h>
 #include <BridgeClient.h>
 #include <YunServer.h>
 #include <SPI.h>
 #include <YunClient.h>
 #include <IPStack.h>
 #include <Countdown.h>
-#include <MQTTClient.h>
+#include <TimerWheel.h>
+#define MQTTCLIENT_SCATTER_PUBLISH 1   // payload goes straight from msg, sendbuf only holds header + topic
+// the 32u4 has 2.5 KB of RAM for all of this, the Bridge and the Strings: each buffer is as small
+// as it can be, and the optional ones are off
+#define MQTTCLIENT_TX_BATCH_SIZE 128   // a reading and a ping go in one Bridge write, the rest as it fills
+#define MQTTCLIENT_RX_RING_SIZE 0      // 128 or more to take acks and commands arriving together in one Bridge read
+#define MQTTCLIENT_MQTTV5 1            // topic aliases for publishTopic when MQTT_VERSION is 5
+#define MQTTCLIENT_TRACE_RECORDS 0     // 16 keeps the last packets, 160 bytes, written to TRACE_FILE on a 't' from Serial
+#include <MQTTAsyncClient.h>
+#include <MQTTMessageView.h>
+#include <MQTTPublishQueue.h>
+#include <MQTTReconnect.h>
 #include <BridgeUdp.h>
 #include <dht11.h>
 
@@ -21,9 +33,21 @@
 #define MQTT_MAX_PACKET_SIZE 100
 #define SIZE 100
 #define MQTT_PORT 1883
+#define MQTT_VERSION 3    // 5 if the broker speaks MQTT 5: repeat publishes then carry a 2 byte alias, not the topic
 #define PUBLISH_TOPIC "iot-2/evt/status/fmt/json"
+#define ALARM_TOPIC "iot-2/evt/alarm/fmt/json"
 #define SUBSCRIBE_TOPIC "iot-2/cmd/+/fmt/json"
 #define AUTHMETHOD "use-token-auth"
+#define TRACE_FILE "/tmp/mqtt.trace"   // on the Linux side, for trace/TraceDecode
+#define SAMPLE_MS 7000       // sensor readings period
+#define RECONNECT_MIN_MS 2000    // first wait after a failed attempt or a dropped connection
+#define RECONNECT_MAX_MS 120000  // the wait doubles per failed attempt up to this
+#define SESSION_EXPIRY 3600  // seconds the broker keeps the subscription after a drop, for MQTT 5
+#define IDLE_MS 20           // longest sleep, so relay commands are still handled promptly
+#define ALARM_CHECK_MS 250   // smoke is checked this often, not only with the readings
+#define SMOKE_PIN 14
+#define SMOKE_ALARM 400      // analogRead level which raises the smoke alarm
+#define SMOKE_CLEAR 350      // and the level it has to fall below to clear it
 
 // Authenticationec
 #define CLIENT_ID "d:3gyk83:arduinoyun:Arduino_Yun"
@@ -33,12 +57,64 @@
 YunClient c;
 IPStack ipstack(c);
 
-MQTT::Client<IPStack, Countdown, 100, 1> client = MQTT::Client<IPStack, Countdown, 100, 1>(ipstack);
+// relay commands go straight to messageArrived, without a message handler slot or an FP call,
+// as a view of the client's read buffer: no copies of the topic or payload
+void messageArrived(MQTT::MessageView& msg);
+extern const char commandFilter[] = SUBSCRIBE_TOPIC;
+typedef MQTT::ViewRoute<commandFilter, messageArrived> Routes;
+
+MQTT::AsyncClient<IPStack, Countdown, 100, 0, 1, Routes> client = MQTT::AsyncClient<IPStack, Countdown, 100, 0, 1, Routes>(ipstack);
+
+MQTT::PreparedTopic publishTopic(PUBLISH_TOPIC);   // header serialized once, patched per publish
+
+// the latest reading taken while the broker is unreachable, and an alarm, are kept in RAM.  An
+// MQTT::SDStore spills older readings to an SD card, at the cost of its 512 byte block buffer.
+MQTT::NoStore noSpill;
+MQTT::PublishQueue<Countdown, MQTT::NoStore, 80, 80> queue(noSpill);
 
-void messageArrived(MQTT::MessageData& md);
+// connect attempts are made from loop between readings, never in a loop of their own
+int connectBroker();
+MQTT::Reconnector<MQTT::AsyncClient<IPStack, Countdown, 100, 0, 1, Routes>, Countdown> link(client, connectBroker, RECONNECT_MIN_MS, RECONNECT_MAX_MS);
+
+void ackArrived(int packetType, unsigned short packetId, int rc);
+void publishReading(String& json);
+void sample(void*);
+void linkChanged(int state, int failures);
+void checkSmoke(void*);
+#if MQTTCLIENT_TRACE_RECORDS > 0
+void dumpTrace();
+#endif
+void resolveBroker();
+void printBanner();
+int freeRam();
 
 String deviceEvent;
-int decider = 0;
+
+// the sampling and smoke check periods share one wheel, which also tells loop how long it may sleep.
+// 8 slots by 4 levels reach 4 s, the longer sample period is parked and moved down.
+TimerWheel<3, 4> wheel;
+WheelTimer sampleTimer(sample);
+WheelTimer alarmTimer(checkSmoke);
+
+// keys of the room state in the Linux-side datastore, read by scripts there and by /data/get
+const char smokeKey[] PROGMEM = "smoke";
+const char movementKey[] PROGMEM = "movement";
+const char humidityKey[] PROGMEM = "humidity";
+const char temperatureKey[] PROGMEM = "temperature";
+const char dewPointKey[] PROGMEM = "dewpoint";
+const __FlashStringHelper * const stateKeys[] = {
+  reinterpret_cast<const __FlashStringHelper *>(smokeKey),
+  reinterpret_cast<const __FlashStringHelper *>(movementKey),
+  reinterpret_cast<const __FlashStringHelper *>(humidityKey),
+  reinterpret_cast<const __FlashStringHelper *>(temperatureKey),
+  reinterpret_cast<const __FlashStringHelper *>(dewPointKey)
+};
+// the state as last written: only the readings which changed are sent, and the sketch is the
+// only writer of these keys, so there is no refresh
+DatastoreCache<const __FlashStringHelper *, 5, 7> roomState(Bridge, SAMPLE_MS, 0);
+
+bool smokeAlarm = false;
+char alarmJson[64];   // the payload of the QoS 1 alarm sent, kept until it is acknowledged
 
 void setup() {
 
@@ -46,23 +122,187 @@ void setup() {
   Bridge.begin();
   Console.begin();
   Serial.begin(9600);
+  FileSystem.begin();
 
   // Set pins as I/O
   pinMode(7,OUTPUT);
   pinMode(13, OUTPUT);
   delay(1000);
+
+  queue.setRate(5, 500);   // readings: five at a time, refilled over 500 ms - alarms are not limited
+
+  client.setAckHandler(ackArrived);
+  link.setStateHandler(linkChanged);
+  link.seed(analogRead(0));   // unconnected, so noise: devices restarted together retry apart
+  wheel.start(sampleTimer, 0, SAMPLE_MS);
+  wheel.start(alarmTimer, ALARM_CHECK_MS, ALARM_CHECK_MS);
+  Serial.print(F("Free RAM : "));
+  Serial.println(freeRam());
   
   
 }
 
 void loop() {
 
+  // take readings when their periods are up
+  wheel.run();
+
+  // handle relay commands and acks as soon as they arrive
+  client.poll();
+
+  // retry the connection when its backoff is up
+  link.poll();
+
+#if MQTTCLIENT_TRACE_RECORDS > 0
+  if (Serial.available() > 0 && Serial.read() == 't') {
+    dumpTrace();
+  }
+#endif
+
+  // send what was queued while offline, oldest first
+  client.cork();
+  queue.drain(client);
+  client.uncork();
+
+  // sleep until the next timer, whether ours or the client's
+  unsigned long idle = wheel.next_ms();
+  unsigned long clientIdle = client.next_ms();
+  if (clientIdle < idle) {
+    idle = clientIdle;
+  }
+  unsigned long linkIdle = link.next_ms();
+  if (linkIdle < idle) {
+    idle = linkIdle;
+  }
+  if (idle > IDLE_MS) {
+    idle = IDLE_MS;
+  }
+  if (idle > 0) {
+    delay(idle);
+  }
+}
+
+#if MQTTCLIENT_TRACE_RECORDS > 0
+// write the packet trace to the Linux side, where it can be copied off and decoded
+void dumpTrace() {
+  File trace = FileSystem.open(TRACE_FILE, FILE_WRITE);
+  if (!trace) {
+    Serial.println(F("Cannot open " TRACE_FILE));
+    return;
+  }
+  int len = client.dumpTrace(trace);
+  trace.close();
+  Serial.print(F("Packet trace written to " TRACE_FILE ", bytes : "));
+  Serial.println(len);
+}
+#endif
+
+// one connect attempt for link: the CONNECT is sent and the connack left to client.poll
+int connectBroker() {
+  Serial.print(F("Connecting using Registered mode with clientid : "));
+  Serial.print(CLIENT_ID);
+  Serial.print(F("\tto MQTT Broker : "));
+  Serial.print(MS_PROXY);
+  Serial.print(F("\ton topic : "));
+  Serial.println(PUBLISH_TOPIC);
+
+  // the name is looked up once, later reconnects go straight to the cached address
+  if (!ipstack.isCached(MS_PROXY)) {
+    resolveBroker();
+  }
+  ipstack.disconnect();   // whatever is left of the last connection
+  if (ipstack.connect(MS_PROXY, MQTT_PORT) != 1) {
+    return MQTT::FAILURE;
+  }
+
+  MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
+  options.MQTTVersion = MQTT_VERSION;
+  options.clientID.cstring = CLIENT_ID;
+  options.username.cstring = AUTHMETHOD;
+  options.password.cstring = AUTHTOKEN;
+  options.keepAliveInterval = 10;
+  // keep the session, so the broker still has the command subscription when we come back
+  options.cleansession = 0;
+  // the connack and suback are handled in ackArrived
+#if MQTT_VERSION == 5
+  MQTTProperty expiry[1];
+  MQTTProperties props = {0, 1, 0, expiry};
+  MQTTProperty interval;
+  interval.identifier = MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL;
+  interval.value.integer4 = SESSION_EXPIRY;
+  MQTTProperties_add(&props, &interval);
+  return client.connect(options, &props);
+#else
+  return client.connect(options);
+#endif
+}
+
+void linkChanged(int state, int failures) {
+  if (state == link.ONLINE) {
+    Serial.println(F("Broker connection up"));
+  } else if (state == link.WAITING) {
+    Serial.print(F("Broker unreachable, readings are queued. Failed attempts : "));
+    Serial.print(failures);
+    Serial.print(F(", next in ms : "));
+    Serial.println(link.next_ms());
+  }
+}
+
+// the Bridge has no resolver call, so ask nslookup on the Linux side and cache the answer in ipstack
+void resolveBroker() {
+  Process p;
+  p.runShellCommand(F("nslookup " MS_PROXY " | sed -n '/^Name:/,$s/^Address[ 0-9]*: *\\([0-9.]*\\.[0-9]*\\).*/\\1/p' | head -n 1"));
+  int octet[4] = {0, 0, 0, 0};
+  int i = 0;
+  while (p.available() > 0) {
+    char ch = p.read();
+    if (ch >= '0' && ch <= '9' && i < 4) {
+      octet[i] = octet[i] * 10 + (ch - '0');
+    } else if (ch == '.') {
+      ++i;
+    } else {
+      break;
+    }
+  }
+  if (i != 3) {
+    Serial.println(F("Broker address not resolved, connecting by name"));
+    return;
+  }
+  ipstack.cacheAddress(MS_PROXY, IPAddress(octet[0], octet[1], octet[2], octet[3]));
+}
+
+// raise or clear the smoke alarm as soon as the level crosses it, ahead of any queued readings
+void checkSmoke(void*) {
+  int smoke = analogRead(SMOKE_PIN);
+  bool alarm = smokeAlarm ? (smoke >= SMOKE_CLEAR) : (smoke >= SMOKE_ALARM);
+  if (alarm == smokeAlarm) {
+    return;
+  }
+  smokeAlarm = alarm;
+  char json[sizeof(alarmJson)];
+  snprintf(json, sizeof(json), "{\"d\":{\"device\":\"Arduino Yun\",\"alarm\":%d,\"s\":%d}}", alarm ? 1 : 0, smoke);
+  int rc;
+  if (client.inflightCount() > 0) {
+    // alarmJson may still be waiting for its acknowledgement: queue a copy in the urgent lane
+    rc = queue.enqueue(ALARM_TOPIC, json, strlen(json), MQTT::QOS1, false, MQTT::URGENT);
+  } else {
+    strcpy(alarmJson, json);
+    rc = queue.publish(client, ALARM_TOPIC, alarmJson, strlen(alarmJson), MQTT::QOS1, false, MQTT::URGENT);
+  }
+  if (rc != 0) {
+    Serial.print(F("Alarm publish failed with return code : "));
+    Serial.println(rc);
+  }
+}
+
+// keeps taking readings while disconnected, they are queued
+void sample(void*) {
+
   /* INPUTS */
   
   // Smoke sensor
-  int smokePin = 14;
   int smoke = 0;     
-  smoke = analogRead(smokePin);     
+  smoke = analogRead(SMOKE_PIN);     
 
   // Movement sensor
   int movePin = 15;
@@ -74,83 +314,44 @@ void loop() {
   dht11 tempSensor;
   int chk = tempSensor.read(tempPin);
 
-  
-/****************************************************/
-  int rc = -1;
-  if (!client.isConnected()) {
-    Serial.print("Connecting using Registered mode with clientid : ");
-    Serial.print(CLIENT_ID);
-    Serial.print("\tto MQTT Broker : ");
-    Serial.print(MS_PROXY);
-    Serial.print("\ton topic : ");
-    Serial.println(PUBLISH_TOPIC);
-    
-    ipstack.connect(MS_PROXY, MQTT_PORT);
-    
-    MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
-    options.MQTTVersion = 3;
-    options.clientID.cstring = CLIENT_ID;
-    options.username.cstring = AUTHMETHOD;
-    options.password.cstring = AUTHTOKEN;
-    options.keepAliveInterval = 10;
-    rc = -1;
-    while ((rc = client.connect(options)) != 0)
-      ;
-    //unsubscribe the topic, if it had subscribed it before.
- 
-    client.unsubscribe(SUBSCRIBE_TOPIC);
-    //Try to subscribe for commands
-    if ((rc = client.subscribe(SUBSCRIBE_TOPIC, MQTT::QOS0, messageArrived)) != 0) {
-            Serial.print("Subscribe failed with return code : ");
-            Serial.println(rc);
-    } else {
-          Serial.println("Subscribed\n");
-    }
-    Serial.println("Subscription tried......");
-    Serial.println("Connected successfully\n");
-    Serial.println("Sensor Values");
-    Serial.println("____________________________________________________________________________");
-  }
+  /****************************************************/
 
-  MQTT::Message message;
-  message.qos = MQTT::QOS0; 
-  message.retained = false;
+  // the readings which changed go to the datastore together, in one Bridge frame
+  char state[5][8];
+  itoa(smoke, state[0], 10);
+  itoa(movement, state[1], 10);
+  itoa(tempSensor.humidity, state[2], 10);
+  itoa(tempSensor.temperature, state[3], 10);
+  dtostrf(tempSensor.dewPoint(), 1, 1, state[4]);
+  for (int i = 0; i < 5; i++) {
+    roomState.put(stateKeys[i], state[i]);
+  }
+  roomState.sync();
 
-  /****************************************************/
-  
-  String smokeJson = "{\"d\":{\"device\":\"Arduino Yun\",\"s\":" + String(smoke) + "   }}";
-  String humJson = "{\"d\":{\"device\":\"Arduino Yun\",\"h\":" + (String)tempSensor.humidity + "    }}";
-  String tempJson = "{\"d\":{\"device\":\"Arduino Yun\",\"t\":" + (String)tempSensor.temperature + "    }}";
-  String dewJson = "{\"d\":{\"device\":\"Arduino Yun\",\"dp\":" + (String)tempSensor.dewPoint() +   "}}";
-  String moveJson = "{\"d\":{\"device\":\"Arduino Yun\",\"m\":" + (String)movement + "   }}";
+  // the JSON text comes from flash, only the Strings built from it take RAM
+  String smokeJson = String(F("{\"d\":{\"device\":\"Arduino Yun\",\"s\":")) + String(smoke) + F("   }}");
+  String humJson = String(F("{\"d\":{\"device\":\"Arduino Yun\",\"h\":")) + (String)tempSensor.humidity + F("    }}");
+  String tempJson = String(F("{\"d\":{\"device\":\"Arduino Yun\",\"t\":")) + (String)tempSensor.temperature + F("    }}");
+  String dewJson = String(F("{\"d\":{\"device\":\"Arduino Yun\",\"dp\":")) + (String)tempSensor.dewPoint() +   F("}}");
+  String moveJson = String(F("{\"d\":{\"device\":\"Arduino Yun\",\"m\":")) + (String)movement + F("   }}");
 
-  String json = "";
-  
-  switch(decider) {
-      case 0 :
-         json = smokeJson;
-         decider += 1;
-         break;
-      case 1 :
-         json = moveJson;
-         decider += 1;
-         break;
-      case 2 :
-         json = humJson;
-         decider += 1;
-         break;
-      case 3 :
-         json = tempJson;
-         decider += 1;
-         break;
-      case 4 :
-         json = dewJson;
-         decider += 1;
-         break;
-      default :
-         printf("Invalid message\n" );
+  // hold the five publishes back and hand them to the Bridge together
+  client.cork();
+  publishReading(smokeJson);
+  publishReading(moveJson);
+  publishReading(humJson);
+  publishReading(tempJson);
+  publishReading(dewJson);
+  int rc = client.uncork();
+  if (rc != 0) {
+    Serial.print(F("Message publish failed with return code : "));
+    Serial.println(rc); 
   }
 
+  Serial.println(F("Waiting..."));
+}
+
+void publishReading(String& json) {
   int i;
   char *msg =  (char*)malloc (json.length() * sizeof (char));
   for (i = 0; i < json.length(); i++) {
@@ -162,68 +363,97 @@ void loop() {
   }
   Serial.println();
   
-  message.payload = msg; 
-  message.payloadlen = strlen(msg);
-  
-  rc = client.publish(PUBLISH_TOPIC, message);
+  // copied into the transmit batch or the queue, so msg can be freed straight away
+  int rc = queue.publish(client, publishTopic, msg, json.length(), MQTT::QOS0, false);
   if (rc != 0) {
-    Serial.print("Message publish failed with return code : ");
+    Serial.print(F("Message publish failed with return code : "));
     Serial.println(rc); 
   }
+  free(msg);
+}
 
-  if (decider == 5) {
-    decider = 0;
-    client.yield(5000);
-    Serial.println("Waiting...");
+void ackArrived(int packetType, unsigned short packetId, int rc) {
+  switch (packetType) {
+    case CONNACK :
+      if (rc != 0) {
+        Serial.print(F("Connect failed with return code : "));
+        Serial.println(rc);
+        break;
+      }
+      if (!client.sessionPresent()) {
+        // a new session: the broker has no subscription for us yet
+        client.subscribe(commandFilter, MQTT::QOS0);
+        break;
+      }
+      Serial.println(F("Session resumed, still subscribed"));
+      printBanner();
+      break;
+    case SUBACK :
+      if (rc != 0) {
+        Serial.print(F("Subscribe failed with return code : "));
+        Serial.println(rc);
+      } else {
+        Serial.println(F("Subscribed\n"));
+      }
+      Serial.println(F("Subscription tried......"));
+      printBanner();
+      break;
   }
-  client.yield(2000);
-  free(msg);
 }
 
-void messageArrived(MQTT::MessageData& md) {
-    Serial.print("\nMessage Received\t");
-    MQTT::Message &message = md.message;
-    int topicLen = strlen(md.topicName.lenstring.data) + 1;
+void printBanner() {
+  Serial.println(F("Connected successfully\n"));
+  Serial.println(F("Sensor Values"));
+  Serial.println(F("____________________________________________________________________________"));
+}
 
-    char * topic = md.topicName.lenstring.data;
-    topic[topicLen] = '\0';
-    
-    int payloadLen = message.payloadlen + 1;
+// bytes left between the heap and the stack, for the Strings and the calls of loop
+int freeRam() {
+  extern int __heap_start, *__brkval;
+  int top;
+  return (int)&top - (__brkval == 0 ? (int)&__heap_start : (int)__brkval);
+}
 
-    char * payload = (char*)message.payload;
-    payload[payloadLen] = '\0';
-    
-    String topicStr = topic;
-    String payloadStr = payload;
-    int payloadInt = *payload;
-    Serial.print(payloadInt);
-    Serial.print("-");
+void messageArrived(MQTT::MessageView& msg) {
+    Serial.print(F("\nMessage Received\t"));
+    MQTT::View command = msg.wildcard(0);    // the + of iot-2/cmd/+/fmt/json
+    Serial.write((const uint8_t*)command.data, command.len);
+    Serial.print(F("\t"));
+
+    // the payload is the relay code, a single digit
+    long code;
+    if (!msg.payload.toInt(code)) {
+      Serial.println(F("Payload is not a number"));
+      return;
+    }
+    Serial.print(code);
+    Serial.print(F("-"));
     Serial.print(1);
 
     // Lights on - relay IN1
-    if (payloadInt == 49) {
+    if (code == 1) {
       digitalWrite(13, LOW);
     }
     // Lights off - relay IN1
-    else if (payloadInt == 50) {
+    else if (code == 2) {
       digitalWrite(13, HIGH);
     }
     
     // Air conditioner on - relay IN2
-    if (payloadInt == 51) {
+    if (code == 3) {
       digitalWrite(12, HIGH);
     }
     // Air conditioner off - relay IN2
-    else if (payloadInt == 53) {
+    else if (code == 5) {
       digitalWrite(12, LOW);
     }
 
     // Curtain on - relay IN3
-    if (payloadInt == 54) {
+    if (code == 6) {
       digitalWrite(11, HIGH);
     }
     // Curtaion off - relay IN3
-    else if (payloadInt == 55) {
+    else if (code == 7) {
       digitalWrite(11, LOW);
     }
   /*
@@ -0,0 +1,212 @@
+/*
+  Copyright (c) 2013 Arduino LLC. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * Host benchmark of the Bridge frame codec: encoding a frame to the stream and checking the CRC
+ * of one received, for payloads from 1 B to 4 KB.  "bytewise" is the way frames were handled
+ * before, a write() and a CRC update for each byte, "frame" is bridgeWriteFrame and bridgeCrc
+ * with whatever BRIDGE_CRC_SLICES the build has.  Built and run on the host, from this directory:
+ *
+ *   for n in 0 1 4 8; do
+ *     g++ -O2 -DBRIDGE_CRC_SLICES=$n -I../src FrameCodec.cpp ../src/BridgeFrame.cpp -o FrameCodec
+ *     ./FrameCodec
+ *   done
+ *
+ * Output is one CSV line per run: benchmark,codec,slices,bytes,ns_per_frame,MB_per_s,line_pct,check
+ * where bytes is the payload length, line_pct the CPU time as a percentage of the time the frame
+ * takes on the line at BRIDGE_BAUDRATE, and check a sum of the results, printed so that the work
+ * cannot be optimised away.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "BridgeFrame.h"
+
+#define BAUDRATE 250000     // BRIDGE_BAUDRATE: 10 bits on the line per byte
+#define MAX_PAYLOAD 4096
+#define WORK 100000000L     // bytes handled per run
+
+static uint8_t payload[MAX_PAYLOAD];
+static uint8_t frame[MAX_PAYLOAD + 6];
+
+// the two Stream::write calls, virtual as they are on the board
+struct ByteStream {
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buff, size_t n) = 0;
+  virtual ~ByteStream() { }
+};
+
+struct MemorySink : ByteStream {
+  uint8_t *out;
+  size_t used;
+  size_t write(uint8_t c) {
+    out[used++] = c;
+    return 1;
+  }
+  size_t write(const uint8_t *buff, size_t n) {
+    memcpy(out + used, buff, n);
+    used += n;
+    return n;
+  }
+};
+
+// reached through a pointer the compiler cannot see through, so the calls stay virtual
+static MemorySink sink;
+static ByteStream *volatile stream = &sink;
+
+// the generic per-byte CRC update Bridge.cpp had for non-AVR targets
+static uint16_t crcByte(uint16_t crc, uint8_t data)
+{
+  data ^= crc & 0xff;
+  data ^= data << 4;
+  return ((((uint16_t)data << 8) | ((crc >> 8) & 0xff)) ^
+          (uint8_t)(data >> 4) ^
+          ((uint16_t)data << 3));
+}
+
+// writeFrame as it was: every byte written and added to the CRC on its own
+static void writeBytewise(ByteStream &stream, uint8_t seq,
+                          const uint8_t *buff1, uint16_t len1,
+                          const uint8_t *buff2, uint16_t len2)
+{
+  uint16_t len = len1 + len2;
+  uint16_t crc = 0xFFFF;
+  uint8_t header[4] = { 0xFF, seq, (uint8_t)(len >> 8), (uint8_t)len };
+  for (int i = 0; i < 4; i++) {
+    stream.write(header[i]);
+    crc = crcByte(crc, header[i]);
+  }
+  for (uint16_t i = 0; i < len1; i++) {
+    stream.write(buff1[i]);
+    crc = crcByte(crc, buff1[i]);
+  }
+  for (uint16_t i = 0; i < len2; i++) {
+    stream.write(buff2[i]);
+    crc = crcByte(crc, buff2[i]);
+  }
+  stream.write((uint8_t)(crc >> 8));
+  stream.write((uint8_t)(crc & 0xFF));
+}
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long iterations(int bytes)
+{
+  long n = WORK / (bytes + 16);
+  return (n > 5000000) ? 5000000 : (n < 1000) ? 1000 : n;
+}
+
+static void report(const char *benchmark, const char *codec, int bytes, long n, double start, long check)
+{
+  double ns = (now_ns() - start) / n;
+  double line_ns = (bytes + 6) * 10 * 1e9 / BAUDRATE;
+  printf("%s,%s,%d,%d,%.1f,%.1f,%.3f,%ld\n", benchmark, codec, BRIDGE_CRC_SLICES, bytes, ns,
+         (bytes + 6) * 1e3 / ns, ns * 100 / line_ns, check);
+}
+
+// a command byte and the payload, as Console and BridgeClient writes are sent
+static void encode(int bytes)
+{
+  static const uint8_t cmd[] = { 'P' };
+  long n = iterations(bytes), check = 0;
+  double start;
+
+  sink.out = frame;
+  start = now_ns();
+  for (long i = 0; i < n; i++) {
+    sink.used = 0;
+    writeBytewise(*stream, (uint8_t)i, cmd, 1, payload, bytes - 1);
+    check += frame[sink.used - 1];
+  }
+  report("encode", "bytewise", bytes, n, start, check);
+
+  uint8_t chunk[BRIDGE_TX_CHUNK];
+  check = 0;
+  start = now_ns();
+  for (long i = 0; i < n; i++) {
+    sink.used = 0;
+    bridgeWriteFrame(*stream, chunk, sizeof(chunk), (uint8_t)i, cmd, 1, payload, bytes - 1, NULL, 0);
+    check += frame[sink.used - 1];
+  }
+  report("encode", "frame", bytes, n, start, check);
+}
+
+// the CRC check of a whole received frame
+static void decode(int bytes)
+{
+  long n = iterations(bytes), check = 0;
+  double start;
+  uint8_t chunk[BRIDGE_TX_CHUNK];
+
+  sink.out = frame;
+  sink.used = 0;
+  bridgeWriteFrame(*stream, chunk, sizeof(chunk), 1, payload, bytes, NULL, 0, NULL, 0);
+  uint16_t sent = (frame[bytes + 4] << 8) | frame[bytes + 5];
+
+  start = now_ns();
+  for (long i = 0; i < n; i++) {
+    uint16_t crc = 0xFFFF;
+    frame[1] = (uint8_t)i;
+    for (int j = 0; j < bytes + 4; j++)
+      crc = crcByte(crc, frame[j]);
+    check += (crc == sent);
+  }
+  report("decode", "bytewise", bytes, n, start, check);
+
+  check = 0;
+  start = now_ns();
+  for (long i = 0; i < n; i++) {
+    frame[1] = (uint8_t)i;
+    uint16_t crc = bridgeCrc(0xFFFF, frame, 4);
+    crc = bridgeCrc(crc, frame + 4, bytes);
+    check += (crc == sent);
+  }
+  report("decode", "frame", bytes, n, start, check);
+}
+
+int main()
+{
+  static const int sizes[] = { 1, 8, 32, 64, 256, 1024, 4096 };
+
+  for (int i = 0; i < MAX_PAYLOAD; i++)
+    payload[i] = (uint8_t)(i * 31 + 7);
+
+  // the table kernel must agree with the per-byte update
+  uint16_t a = 0xFFFF, b = bridgeCrc(0xFFFF, payload, MAX_PAYLOAD);
+  for (int i = 0; i < MAX_PAYLOAD; i++)
+    a = crcByte(a, payload[i]);
+  if (a != b) {
+    fprintf(stderr, "CRC mismatch: %04x %04x\n", a, b);
+    return 1;
+  }
+
+  printf("benchmark,codec,slices,bytes,ns_per_frame,MB_per_s,line_pct,check\n");
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    encode(sizes[i]);
+    decode(sizes[i]);
+  }
+  return 0;
+}
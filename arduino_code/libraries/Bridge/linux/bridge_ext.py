@@ -0,0 +1,278 @@
+# Linux-side commands for the extended Bridge library: the features it asks for with 'x' and
+# the datastore commands it uses once they are reported.  The sketch's own puts are taken over
+# from the datastore module, so that only changes made from the Linux side - the REST api or a
+# script - are counted for 'V'.
+#
+# Install on the Yun next to the stock bridge, and load it after the datastore module:
+#
+#   scp bridge_ext.py root@arduino.local:/usr/lib/python2.7/bridge/
+#
+# then in /usr/lib/python2.7/bridge/bridge.py, below "datastore.init(cp)":
+#
+#   import bridge_ext
+#   bridge_ext.init(cp)
+#
+# and restart the bridge (reset the sketch).  Without it the sketch sees no features and uses
+# the stock 'D' and 'd' commands, a key to a frame.
+#
+# Windowed transfers also need the packet layer below the commands to change, so they are
+# reported only once bridge.py runs the PacketReader here in place of the stock one:
+#
+#   bridge_ext.PacketReader(cp).run()
+#
+# It reads frames from stdin and writes the replies to stdout, as the stock reader does.
+
+import os
+import select
+import sys
+import time
+
+from datastore import datastore
+
+SEPARATOR = '\xFE'
+
+# The flags of BridgeClass::CAP_
+CAP_WINDOW = 0x01
+CAP_BATCH = 0x02
+CAP_CHANGES = 0x04
+
+capabilities = CAP_BATCH | CAP_CHANGES
+
+# Changes made to the datastore from the Linux side, never 0 - which tells the sketch that
+# the count is not kept
+changes = 1
+sketch_put = None       # the datastore's own put, for the sketch's puts
+
+
+def counted_put(key, value):
+  global changes
+  changes = changes % 0xFFFFFFFF + 1
+  sketch_put(key, value)
+
+
+class CapabilitiesCommand:
+  def run(self, data):
+    return chr(capabilities)
+
+
+# 'D' key 0xFE value, as the stock command but not counted
+class PutCommand:
+  def run(self, data):
+    fields = data.split(SEPARATOR, 1)
+    if len(fields) != 2:
+      return ''
+    sketch_put(fields[0], fields[1])
+    return ''
+
+
+# 'B' key 0xFE value [0xFE key 0xFE value]...
+class PutManyCommand:
+  def run(self, data):
+    fields = data.split(SEPARATOR)
+    if len(fields) % 2 != 0:
+      return ''
+    for i in range(0, len(fields), 2):
+      sketch_put(fields[i], fields[i + 1])
+    return ''
+
+
+# 'Y' key [0xFE key]..., answered with the values in the same order, 0xFE between them
+class GetManyCommand:
+  def run(self, data):
+    values = []
+    for key in data.split(SEPARATOR):
+      value = datastore.get(key)
+      values.append(value if value is not None else '')
+    return SEPARATOR.join(values)
+
+
+# 'V', answered with the count of changes, 4 bytes high byte first
+class ChangesCommand:
+  def run(self, data):
+    return ''.join([chr((changes >> shift) & 0xFF) for shift in (24, 16, 8, 0)])
+
+
+def init(command_processor):
+  global sketch_put
+  sketch_put = datastore.put
+  datastore.put = counted_put
+  command_processor.register('x', CapabilitiesCommand())
+  command_processor.register('D', PutCommand())
+  command_processor.register('B', PutManyCommand())
+  command_processor.register('Y', GetManyCommand())
+  command_processor.register('V', ChangesCommand())
+
+
+# Frames are kept as str, the type the commands take, under Python 2 and 3 alike
+if bytes is str:
+  def to_text(raw):
+    return raw
+
+  def to_raw(text):
+    return text
+else:
+  def to_text(raw):
+    return raw.decode('latin-1')
+
+  def to_raw(text):
+    return text.encode('latin-1')
+
+
+# CRC-CCITT as avr-libc's _crc_ccitt_update, which the sketch uses
+def crc_update(crc, data):
+  data ^= crc & 0xFF
+  data = (data ^ (data << 4)) & 0xFF
+  return (((data << 8) | (crc >> 8)) ^ (data >> 4) ^ (data << 3)) & 0xFFFF
+
+
+def crc(buff, value=0xFFFF):
+  for c in bytearray(buff):
+    value = crc_update(value, c)
+  return value
+
+
+# Reads frames - 0xFF, index, length (hi, lo), payload, CRC (hi, lo) - runs their commands and
+# writes the replies under the same index.
+#
+# At first it works as the stock reader: a frame with the index of the one before is a resend,
+# answered with the reply kept, and anything else is run.  Once it has answered 'x' with
+# CAP_WINDOW the frames are windowed: run in index order, whatever order they come in, with
+# those which arrive ahead of a lost one held until it is sent again.  The replies to the last
+# HISTORY frames are kept, so that a frame sent again because its reply was lost is answered,
+# not run again.  A lost frame which has not come in GAP_TIMEOUT s has been given up on by the
+# sketch, and the frames held are run without it.  A version query or the quit command go back
+# to the stock behaviour, as the sketch does in begin().
+class PacketReader:
+  HISTORY = 16
+  AHEAD = 64              # further ahead than this an index is not a frame of this window
+  GAP_TIMEOUT = 6.0       # the sketch gives up on a frame after 50 tries, 100 ms apart
+  FRAME_TIMEOUT = 0.1     # a frame not whole by then was cut short or was not a frame
+
+  def __init__(self, processor, infile=None, outfile=None):
+    global capabilities
+    capabilities |= CAP_WINDOW
+    self.processor = processor
+    self.infile = infile if infile is not None else sys.stdin
+    self.outfile = outfile if outfile is not None else sys.stdout
+    self.buff = bytearray()
+    self.started = 0
+    self.last_index = None
+    self.last_reply = None
+    self.next = None      # the index of the next frame to run once windowed
+    self.held = {}
+    self.held_since = 0
+    self.replies = {}
+
+  def run(self):
+    while not self.processor.finished:
+      self.poll(0.1)
+
+  # Take in what stdin has within timeout s and handle the frames in it
+  def poll(self, timeout):
+    fd = self.infile.fileno()
+    readable = select.select([fd], [], [], timeout)[0]
+    now = time.time()
+    if readable:
+      data = os.read(fd, 1024)
+      if not data:
+        self.processor.finished = True
+        return
+      if not self.buff:
+        self.started = now
+      self.buff.extend(data)
+    while self.take(now):
+      pass
+    if self.held and now - self.held_since > self.GAP_TIMEOUT:
+      self.skip()
+
+  # Handle the frame at the start of buff, if it is whole
+  def take(self, now):
+    start = self.buff.find(b'\xFF')
+    if start < 0:
+      del self.buff[:]
+      return False
+    if start > 0:
+      del self.buff[:start]
+      self.started = now
+    if len(self.buff) < 4:
+      return self.resync(now)
+    length = (self.buff[2] << 8) | self.buff[3]
+    if len(self.buff) < length + 6:
+      return self.resync(now)
+    frame = bytes(self.buff[:length + 4])
+    check = (self.buff[length + 4] << 8) | self.buff[length + 5]
+    if crc(frame) != check:
+      del self.buff[:1]   # not a frame, or a damaged one: the sketch sends it again
+      self.started = now
+      return True
+    del self.buff[:length + 6]
+    self.started = now
+    self.frame(bytearray(frame)[1], to_text(frame[4:]))
+    return True
+
+  # A start of frame which is not followed by the rest in time is dropped
+  def resync(self, now):
+    if now - self.started > self.FRAME_TIMEOUT:
+      del self.buff[:1]
+      self.started = now
+      return True
+    return False
+
+  def frame(self, index, data):
+    if data == 'XXXXX' or data[0:2] == 'XX':
+      self.next = None
+      self.held = {}
+      self.replies = {}
+      self.last_index = None
+
+    if self.next is None:
+      if index == self.last_index:
+        self.send(index, self.last_reply)
+        return
+      reply = self.processor.process(data)
+      self.last_index = index
+      self.last_reply = reply
+      self.send(index, reply)
+      if data == 'x' and reply and ord(reply[0]) & CAP_WINDOW:
+        self.next = (index + 1) & 0xFF
+        self.replies = {index: reply}
+      return
+
+    behind = (self.next - index) & 0xFF
+    if 1 <= behind <= self.HISTORY:
+      if index in self.replies:
+        self.send(index, self.replies[index])
+      return
+    if (index - self.next) & 0xFF >= self.AHEAD:
+      return
+    if not self.held:
+      self.held_since = time.time()
+    self.held[index] = data
+    self.run_held()
+
+  def run_held(self):
+    while self.next in self.held:
+      index = self.next
+      reply = self.processor.process(self.held.pop(index))
+      self.replies[index] = reply
+      self.replies.pop((index - self.HISTORY) & 0xFF, None)
+      self.send(index, reply)
+      self.next = (index + 1) & 0xFF
+    if self.held:
+      self.held_since = time.time()
+
+  # Run the frames held without the one which never came
+  def skip(self):
+    self.next = min(self.held, key=lambda index: (index - self.next) & 0xFF)
+    self.run_held()
+
+  def send(self, index, reply):
+    if reply is None:
+      return
+    raw = to_raw(reply)
+    frame = bytearray([0xFF, index, (len(raw) >> 8) & 0xFF, len(raw) & 0xFF]) + bytearray(raw)
+    value = crc(frame)
+    frame += bytearray([value >> 8, value & 0xFF])
+    out = getattr(self.outfile, 'buffer', self.outfile)
+    out.write(bytes(frame))
+    out.flush()
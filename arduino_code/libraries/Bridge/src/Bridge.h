@@ -23,6 +23,23 @@
 #define BRIDGE_BAUDRATE 250000
 #endif
 
+// Frames which may wait for their replies at once, when the Linux side reports CAP_WINDOW -
+// as linux/bridge_ext.py does once its PacketReader runs.  0 leaves only stop-and-wait
+// transfers and saves the RAM of the window.
+#ifndef BRIDGE_WINDOW
+#define BRIDGE_WINDOW 4
+#endif
+
+// Largest frame post() copies into the window, larger ones are sent by transfer()
+#ifndef BRIDGE_WINDOW_FRAME
+#define BRIDGE_WINDOW_FRAME 32
+#endif
+
+// Largest datastore frame putMany() and getMany() pack keys and values into, on the stack
+#ifndef BRIDGE_KV_FRAME
+#define BRIDGE_KV_FRAME 64
+#endif
+
 #include <Arduino.h>
 #include <Stream.h>
 
@@ -44,6 +61,35 @@ class BridgeClass {
       return get(key, reinterpret_cast<uint8_t *>(value), maxlen);
     }
 
+    // The count of changes made to the datastore from the Linux side, for a cache of it to
+    // tell whether what it holds is still current, or 0 if the bridge does not report
+    // CAP_CHANGES.  Changes made by the sketch itself do not count.
+    unsigned long getDatastoreVersion();
+
+    // Put count key/value pairs, as many to a frame as fit in BRIDGE_KV_FRAME, so that a
+    // whole set of readings costs one round trip with a bridge which has CAP_BATCH.  Keys may
+    // be in flash, with F().  Returns how many pairs the Linux side acknowledged: the first
+    // ones, as sending stops at the first pair which is not.
+    uint8_t putMany(const char * const keys[], const char * const values[], uint8_t count)
+    {
+      return putPairs(keys, false, values, count);
+    }
+    uint8_t putMany(const __FlashStringHelper * const keys[], const char * const values[], uint8_t count)
+    {
+      return putPairs(reinterpret_cast<const char * const *>(keys), true, values, count);
+    }
+    // Get the values of count keys into buff, each '\0' terminated, and point values at them.
+    // Returns how many were read: values past those are NULL, and the last may be cut short
+    // if buff is full.
+    uint8_t getMany(const char * const keys[], uint8_t count, char *buff, unsigned int size, char *values[])
+    {
+      return getValues(keys, false, count, buff, size, values);
+    }
+    uint8_t getMany(const __FlashStringHelper * const keys[], uint8_t count, char *buff, unsigned int size, char *values[])
+    {
+      return getValues(reinterpret_cast<const char * const *>(keys), true, count, buff, size, values);
+    }
+
     // Trasnfer a frame (with error correction and response)
     uint16_t transfer(const uint8_t *buff1, uint16_t len1,
                       const uint8_t *buff2, uint16_t len2,
@@ -66,23 +112,116 @@ class BridgeClass {
       return transfer(buff1, len1, buff2, len2, NULL, 0, rxbuff, rxlen);
     }
 
+    // Send a frame whose reply carries nothing the caller needs.  With a windowed
+    // bridge the call returns without waiting for the reply, otherwise it is a transfer()
+    void post(const uint8_t *buff1, uint16_t len1,
+              const uint8_t *buff2 = NULL, uint16_t len2 = 0);
+
     uint16_t getBridgeVersion()
     {
       return bridgeVersion;
     }
 
+    // The features the Linux side reported at begin(), CAP_ flags
+    uint8_t getCapabilities()
+    {
+      return capabilities;
+    }
+
+    // True if frames are sent without waiting for the replies to those before
+    bool isWindowed()
+    {
+      return windowed;
+    }
+
     static const uint16_t TRANSFER_TIMEOUT = 0xFFFF;
+    static const uint16_t TRANSFER_PENDING = 0xFFFE;
+
+    // Features beyond the stock bridge, which begin() asks the Linux side for with 'x': the
+    // reply is a byte of these flags.  A bridge which does not know 'x' has none of them.
+    //
+    // Windowed transfers: the Linux side runs frames in sequence order, holding those which
+    // arrive after a lost one, and keeps the reply to each sequence number in the window so
+    // that a frame sent again is answered, not run again
+    static const uint8_t CAP_WINDOW = 0x01;
+
+    // Several datastore keys to a frame: 'B' with key 0xFE value pairs, 0xFE between them,
+    // and 'Y' with keys, whose reply is the values
+    static const uint8_t CAP_BATCH = 0x02;
+
+    // A count of the changes made to the datastore from the Linux side, the REST api or a
+    // script, which 'V' is answered with: 4 bytes, high byte first
+    static const uint8_t CAP_CHANGES = 0x04;
+
+#if BRIDGE_WINDOW > 0
+    // Send a frame and return a ticket for its reply, without waiting for it.  The reply is
+    // written to rxbuff, which must stay valid until response() has returned it or cancel().
+    // Returns -1 if the bridge is not windowed or the window is full: use transfer() then
+    int8_t request(const uint8_t *buff1, uint16_t len1, uint8_t *rxbuff, uint16_t rxlen);
+    // The length of the reply to a ticket, which is then done with, or TRANSFER_PENDING
+    uint16_t response(int8_t ticket);
+    // Give up a ticket: its reply, if one still comes, is dropped
+    void cancel(int8_t ticket);
+#endif
+    // Wait until every frame sent has been answered or has run out of retries
+    void drain();
 
   private:
     uint8_t index;
     int timedRead(unsigned int timeout);
     void dropAll();
+    void writeFrame(uint8_t seq,
+                    const uint8_t *buff1, uint16_t len1,
+                    const uint8_t *buff2, uint16_t len2,
+                    const uint8_t *buff3, uint16_t len3);
     uint16_t bridgeVersion;
+    uint8_t capabilities;
+    bool windowed;
+
+    uint8_t putPairs(const char * const keys[], bool flashKeys, const char * const values[], uint8_t count);
+    bool putLongKey(const char *key, bool flashKey, const char *value);
+    uint8_t getValues(const char * const keys[], bool flashKeys, uint8_t count,
+                      char *buff, unsigned int size, char *values[]);
+
+#if BRIDGE_WINDOW > 0
+  private:
+    static const unsigned int RETRANSMIT_TIMEOUT = 100;
+    // The Linux side keeps the replies to this many frames before the next it expects, so no
+    // frame goes out further ahead of the oldest one still waiting for its reply
+    static const uint8_t WINDOW_SPAN = 16;
+
+    enum { FRAME_FREE, FRAME_SENT, FRAME_DONE };
+
+    // a frame in the window
+    struct Frame {
+      uint8_t state;
+      uint8_t seq;              // the index byte it was sent with
+      uint8_t tries;
+      bool owned;               // someone will collect the reply: transfer() or a ticket
+      unsigned long sent;       // millis() of the last send
+      const uint8_t *buff1, *buff2, *buff3;
+      uint16_t len1, len2, len3;
+      uint8_t *rxbuff;
+      uint16_t rxlen;
+      uint16_t result;          // the reply length once FRAME_DONE, or TRANSFER_TIMEOUT
+      uint8_t data[BRIDGE_WINDOW_FRAME];   // posted frames are copied here
+    };
+    Frame frames[BRIDGE_WINDOW];
+
+    int8_t queue(const uint8_t *buff1, uint16_t len1,
+                 const uint8_t *buff2, uint16_t len2,
+                 const uint8_t *buff3, uint16_t len3,
+                 uint8_t *rxbuff, uint16_t rxlen, bool owned);
+    int8_t freeFrames();
+    void service(unsigned int timeout);
+    void receive(unsigned int timeout);
+    void finish(Frame &f, uint16_t result);
+    void resetWindow();
+#endif
 
   private:
     void crcUpdate(uint8_t c);
     void crcReset();
-    void crcWrite();
     bool crcCheck(uint16_t _CRC);
     uint16_t CRC;
 
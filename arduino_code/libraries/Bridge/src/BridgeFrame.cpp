@@ -0,0 +1,93 @@
+/*
+  Copyright (c) 2013 Arduino LLC. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "BridgeFrame.h"
+
+#if BRIDGE_CRC_SLICES > 0
+
+// Slicing tables: table[0] is the usual byte table, table[k][i] the CRC of byte i followed by k
+// zero bytes, so that k + 1 bytes are folded in with one lookup each.  Built when the sketch
+// starts, from table[0].
+static struct CrcTables {
+  uint16_t table[BRIDGE_CRC_SLICES][256];
+
+  CrcTables() {
+    for (uint16_t i = 0; i < 256; i++) {
+      uint16_t crc = i;
+      for (uint8_t bit = 0; bit < 8; bit++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+      table[0][i] = crc;
+    }
+    for (uint8_t k = 1; k < BRIDGE_CRC_SLICES; k++)
+      for (uint16_t i = 0; i < 256; i++)
+        table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+  }
+} crcTables;
+
+uint16_t bridgeCrcUpdate(uint16_t crc, uint8_t data) {
+  return (crc >> 8) ^ crcTables.table[0][(crc ^ data) & 0xFF];
+}
+
+uint16_t bridgeCrc(uint16_t crc, const uint8_t *buff, uint16_t len) {
+  const uint16_t (*t)[256] = crcTables.table;
+#if BRIDGE_CRC_SLICES >= 8
+  for ( ; len >= 8; len -= 8, buff += 8) {
+    crc ^= buff[0] | (buff[1] << 8);
+    crc = t[7][crc & 0xFF] ^ t[6][crc >> 8] ^ t[5][buff[2]] ^ t[4][buff[3]] ^
+          t[3][buff[4]] ^ t[2][buff[5]] ^ t[1][buff[6]] ^ t[0][buff[7]];
+  }
+#endif
+#if BRIDGE_CRC_SLICES >= 4
+  for ( ; len >= 4; len -= 4, buff += 4) {
+    crc ^= buff[0] | (buff[1] << 8);
+    crc = t[3][crc & 0xFF] ^ t[2][crc >> 8] ^ t[1][buff[2]] ^ t[0][buff[3]];
+  }
+#endif
+  while (len-- > 0)
+    crc = (crc >> 8) ^ t[0][(crc ^ *buff++) & 0xFF];
+  return crc;
+}
+
+#else
+
+#if defined(ARDUINO_ARCH_AVR)
+// AVR use an optimized implementation of CRC
+#include <util/crc16.h>
+#else
+// Generic implementation for non-AVR architectures
+static uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+  data ^= crc & 0xff;
+  data ^= data << 4;
+  return ((((uint16_t)data << 8) | ((crc >> 8) & 0xff)) ^
+          (uint8_t)(data >> 4) ^
+          ((uint16_t)data << 3));
+}
+#endif
+
+uint16_t bridgeCrcUpdate(uint16_t crc, uint8_t data) {
+  return _crc_ccitt_update(crc, data);
+}
+
+uint16_t bridgeCrc(uint16_t crc, const uint8_t *buff, uint16_t len) {
+  while (len-- > 0)
+    crc = _crc_ccitt_update(crc, *buff++);
+  return crc;
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+  Copyright (c) 2013 Arduino LLC. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef BRIDGE_FRAME_H_
+#define BRIDGE_FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Frames are 0xFF, index, length (hi, lo), payload and a CRC-CCITT (hi, lo) of all that came
+// before it: the reflected polynomial 0x8408 started at 0xFFFF, as avr-libc's _crc_ccitt_update.
+
+// Bytes the CRC table kernel takes at a time: 1, 4 or 8, with 256 * 2 bytes of RAM for each.
+// 0 leaves the byte-at-a-time update without a table, which is the assembler one on AVR.
+#ifndef BRIDGE_CRC_SLICES
+#if defined(ARDUINO_ARCH_AVR)
+#define BRIDGE_CRC_SLICES 0
+#else
+#define BRIDGE_CRC_SLICES 4
+#endif
+#endif
+
+// Bytes of a frame assembled on the stack before they are written to the stream in one go
+#ifndef BRIDGE_TX_CHUNK
+#if defined(ARDUINO_ARCH_AVR)
+#define BRIDGE_TX_CHUNK 32
+#else
+#define BRIDGE_TX_CHUNK 64
+#endif
+#endif
+
+uint16_t bridgeCrcUpdate(uint16_t crc, uint8_t data);
+uint16_t bridgeCrc(uint16_t crc, const uint8_t *buff, uint16_t len);
+
+// Write a frame to sink through buff, size bytes at a time.  The CRC is taken over each payload
+// segment as a whole, and the frame goes out in as few sink.write(buff, n) calls as buff allows:
+// one, for any frame of up to size - 6 bytes of payload.
+template<class Sink>
+void bridgeWriteFrame(Sink &sink, uint8_t *buff, uint16_t size, uint8_t seq,
+                      const uint8_t *buff1, uint16_t len1,
+                      const uint8_t *buff2, uint16_t len2,
+                      const uint8_t *buff3, uint16_t len3)
+{
+  const uint8_t *segment[3] = { buff1, buff2, buff3 };
+  uint16_t length[3] = { len1, len2, len3 };
+  uint16_t len = len1 + len2 + len3;
+  uint16_t used = 4;
+
+  buff[0] = 0xFF;                 // Start of packet (0xFF)
+  buff[1] = seq;                  // Message index
+  buff[2] = (len >> 8) & 0xFF;    // Message length (hi)
+  buff[3] = len & 0xFF;           // Message length (lo)
+  uint16_t crc = bridgeCrc(0xFFFF, buff, 4);
+
+  for (uint8_t s = 0; s < 3; s++) {
+    const uint8_t *data = segment[s];
+    uint16_t left = length[s];
+    if (left == 0)
+      continue;
+    crc = bridgeCrc(crc, data, left);
+    while (left > 0) {
+      uint16_t n = size - used;
+      if (n > left)
+        n = left;
+      memcpy(buff + used, data, n);
+      used += n;
+      data += n;
+      left -= n;
+      if (used == size) {
+        sink.write(buff, used);
+        used = 0;
+      }
+    }
+  }
+
+  if (used + 2 > size) {
+    sink.write(buff, used);
+    used = 0;
+  }
+  buff[used++] = crc >> 8;        // CRC
+  buff[used++] = crc & 0xFF;
+  sink.write(buff, used);
+}
+
+#endif
@@ -48,7 +48,7 @@ BridgeClient BridgeServer::accept() {
 
 size_t BridgeServer::write(uint8_t c) {
   uint8_t cmd[] = { 'b', c };
-  bridge.transfer(cmd, 2);
+  bridge.post(cmd, 2);
   return 1;
 }
 
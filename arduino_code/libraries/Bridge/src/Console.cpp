@@ -41,7 +41,7 @@ ConsoleClass::~ConsoleClass() {
 size_t ConsoleClass::write(uint8_t c) {
   if (autoFlush) {
     uint8_t tmp[] = { 'P', c };
-    bridge.transfer(tmp, 2);
+    bridge.post(tmp, 2);
   } else {
     outBuffer[outBuffered++] = c;
     if (outBuffered == outBufferSize)
@@ -53,7 +53,7 @@ size_t ConsoleClass::write(uint8_t c) {
 size_t ConsoleClass::write(const uint8_t *buff, size_t size) {
   if (autoFlush) {
     uint8_t tmp[] = { 'P' };
-    bridge.transfer(tmp, 1, buff, size, NULL, 0);
+    bridge.post(tmp, 1, buff, size);
   } else {
     size_t sent = size;
     while (sent > 0) {
@@ -70,7 +70,7 @@ void ConsoleClass::flush() {
   if (autoFlush)
     return;
 
-  bridge.transfer(outBuffer, outBuffered);
+  bridge.post(outBuffer, outBuffered);
   outBuffered = 1;
 }
 
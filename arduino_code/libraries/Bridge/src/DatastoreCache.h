@@ -0,0 +1,259 @@
+/*
+  Copyright (c) 2013 Arduino LLC. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef DATASTORE_CACHE_H_
+#define DATASTORE_CACHE_H_
+
+#include <Bridge.h>
+
+// Keys are compared by address first, so that the same literal costs no strcmp
+inline bool datastoreKeyEquals(const char *a, const char *b) {
+  return a == b || strcmp(a, b) == 0;
+}
+
+inline bool datastoreKeyEquals(const __FlashStringHelper *a, const __FlashStringHelper *b) {
+  if (a == b)
+    return true;
+  const char *pa = reinterpret_cast<const char *>(a);
+  const char *pb = reinterpret_cast<const char *>(b);
+  for (;; pa++, pb++) {
+    char c = pgm_read_byte(pa);
+    if (c != (char)pgm_read_byte(pb))
+      return false;
+    if (c == '\0')
+      return true;
+  }
+}
+
+// Write-behind cache of up to ENTRIES datastore keys, with values of up to VALUE_SIZE chars.
+//
+// get() fetches a key from the Linux side once and then answers from RAM.  put() only changes
+// the value held, and a put() of the value a key already has costs nothing.  The keys changed
+// go to the Linux side together, in as few putMany() frames as they fit, on sync() or from
+// poll() once the oldest change is flushInterval ms old.  Every refreshInterval ms poll() asks
+// the bridge for its datastore version, and forgets the values it has read if something on the
+// Linux side has changed the datastore since; a bridge without CAP_CHANGES has them forgotten
+// every refreshInterval instead.  A refreshInterval of 0 never forgets them, for a sketch which
+// is the only one to write its keys.
+//
+// Keys are not copied: they must outlive the cache, as literals or F() strings do.  Key is the
+// type of them, const char * or const __FlashStringHelper *.  A longer value than VALUE_SIZE
+// goes straight through the bridge, as does everything when the cache is full of changes it
+// cannot flush.
+template<class Key = const char *, uint8_t ENTRIES = 8, uint8_t VALUE_SIZE = 15>
+class DatastoreCache {
+  public:
+    DatastoreCache(BridgeClass &_b = Bridge, unsigned long _flushInterval = 1000,
+                   unsigned long _refreshInterval = 5000) :
+      bridge(_b), flushInterval(_flushInterval), refreshInterval(_refreshInterval),
+      dirtySince(0), refreshed(0), version(0), clock(0), dirtyCount(0), savedCount(0)
+    {
+      for (uint8_t i = 0; i < ENTRIES; i++)
+        entries[i].state = EMPTY;
+    }
+
+    void put(Key key, const char *value) {
+      unsigned int l = strlen(value);
+      Entry *e = find(key);
+      if (e != NULL && strcmp(e->value, value) == 0) {
+        e->used = ++clock;
+        savedCount++;           // the Linux side has it already, or will with the next flush
+        return;
+      }
+      if (l > VALUE_SIZE) {
+        if (e != NULL)
+          drop(e);
+        bridge.putMany(&key, &value, 1);
+        return;
+      }
+      if (e == NULL)
+        e = take(key);
+      if (e == NULL) {
+        bridge.putMany(&key, &value, 1);
+        return;
+      }
+      if (e->state == DIRTY)
+        savedCount++;           // the earlier change is never sent
+      else
+        markDirty(e);
+      memcpy(e->value, value, l + 1);
+      e->used = ++clock;
+    }
+
+    // Copy the value of key into value, a buffer of size bytes, '\0' terminated, and return
+    // its length.  Changes not yet flushed are read back as they are.
+    unsigned int get(Key key, char *value, unsigned int size) {
+      if (size == 0)
+        return 0;
+      Entry *e = find(key);
+      if (e != NULL) {
+        savedCount++;
+        e->used = ++clock;
+        return copy(e->value, value, size);
+      }
+
+      // one byte more than is kept, to tell a value which fits from one which was cut short
+      char buff[VALUE_SIZE + 2];
+      char *values[1];
+      if (bridge.getMany(&key, 1, buff, sizeof(buff), values) != 1) {
+        value[0] = '\0';
+        return 0;
+      }
+      unsigned int l = strlen(buff);
+      if (l > VALUE_SIZE) {
+        if (size <= sizeof(buff))
+          return copy(buff, value, size);
+        if (bridge.getMany(&key, 1, value, size, values) != 1) {
+          value[0] = '\0';
+          return 0;
+        }
+        return strlen(value);
+      }
+      e = take(key);
+      if (e != NULL) {
+        e->state = CLEAN;
+        e->used = ++clock;
+        memcpy(e->value, buff, l + 1);
+      }
+      return copy(buff, value, size);
+    }
+
+    // Send every change now.  Those the Linux side does not acknowledge stay changed, for
+    // poll() to send again.
+    void sync() {
+      Key keys[ENTRIES];
+      const char *values[ENTRIES];
+      uint8_t sent[ENTRIES];
+      uint8_t count = 0;
+      for (uint8_t i = 0; i < ENTRIES; i++) {
+        if (entries[i].state != DIRTY)
+          continue;
+        keys[count] = entries[i].key;
+        sent[count] = i;
+        values[count++] = entries[i].value;
+      }
+      if (count == 0)
+        return;
+      uint8_t acked = bridge.putMany(keys, values, count);
+      for (uint8_t i = 0; i < acked; i++)
+        entries[sent[i]].state = CLEAN;
+      dirtyCount -= acked;
+    }
+
+    // Flush and refresh when they are due.  Call it from the main loop.
+    void poll() {
+      unsigned long now = millis();
+      if (dirtyCount > 0 && now - dirtySince >= flushInterval)
+        sync();
+      if (refreshInterval == 0 || now - refreshed < refreshInterval)
+        return;
+      refreshed = now;
+      unsigned long v = bridge.getDatastoreVersion();
+      if (v == 0 || v != version)
+        invalidate();
+      version = v;
+    }
+
+    // Forget the values read, so that the next get() of each fetches it again.  Changes not
+    // yet flushed are kept.
+    void invalidate() {
+      for (uint8_t i = 0; i < ENTRIES; i++)
+        if (entries[i].state == CLEAN)
+          entries[i].state = EMPTY;
+    }
+
+    // The gets answered and the puts left out without a frame to the Linux side
+    unsigned long saved() {
+      return savedCount;
+    }
+
+  private:
+    enum { EMPTY, CLEAN, DIRTY };
+
+    struct Entry {
+      Key key;
+      uint8_t state;
+      uint16_t used;            // clock of the last get() or put(), to evict the oldest
+      char value[VALUE_SIZE + 1];
+    };
+
+    Entry *find(Key key) {
+      for (uint8_t i = 0; i < ENTRIES; i++)
+        if (entries[i].state != EMPTY && datastoreKeyEquals(entries[i].key, key))
+          return &entries[i];
+      return NULL;
+    }
+
+    // An entry for key: an empty one, else the clean one used longest ago, else the one used
+    // longest ago once the changes are flushed
+    Entry *take(Key key) {
+      Entry *oldest = NULL;
+      for (uint8_t pass = 0; pass < 2 && oldest == NULL; pass++) {
+        for (uint8_t i = 0; i < ENTRIES; i++) {
+          Entry *e = &entries[i];
+          if (e->state == EMPTY) {
+            oldest = e;
+            break;
+          }
+          if (e->state == CLEAN && (oldest == NULL || (uint16_t)(clock - e->used) > (uint16_t)(clock - oldest->used)))
+            oldest = e;
+        }
+        if (oldest == NULL)
+          sync();
+      }
+      if (oldest != NULL) {
+        oldest->key = key;
+        oldest->state = CLEAN;
+      }
+      return oldest;
+    }
+
+    void markDirty(Entry *e) {
+      if (dirtyCount++ == 0)
+        dirtySince = millis();
+      e->state = DIRTY;
+    }
+
+    void drop(Entry *e) {
+      if (e->state == DIRTY)
+        dirtyCount--;
+      e->state = EMPTY;
+    }
+
+    static unsigned int copy(const char *from, char *to, unsigned int size) {
+      unsigned int l = strlen(from);
+      if (l >= size)
+        l = size - 1;
+      memcpy(to, from, l);
+      to[l] = '\0';
+      return l;
+    }
+
+    BridgeClass &bridge;
+    unsigned long flushInterval;
+    unsigned long refreshInterval;
+    unsigned long dirtySince;   // millis() of the oldest change not flushed
+    unsigned long refreshed;
+    unsigned long version;
+    uint16_t clock;
+    uint8_t dirtyCount;
+    unsigned long savedCount;
+    Entry entries[ENTRIES];
+};
+
+#endif
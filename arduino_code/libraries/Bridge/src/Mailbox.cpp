@@ -34,7 +34,7 @@ void MailboxClass::readMessage(String &str, unsigned int maxLength) {
 
 void MailboxClass::writeMessage(const uint8_t *buff, unsigned int size) {
   uint8_t cmd[] = {'M'};
-  bridge.transfer(cmd, 1, buff, size, NULL, 0);
+  bridge.post(cmd, 1, buff, size);
 }
 
 void MailboxClass::writeMessage(const String& str) {
@@ -43,7 +43,7 @@ void MailboxClass::writeMessage(const String& str) {
 
 void MailboxClass::writeJSON(const String& str) {
   uint8_t cmd[] = {'J'};
-  bridge.transfer(cmd, 1, (uint8_t*) str.c_str(), str.length(), NULL, 0);
+  bridge.post(cmd, 1, (uint8_t*) str.c_str(), str.length());
 }
 
 unsigned int MailboxClass::messageAvailable() {
@@ -24,7 +24,7 @@ Process::~Process() {
 
 size_t Process::write(uint8_t c) {
   uint8_t cmd[] = {'I', handle, c};
-  bridge.transfer(cmd, 3);
+  bridge.post(cmd, 3);
   return 1;
 }
 
@@ -0,0 +1,196 @@
+/*
+  Copyright (c) 2013 Arduino LLC. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+/*
+ * Host check of the Bridge library against the Linux side in linux/bridge_ext.py: the sketch's
+ * Bridge talks to linux_peer.py, a python child, over pipes which hold each reply back by a
+ * latency and can damage one byte in so many in either direction.  Console writes must reach
+ * the Linux side each once and in order, on a clean line and on a damaged one, and socket reads
+ * and datastore batches must come back whole.  Built and run on the host, from this directory:
+ *
+ *   for n in 0 4; do
+ *     g++ -O2 -DBRIDGE_WINDOW=$n -Ihost -I../src WindowCheck.cpp ../src/Bridge.cpp \
+ *         ../src/BridgeFrame.cpp ../src/Console.cpp ../src/BridgeClient.cpp -o WindowCheck
+ *     ./WindowCheck window && ./WindowCheck nowindow
+ *   done
+ *
+ * Options, after window or nowindow: the reply latency in ms (3), one byte in how many damaged
+ * (300), the seed, and the python to run (python3).  Output is one CSV line:
+ * peer,BRIDGE_WINDOW,latency,ms for 300 writes,ms for 300 writes damaged,commands run, and the
+ * exit status is 0 if every check held.
+ */
+
+#include <Arduino.h>
+#include <Bridge.h>
+#include <Console.h>
+#include <BridgeClient.h>
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  return 1 + std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// The serial line to the Linux side
+struct Line : HardwareSerial {
+  int to, from;
+  int latency;
+  int damage;
+  std::deque<std::pair<unsigned long, uint8_t> > received;
+
+  bool damaged() {
+    return damage > 0 && rand() % damage == 0;
+  }
+  size_t write(uint8_t c) {
+    if (damaged())
+      c ^= 0x10;
+    return ::write(to, &c, 1) == 1 ? 1 : 0;
+  }
+  size_t write(const uint8_t *buff, size_t n) {
+    for (size_t i = 0; i < n; i++)
+      write(buff[i]);
+    return n;
+  }
+  int peek() {
+    uint8_t c;
+    while (::read(from, &c, 1) == 1)
+      received.push_back(std::make_pair(millis() + latency, damaged() ? (uint8_t)(c ^ 0x08) : c));
+    if (received.empty() || (long)(millis() - received.front().first) < 0)
+      return -1;
+    return received.front().second;
+  }
+  int read() {
+    int c = peek();
+    if (c >= 0)
+      received.pop_front();
+    return c;
+  }
+  int available() {
+    return peek() >= 0;
+  }
+} line;
+
+HardwareSerial &Serial = line;
+
+static pid_t peer;
+
+#define CHECK(c) if (!(c)) { printf("FAIL line %d: %s\n", __LINE__, #c); kill(peer, SIGTERM); return 1; }
+
+static std::string ask(uint8_t cmd)
+{
+  static uint8_t buff[4096];
+  uint16_t l = Bridge.transfer(&cmd, 1, buff, sizeof(buff));
+  return (l == BridgeClass::TRANSFER_TIMEOUT) ? "timeout" : std::string((char *)buff, l);
+}
+
+static unsigned long writes(char mark, std::string &sent)
+{
+  unsigned long start = millis();
+  for (int i = 0; i < 300; i++) {
+    char b[8];
+    snprintf(b, sizeof(b), "%03d%c", i, mark);
+    Console.write((const uint8_t *)b, 4);
+    sent += b;
+  }
+  Bridge.drain();
+  return millis() - start;
+}
+
+int main(int argc, char **argv)
+{
+  const char *mode = (argc > 1) ? argv[1] : "window";
+  line.latency = (argc > 2) ? atoi(argv[2]) : 3;
+  int damage = (argc > 3) ? atoi(argv[3]) : 300;
+  srand((argc > 4) ? atoi(argv[4]) : 1);
+  const char *python = (argc > 5) ? argv[5] : "python3";
+
+  int in[2], out[2];
+  if (pipe(in) != 0 || pipe(out) != 0)
+    return 1;
+  peer = fork();
+  if (peer == 0) {
+    dup2(in[0], 0);
+    dup2(out[1], 1);
+    close(in[1]);
+    close(out[0]);
+    execlp(python, python, "linux_peer.py", mode, (char *)NULL);
+    _exit(127);
+  }
+  close(in[0]);
+  close(out[1]);
+  line.to = in[1];
+  line.from = out[0];
+  fcntl(line.from, F_SETFL, O_NONBLOCK);
+
+  bool window = strcmp(mode, "nowindow") != 0;
+  Bridge.begin();
+  CHECK(Bridge.getCapabilities() == (window ? 7 : 6));
+  CHECK(Bridge.isWindowed() == (BRIDGE_WINDOW > 0 && window));
+
+  std::string sent;
+  unsigned long clean = writes(',', sent);
+  CHECK(ask('1') == sent);
+  line.damage = damage;
+  unsigned long damaged = writes(';', sent);
+  line.damage = 0;
+  CHECK(ask('1') == sent);
+
+  // socket reads: the data at once by default, later but whole when non-blocking
+  uint8_t data[] = {'2', 'h', 'e', 'l', 'l', 'o'};
+  Bridge.transfer(data, sizeof(data));
+  BridgeClient client(3);
+  CHECK(client.available() == 5);
+  client.setNonBlocking(true);
+  std::string got;
+  for (int i = 0; i < 5; i++)
+    got += (char)client.read();
+  Bridge.transfer(data, sizeof(data));
+  unsigned long start = millis();
+  while (got.size() < 10 && millis() - start < 2000) {
+    int c = client.read();
+    if (c >= 0)
+      got += (char)c;
+  }
+  CHECK(got == "hellohello");
+
+  const char *keys[] = {"a", "b", "c"};
+  const char *values[] = {"1", "2", "3"};
+  char buff[32];
+  char *read[3];
+  CHECK(Bridge.putMany(keys, values, 3) == 3);
+  CHECK(Bridge.getMany(keys, 3, buff, sizeof(buff), read) == 3 && strcmp(read[2], "3") == 0);
+
+  printf("%s,%d,%d,%lu,%lu,%s\n", mode, BRIDGE_WINDOW, line.latency, clean, damaged, ask('3').c_str());
+  kill(peer, SIGTERM);
+  return 0;
+}
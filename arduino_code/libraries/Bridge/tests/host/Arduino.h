@@ -0,0 +1,58 @@
+// Just enough of the Arduino core to build the Bridge library on the host
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+typedef bool boolean;
+unsigned long millis();
+void delay(unsigned long);
+struct __FlashStringHelper;
+#define F(s) (s)
+class String {
+public:
+  std::string s;
+  String(const char *c = "") : s(c) {}
+  unsigned char reserve(int n) { s.reserve(n); return 1; }
+  String &operator+=(const __FlashStringHelper *c) { s += (const char *)c; return *this; }
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.size(); }
+  String &operator+=(const char *c) { s += c; return *this; }
+  String &operator+=(char c) { s += c; return *this; }
+  String &operator+=(int v) { s += std::to_string(v); return *this; }
+  String &operator+=(uint8_t v) { s += std::to_string(v); return *this; }
+  String &operator=(const char *c) { s = c; return *this; }
+};
+class Print {
+public:
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *b, size_t n) { for (size_t i = 0; i < n; i++) write(b[i]); return n; }
+  size_t print(const char *c) { return write((const uint8_t *)c, strlen(c)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t write(char c) { return write((uint8_t)c); }
+  virtual ~Print() {}
+};
+class Stream : public Print {
+public:
+  unsigned long _timeout = 1000;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  void setTimeout(unsigned long t) { _timeout = t; }
+};
+class IPAddress {
+public:
+  uint8_t a[4];
+  IPAddress(uint8_t x = 0, uint8_t y = 0, uint8_t z = 0, uint8_t w = 0) { a[0] = x; a[1] = y; a[2] = z; a[3] = w; }
+  uint8_t operator[](int i) const { return a[i]; }
+};
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+};
+extern HardwareSerial &Serial;
+#define SERIAL_PORT_HARDWARE Serial
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
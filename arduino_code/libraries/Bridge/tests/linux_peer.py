@@ -0,0 +1,73 @@
+# The Linux side for WindowCheck: bridge_ext's PacketReader on stdin and stdout, with a few
+# stand-in commands in place of the stock bridge's modules.  "nowindow" leaves CAP_WINDOW out,
+# as a bridge without the reader.
+
+import os
+import sys
+import types
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'linux'))
+
+
+class Datastore:
+  def __init__(self):
+    self.data = {}
+
+  def put(self, key, value):
+    self.data[key] = value
+
+  def get(self, key):
+    return self.data.get(key)
+
+
+datastore = types.ModuleType('datastore')
+datastore.datastore = Datastore()
+sys.modules['datastore'] = datastore
+
+import bridge_ext
+
+
+class CommandProcessor:
+  def __init__(self):
+    self.handlers = {}
+    self.finished = False
+    self.console = ''
+    self.socket = ''
+    self.executed = 0
+
+  def register(self, key, handler):
+    self.handlers[key] = handler
+
+  def process(self, data):
+    self.executed += 1
+    if data == 'XXXXX':
+      return ''
+    if data[0:2] == 'XX':
+      return chr(0) + '160'
+    key = data[0]
+    if key == 'P':                      # console write
+      self.console += data[1:]
+      return ''
+    if key == 'K':                      # socket read: handle, length
+      n = ord(data[2])
+      reply = self.socket[:n]
+      self.socket = self.socket[n:]
+      return reply
+    if key == '1':                      # the check's own: the console so far
+      return self.console
+    if key == '2':                      # the check's own: data for the socket
+      self.socket += data[1:]
+      return ''
+    if key == '3':                      # the check's own: commands run
+      return str(self.executed)
+    if key in self.handlers:
+      return self.handlers[key].run(data[1:])
+    return None
+
+
+cp = CommandProcessor()
+bridge_ext.init(cp)
+reader = bridge_ext.PacketReader(cp)
+if len(sys.argv) > 1 and sys.argv[1] == 'nowindow':
+  bridge_ext.capabilities &= ~bridge_ext.CAP_WINDOW
+reader.run()
@@ -17,27 +17,33 @@
 #if !defined(COUNTDOWN_H)
 #define COUNTDOWN_H
 
+/**
+ * A deadline on millis().  The comparisons are done on the difference from millis(), so they
+ * stay right when millis() wraps after 49 days, for intervals of up to 24 days.
+ */
 class Countdown
 {
 public:
     Countdown()
     {  
-		interval_end_ms = 0L;
+		interval_end_ms = 0L;   // not started, never expires
     }
     
-    Countdown(int ms)
+    Countdown(unsigned long ms)
     {
         countdown_ms(ms);   
     }
     
     bool expired()
     {
-        return (interval_end_ms > 0L) && (millis() >= interval_end_ms);
+        return (interval_end_ms != 0L) && ((long)(millis() - interval_end_ms) >= 0);
     }
     
     void countdown_ms(unsigned long ms)  
     {
         interval_end_ms = millis() + ms;
+        if (interval_end_ms == 0L)
+            interval_end_ms = 1L;   // 0 is kept for not started
     }
     
     void countdown(int seconds)
@@ -45,9 +51,13 @@ public:
         countdown_ms((unsigned long)seconds * 1000L);
     }
     
-    int left_ms()
+    /** The time until the deadline, 0 once it has passed or if the countdown was never started.
+     *  An int would be 16 bits on the AVR, and negative past 32.7 s.
+     */
+    unsigned long left_ms()
     {
-        return interval_end_ms - millis();
+        long left = (interval_end_ms != 0L) ? (long)(interval_end_ms - millis()) : 0L;
+        return (left > 0) ? (unsigned long)left : 0UL;
     }
     
 private:
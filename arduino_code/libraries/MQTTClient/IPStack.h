@@ -1,40 +1,113 @@
-/***j**:+j+*>.***.******k*:*+/**/+.+o+k*+n*.j+:*.+k{****>:*::+z**+$*Cov}ohv (k) :011FM Covq..p; .0n sohu seservuf.)tis so{ao#and`vjecsompe~yingbmaerkals
-!z`r made&avamluble*unler8|hu0teo on(vhe(Es|qsPjmic Lycensghw1.2K * au`Ec|kq{e1Disri{uuio`Liseose2v1o00whkgh qccompan{!viys li{trybuwioo/J"+
- *&whe eliqsm Qwb|yc(License i va|ible qt
- * (!http:?/www.eslpe.orle|/evl-v1pnhtml
-0+"a~d tig<eclipse Diwtsbuin L}cen{e  available at
-%.b htt:/ww.lmqsenvw?orwto}mm~tw/}tl-~=.th>* *
-1j%ont~ibuvrz".c9 ia8Kqgs!-(}ntal AqIlmn;mmp|eoeotqion`ne/or"im|kqo documetmvmon
- k#   oje}i~1Sceb?!geouric!IpWvaok*+*:*****.*:*j*n**j*:*:***j.**;***:k*:*****:jn/**:*j+**:*j:>.*.*j****?'iv)!uf{ned*I\}AKK_H)
-+legie IsUIC{L
-#mnclwfg!=SRi.j>
-cinclude=[lnt>j?J
-o|a{{ iPStmkk(
-{+p}fic:   !J  " IPStack(client&0client)$: clienu&c|ie~|)d   {
-`(! 
-10 
-$(2"int connegu(khas* jstoa}m-"int prv(({
-  !$ hrwuuvn0gmet->conetlotnqme,por|);!  "
-0!0(i~t!go~o(wint33thwoamo,0{ntor|
-" ( {J2&4 0 ,$et}n c{en|snnect,losni}e. p~tm;`&0 }
-K"  &ntizeit,nwognu cxz> c}ffer. i~|4nmn,%n|0tk}wouu)J#$"!{`!  0( nta}~terval = 9t?!0// all tiogs8qvg mn0mi|liseconds
-	y~t$to~al }"0,"rc`?(-1?
-		mn*(ti}eo = 30	intervql = 2?	wjyne hslie~t->ivqkmasle89< len &f(totcl`<!ummeot)
-{
-		duly(mntsvcl+;
-I		uotil!+= intevl{
-}
-	in$(client=?ava|mcle,i >= le~)
-			rc ? c{o~t=>seag{)hmr.-}ffer? ~:et}{~rs;~f}O( ` #d!nt wyt(u~{mgnedglr* rfer.k~thlmo< int`tot;
-0!!{
- #` a(0 glment-e|yuouu(|i}gu|);( 
-rgwurn lynt/>wrte8(}iot8_t+9b}fvr,me);
-($ 
-!  "# m(i{cnnecvhoK0` {
-00   0 !lyenv->toxh)
-p` 0$$  zeturn"1;
-   
-+prmvg>J"!hCliont clignt;
-{J
-#e~dig
-J
\ No newline at end of file
+/*******************************************************************************
+ * Copyright (c) 2014 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *    Benjamin Cabe - generic IPStack
+ *******************************************************************************/
+
+#if !defined(IPSTACK_H)
+#define IPSTACK_H
+
+#include <SPI.h>
+#include <Client.h>
+
+class IPStack
+{
+public:
+    IPStack(Client& client) : client(&client), cachedHost(0)
+    {
+
+    }
+
+    /** Connect to the address cached for hostname if there is one, so that the name is not
+     *  resolved again on every reconnect, otherwise by name.  A failed connect to the cached
+     *  address forgets it, in case the host has moved.
+     */
+    int connect(const char* hostname, int port)
+    {
+        if (isCached(hostname))
+        {
+            int rc = client->connect(cachedAddress, port);
+            if (rc == 1)
+                return rc;
+            cachedHost = 0;
+        }
+        return client->connect(hostname, port);
+    }
+
+    /** Remember the address hostname resolves to, for connect
+     *  @param hostname - the name, which must outlive its use here
+     */
+    void cacheAddress(const char* hostname, IPAddress address)
+    {
+        cachedHost = hostname;
+        cachedAddress = address;
+    }
+
+    bool isCached(const char* hostname)
+    {
+        return cachedHost != 0 && strcmp(cachedHost, hostname) == 0;
+    }
+
+    int connect(uint32_t hostname, int port)
+    {
+        return client->connect(hostname, port);
+    }
+
+    int available()
+    {
+        return client->available();
+    }
+
+    /** Read len bytes, waiting until they have all arrived or timeout ms have passed.  The wait is
+     *  left to the client's own timed read, so the data is returned as soon as it arrives rather
+     *  than on the next tick of a delay() loop.
+     *  @return the number of bytes read, which is less than len if the time ran out first, or -1 if
+     *  none arrived
+     */
+    int read(unsigned char* buffer, int len, int timeout)
+    {
+        int rc = 0;
+
+        if (client->available() >= len)
+            rc = client->read(buffer, len);     // all there already, in one read
+        if (rc < 0)
+            rc = 0;
+        if (rc < len)
+        {
+            client->setTimeout((timeout > 0) ? timeout : 0);
+            rc += client->readBytes((char*)&buffer[rc], len - rc);
+        }
+        return (rc > 0) ? rc : -1;
+    }
+
+    int write(unsigned char* buffer, int len, int timeout)
+    {
+        client->setTimeout(timeout);
+        return client->write((uint8_t*)buffer, len);
+    }
+
+    int disconnect()
+    {
+        client->stop();
+        return 0;
+    }
+
+private:
+
+    Client* client;
+    const char* cachedHost;
+    IPAddress cachedAddress;
+};
+
+#endif
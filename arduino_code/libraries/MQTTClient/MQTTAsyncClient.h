@@ -0,0 +1,1467 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Ian Craggs - initial API and implementation and/or initial documentation
+ *    non-blocking client variant driven by MQTTPacket_readnb
+ *******************************************************************************/
+
+#if !defined(MQTTASYNCCLIENT_H)
+#define MQTTASYNCCLIENT_H
+
+#include "MQTTClient.h"
+#include <string.h>
+
+#if !defined(MQTTCLIENT_PUBLISH_RETRIES)
+    #define MQTTCLIENT_PUBLISH_RETRIES 3
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * @class AsyncClient
+ * @brief non-blocking, non-threaded MQTT client API
+ *
+ * None of the methods wait for a reply from the server.  Requests are written to the network and
+ * the call returns; poll() must then be called from the main loop.  poll() takes whatever bytes the
+ * network has ready through MQTTPacket_readnb, keeping a partially received packet across calls,
+ * and moves the connect, subscribe, unsubscribe, publish acknowledgement and keepalive states on.
+ * The outcome of each request is reported through the ack handler.
+ * One CONNECT, SUBSCRIBE or UNSUBSCRIBE can be outstanding at a time.  QoS 1 and 2 publishes are
+ * pipelined: up to MAX_INFLIGHT of them can wait for their acknowledgements, which may arrive in
+ * any order.  A publish which is not acknowledged within the command timeout is sent again with
+ * the DUP flag set, up to MQTTCLIENT_PUBLISH_RETRIES times, before it is reported as failed.
+ * @param Network a network class which supports available, read and write
+ * @param Timer a timer class with the methods: countdown_ms, countdown, expired, left_ms
+ * @param MAX_INFLIGHT the number of QoS 1 and 2 publishes which can be awaiting acknowledgement
+ * @param Routes message handlers bound to topic filters at compile time, a list of MQTT::Route
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE = 100, int MAX_MESSAGE_HANDLERS = 5, int MAX_INFLIGHT = 1, class Routes = NoRoutes>
+class AsyncClient
+{
+
+public:
+
+    typedef void (*messageHandler)(MessageData&);
+
+    /** Callback for the completion of a request
+     *  @param packet_type - the acknowledgement: CONNACK, SUBACK, UNSUBACK, PUBACK or PUBCOMP
+     *  @param packetid - the packet id of the request, 0 for a connect
+     *  @param rc - the connack return code for CONNACK, the granted QoS for SUBACK, SUCCESS otherwise,
+     *      or FAILURE if no acknowledgement arrived within the command timeout, the connection was lost
+     *      or there was no room for the message handler
+     */
+    typedef void (*ackHandler)(int packet_type, unsigned short packetid, int rc);
+
+    enum State { DISCONNECTED, CONNECTING, CONNECTED };
+
+    /** Construct the client
+     *  @param network - pointer to an instance of the Network class - must be connected to the endpoint
+     *      before calling MQTT connect
+     *  @param command_timeout_ms - how long to wait for the acknowledgement of each request
+     */
+    AsyncClient(Network& network, unsigned int command_timeout_ms = 30000);
+
+    /** Set the default message handling callback - used for any message which does not match a subscription message handler
+     *  @param mh - pointer to the callback function
+     */
+    void setDefaultMessageHandler(messageHandler mh)
+    {
+        defaultMessageHandler.attach(mh);
+    }
+
+    /** Set the callback which reports the completion of each request
+     *  @param ah - pointer to the callback function
+     */
+    void setAckHandler(ackHandler ah)
+    {
+        this->ah = ah;
+    }
+
+    /** MQTT Connect - send an MQTT connect packet down the network.  The client is in the
+     *  CONNECTING state until poll() receives the connack.
+     *  The nework object must be connected to the network endpoint before calling this
+     *  @param options - connect options
+     *  @return success code -
+     */
+    int connect(MQTTPacket_connectData& options);
+
+    /** MQTT Connect with MQTT 5 connect properties, which are sent when options.MQTTVersion is 5.
+     *  MQTT 5 needs MQTTCLIENT_MQTTV5.  Publishes to prepared topics then use the topic aliases
+     *  the server allows in its connack.
+     *  @param options - connect options
+     *  @param connectProperties - the connect properties, or 0 for none
+     *  @return success code -
+     */
+    int connect(MQTTPacket_connectData& options, MQTTProperties* connectProperties);
+
+    /** MQTT Publish - send an MQTT publish packet.  At QoS 1 and 2 the acknowledgement is reported
+     *  through the ack handler, and the topic and payload are kept for retransmission, so they must
+     *  stay valid until then.
+     *  @param topic - the topic to publish to
+     *  @param message - the message to send
+     *  @return success code - FAILURE if not connected, or at QoS 1 or 2 if the in-flight window is full
+     */
+    int publish(const char* topicName, Message& message);
+
+    /** MQTT Publish - send an MQTT publish packet
+     *  @param topic - the topic to publish to
+     *  @param payload - the data to send
+     *  @param payloadlen - the length of the data
+     *  @param qos - the QoS to send the publish at
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false);
+
+    /** MQTT Publish - send an MQTT publish packet
+     *  @param topic - the topic to publish to
+     *  @param payload - the data to send
+     *  @param payloadlen - the length of the data
+     *  @param id - the packet id used - returned
+     *  @param qos - the QoS to send the publish at
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false);
+
+    /** MQTT Publish to a prepared topic - the cached header is patched with the remaining length and
+     *  packet id and sent from the PreparedTopic, followed by the payload from the caller's memory
+     *  @param topic - the prepared topic to publish to
+     *  @param payload - the data to send
+     *  @param payloadlen - the length of the data
+     *  @param qos - the QoS to send the publish at
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publish(PreparedTopic& topic, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false);
+
+    /** MQTT Publish to a prepared topic
+     *  @param topic - the prepared topic to publish to
+     *  @param payload - the data to send
+     *  @param payloadlen - the length of the data
+     *  @param id - the packet id used - returned
+     *  @param qos - the QoS to send the publish at
+     *  @param retained - whether the message should be retained
+     *  @return success code -
+     */
+    int publish(PreparedTopic& topic, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false);
+
+    /** MQTT Subscribe - send an MQTT subscribe packet.  The message handler is installed when
+     *  the suback arrives.
+     *  @param topicFilter - a topic pattern which can include wildcards
+     *  @param qos - the MQTT QoS to subscribe at
+     *  @param mh - the callback function to be invoked when a message is received for this subscription,
+     *      or 0 when the filter is bound to a handler in Routes, which then takes no handler slot
+     *  @return success code - FAILURE if not connected, another request is outstanding or there is no free handler
+     */
+    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh = 0);
+
+    /** MQTT Subscribe to several topic filters with one subscribe packet, and one round trip.  The
+     *  message handlers are installed when the suback arrives, for the filters the server granted.
+     *  The suback is reported once: with the lowest QoS granted, or with the failure of the first
+     *  filter which was refused or had no room for its handler.
+     *  @param count - the number of filters, at most MQTTCLIENT_SUBSCRIBE_FILTERS
+     *  @param topicFilters - the topic patterns, kept until the suback arrives
+     *  @param qos - the MQTT QoS to subscribe at, for each filter
+     *  @param mhs - the message handler for each filter, or 0 for one bound in Routes; or 0 for none
+     *      at all.  Kept until the suback arrives.
+     *  @return success code - FAILURE if not connected, another request is outstanding or there are
+     *      not enough free handler slots
+     */
+    int subscribe(int count, const char* const topicFilters[], enum QoS qos[], messageHandler mhs[] = 0);
+
+    /** MQTT Unsubscribe - send an MQTT unsubscribe packet.  The message handler is removed when
+     *  the unsuback arrives.
+     *  @param topicFilter - a topic pattern which can include wildcards
+     *  @return success code -
+     */
+    int unsubscribe(const char* topicFilter);
+
+    /** MQTT Disconnect - send an MQTT disconnect packet, and clean up any state
+     *  @return success code -
+     */
+    int disconnect();
+
+    /** Handle all the packets the network has ready, check the request timeouts and keep the
+     *  connection alive.  Never waits for data, so it can be called on every pass of the main loop.
+     *  @return success code - on failure, this means the client has disconnected
+     */
+    int poll();
+
+    /** How long can the caller wait before poll has a timer to act on - a keepalive ping, an ack
+     *  timeout, a retransmission or a batch flush?  Packets arriving from the network are not
+     *  counted, so the caller should also bound its wait by how quickly it wants to react to them.
+     *  @return the time in ms, 0 if poll has work now, or NO_DEADLINE if nothing is timed
+     */
+    unsigned long next_ms();
+
+    static const unsigned long NO_DEADLINE = 0xFFFFFFFFUL;
+
+    enum State state()
+    {
+        return connstate;
+    }
+
+    bool isConnected()
+    {
+        return connstate == CONNECTED;
+    }
+
+    /** Did the server still have the client's session when it accepted the last connect, made with
+     *  cleansession 0?  The subscriptions are then in place, and need not be made again.
+     */
+    bool sessionPresent()
+    {
+        return session_present;
+    }
+
+    /** Is a CONNECT, SUBSCRIBE or UNSUBSCRIBE waiting for its acknowledgement?
+     */
+    bool isBusy()
+    {
+        return pendingType != 0;
+    }
+
+    /** The number of QoS 1 and 2 publishes waiting for acknowledgement
+     */
+    int inflightCount();
+
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+    /** Hold back the packets sent from now on and write them to the network together.  The batch
+     *  is written when uncork is called, when the next packet does not fit in it, or by poll once
+     *  flush_ms has passed since the first packet was held back.
+     *  @param flush_ms - the longest a packet is held back, 0 for no limit
+     */
+    void cork(unsigned long flush_ms = 0)
+    {
+        batch.cork(flush_ms);
+    }
+
+    /** Write any held back packets, and send the following ones straight away
+     *  @return success code -
+     */
+    int uncork();
+#endif
+
+#if MQTTCLIENT_TRACE_RECORDS > 0
+    /** Write the trace of the last packets sent and received, for trace/TraceDecode on the host
+     *  @param out - anything with write(const uint8_t*, size_t), such as Serial or a Bridge File
+     *  @return the number of bytes written
+     */
+    template<class Stream>
+    int dumpTrace(Stream& out)
+    {
+        return trace.dump(out);
+    }
+#endif
+
+private:
+
+    static int getdata(void* sck, unsigned char* buf, int count);
+    int readPacket();
+
+    int handlePacket(int packet_type);
+    int keepalive();
+    void close();
+    static void earliest(unsigned long& ms, Timer& timer)
+    {
+        unsigned long left = timer.left_ms();
+        if (left < ms)
+            ms = left;
+    }
+    void complete(int packet_type, unsigned short packetid, int rc);
+
+    int startPublish(const char* topicName, PreparedTopic* prepared, void* payload, size_t payloadlen,
+            unsigned short& id, enum QoS qos, bool retained);
+    int sendPublish(const char* topicName, PreparedTopic* prepared, void* payload, size_t payloadlen,
+            unsigned short id, enum QoS qos, bool retained, unsigned char dup, Timer& timer);
+    int sendPacket(unsigned char* buf, int length, Timer& timer, unsigned char* payload = 0, int payloadlen = 0);
+    int sendPacket(int length, Timer& timer)
+    {
+        return sendPacket(sendbuf, length, timer);
+    }
+    int sendBytes(unsigned char* buf, int length, Timer& timer);
+    int flush(Timer& timer);
+    int deliverMessage(MQTTString& topicName, Message& message);
+    int setMessageHandler(const char* topicFilter, messageHandler mh);
+    void removeMessageHandler(const char* topicFilter);
+    bool isTopicMatched(char* topicFilter, MQTTString& topicName);
+
+    // props if the connection is MQTT 5, otherwise 0 - MQTT 3.1.1 packets have no properties
+    MQTTProperties* properties(MQTTProperties& props)
+    {
+#if MQTTCLIENT_MQTTV5
+        if (mqttVersion == 5)
+            return &props;
+#else
+        (void)props;
+#endif
+        return 0;
+    }
+
+    Network& ipstack;
+    unsigned long command_timeout_ms;
+
+    unsigned char sendbuf[MAX_MQTT_PACKET_SIZE];
+    unsigned char readbuf[MAX_MQTT_PACKET_SIZE];  // also holds a partially received packet between polls, without the ring
+#if MQTTCLIENT_RX_RING_SIZE > 0
+    RxRing<Network, MQTTCLIENT_RX_RING_SIZE> rx;    // received data, copied to readbuf a whole packet at a time
+#endif
+    MQTTTransport transport;
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+    TxBatch<Timer, MQTTCLIENT_TX_BATCH_SIZE> batch;
+#endif
+#if MQTTCLIENT_TRACE_RECORDS > 0
+    Trace<MQTTCLIENT_TRACE_RECORDS> trace;
+#endif
+
+    enum State connstate;
+    bool session_present;
+    Timer last_sent, last_received, ping_timer;
+    unsigned int keepAliveInterval;
+    bool ping_outstanding;
+#if MQTTCLIENT_MQTTV5
+    unsigned char mqttVersion;
+    TopicAliases<MQTTCLIENT_TOPIC_ALIASES> aliases;
+#endif
+
+    PacketId packetid;
+
+    struct MessageHandlers
+    {
+        const char* topicFilter;
+        FP<void, MessageData&> fp;
+    } messageHandlers[MAX_MESSAGE_HANDLERS];      // Message handlers are indexed by subscription topic
+
+    FP<void, MessageData&> defaultMessageHandler;
+
+#if MQTTCLIENT_TOPIC_TRIE
+    TopicTrie<MAX_MESSAGE_HANDLERS * MQTTCLIENT_TRIE_LEVELS + 1> subscriptions;   // filter -> message handler index
+#endif
+    ackHandler ah;
+
+    int pendingType;                // ack awaited for the outstanding CONNECT, SUBSCRIBE or UNSUBSCRIBE, 0 if none
+    unsigned short pendingMsgid;
+    const char* pendingFilter;      // the filter of a one filter SUBSCRIBE, or of the UNSUBSCRIBE
+    messageHandler pendingHandler;
+    const char* const* pendingFilters;  // the filters and handlers of the outstanding SUBSCRIBE
+    messageHandler* pendingHandlers;
+    int pendingCount;
+    Timer pending_timer;
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    struct InflightSlot
+    {
+        unsigned short msgid;       // 0 when the slot is free
+        int type;                   // PUBACK, PUBREC or PUBCOMP awaited
+        int retries;
+        const char* topicName;      // kept for retransmission
+        PreparedTopic* prepared;
+        void* payload;
+        size_t payloadlen;
+        enum QoS qos;
+        bool retained;
+        Timer timer;
+    } inflight[MAX_INFLIGHT];
+
+    InflightSlot* findSlot(unsigned short msgid);
+    int retransmit(InflightSlot* slot);
+#endif
+
+#if MQTTCLIENT_QOS2
+    unsigned short incomingQoS2messages[MAX_INCOMING_QOS2_MESSAGES];
+    bool isQoS2msgidFree(unsigned short id);
+    bool useQoS2msgid(unsigned short id);
+    void freeQoS2msgid(unsigned short id);
+#endif
+
+};
+
+}
+
+
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, int MAX_INFLIGHT, class Routes>
+MQTT::AsyncClient<Network, Timer, a, MAX_MESSAGE_HANDLERS, MAX_INFLIGHT, Routes>::AsyncClient(Network& network, unsigned int command_timeout_ms)  : ipstack(network), packetid()
+{
+    last_sent = Timer();
+    last_received = Timer();
+    ping_timer = Timer();
+    pending_timer = Timer();
+    keepAliveInterval = 0;
+    ping_outstanding = false;
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+        messageHandlers[i].topicFilter = 0;
+    this->command_timeout_ms = command_timeout_ms;
+    connstate = DISCONNECTED;
+    session_present = false;
+    ah = 0;
+#if MQTTCLIENT_MQTTV5
+    mqttVersion = 4;
+#endif
+
+    transport.getfn = getdata;
+    transport.sck = &ipstack;
+    transport.state = 0;
+
+    pendingType = 0;
+    pendingMsgid = 0;
+    pendingFilter = 0;
+    pendingHandler = 0;
+    pendingFilters = 0;
+    pendingHandlers = 0;
+    pendingCount = 0;
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    for (int i = 0; i < MAX_INFLIGHT; ++i)
+    {
+        inflight[i].msgid = 0;
+        inflight[i].timer = Timer();
+    }
+#endif
+
+#if MQTTCLIENT_QOS2
+    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
+        incomingQoS2messages[i] = 0;
+#endif
+}
+
+
+#if MQTTCLIENT_QOS2
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+bool MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::isQoS2msgidFree(unsigned short id)
+{
+    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
+    {
+        if (incomingQoS2messages[i] == id)
+            return false;
+    }
+    return true;
+}
+
+
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+bool MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::useQoS2msgid(unsigned short id)
+{
+    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
+    {
+        if (incomingQoS2messages[i] == 0)
+        {
+            incomingQoS2messages[i] = id;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+void MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::freeQoS2msgid(unsigned short id)
+{
+    for (int i = 0; i < MAX_INCOMING_QOS2_MESSAGES; ++i)
+    {
+        if (incomingQoS2messages[i] == id)
+        {
+            incomingQoS2messages[i] = 0;
+            return;
+        }
+    }
+}
+#endif
+
+
+/**
+ * MQTTTransport getfn: hand over no more than the network already has buffered, so
+ * MQTTPacket_readnb never waits.  Returns 0 to be called again later.
+ */
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::getdata(void* sck, unsigned char* buf, int count)
+{
+    Network* network = (Network*)sck;
+    int avail = network->available();
+
+    if (avail <= 0)
+        return 0;
+    if (avail < count)
+        count = avail;
+    return network->read(buf, count, 0);
+}
+
+
+// the next whole packet received, 0 if there is none yet
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::readPacket()
+{
+    int packet_type;
+
+#if MQTTCLIENT_RX_RING_SIZE > 0
+    // the ring was filled at the start of poll - read more only if the network had more than fitted
+    while ((packet_type = rx.next(readbuf, MAX_MQTT_PACKET_SIZE)) == 0 && rx.behind())
+    {
+        if (rx.fill(ipstack, 0) <= 0)
+            break;
+    }
+#else
+    packet_type = MQTTPacket_readnb(readbuf, MAX_MQTT_PACKET_SIZE, &transport);
+#endif
+#if MQTTCLIENT_TRACE_RECORDS > 0
+    if (packet_type > 0)
+        trace.record(TRACE_RECEIVED, readbuf);
+#endif
+    return packet_type;
+}
+
+
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::sendBytes(unsigned char* buf, int length, Timer& timer)
+{
+    int sent = 0;
+
+    while (sent < length && !timer.expired())
+    {
+        int rc = ipstack.write(&buf[sent], length - sent, timer.left_ms());
+        if (rc < 0)  // there was an error writing the data
+            break;
+        sent += rc;
+    }
+    return sent;
+}
+
+
+// while corked, the packet is added to the transmit batch instead
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::sendPacket(unsigned char* buf, int length, Timer& timer, unsigned char* payload, int payloadlen)
+{
+    int rc = FAILURE;
+
+#if MQTTCLIENT_TRACE_RECORDS > 0
+    trace.record(TRACE_SENT, buf);
+#endif
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+    if (batch.isCorked())
+    {
+        if (!batch.fits(length + payloadlen) && (rc = flush(timer)) != SUCCESS)
+            goto exit;
+        if (batch.fits(length + payloadlen))
+        {
+            batch.append(buf, length, payload, payloadlen);
+            rc = SUCCESS;
+            goto exit;
+        }
+        // larger than the whole batch, so it goes out on its own
+    }
+#endif
+    if (sendBytes(buf, length, timer) == length &&
+        (payloadlen == 0 || sendBytes(payload, payloadlen, timer) == payloadlen))
+    {
+        if (this->keepAliveInterval > 0)
+            last_sent.countdown(this->keepAliveInterval); // record the fact that we have successfully sent the packet
+        rc = SUCCESS;
+    }
+
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+exit:
+#endif
+#if defined(MQTT_DEBUG)
+    char printbuf[150];
+    DEBUG("Rc %d from sending packet %s\n", rc, MQTTFormat_toServerString(printbuf, sizeof(printbuf), buf, length));
+#endif
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::flush(Timer& timer)
+{
+    int rc = SUCCESS;
+
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+    int len = batch.length();
+
+    if (len == 0)
+        goto exit;
+    if (sendBytes(batch.data(), len, timer) != len)
+        rc = FAILURE;
+    else if (this->keepAliveInterval > 0)
+        last_sent.countdown(this->keepAliveInterval);
+    batch.clear();
+
+exit:
+#else
+    (void)timer;
+#endif
+    return rc;
+}
+
+
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::uncork()
+{
+    Timer timer = Timer(command_timeout_ms);
+    int rc;
+
+    batch.uncork();
+    if ((rc = flush(timer)) != SUCCESS && connstate != DISCONNECTED)
+        close();
+    return rc;
+}
+#endif
+
+
+// assume topic filter and name is in correct format
+// # can only be at end
+// + and # can only be next to separator
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+bool MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::isTopicMatched(char* topicFilter, MQTTString& topicName)
+{
+    char* curf = topicFilter;
+    char* curn = topicName.lenstring.data;
+    char* curn_end = curn + topicName.lenstring.len;
+
+    while (*curf && curn < curn_end)
+    {
+        if (*curn == '/' && *curf != '/')
+            break;
+        if (*curf != '+' && *curf != '#' && *curf != *curn)
+            break;
+        if (*curf == '+')
+        {   // skip until we meet the next separator, or end of string
+            char* nextpos = curn + 1;
+            while (nextpos < curn_end && *nextpos != '/')
+                nextpos = ++curn + 1;
+        }
+        else if (*curf == '#')
+            curn = curn_end - 1;    // skip until end of string
+        curf++;
+        curn++;
+    };
+
+    return (curn == curn_end) && (*curf == '\0');
+}
+
+
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, a, MAX_MESSAGE_HANDLERS, MAX_INFLIGHT, Routes>::deliverMessage(MQTTString& topicName, Message& message)
+{
+    int rc = FAILURE;
+
+    MessageData routed(topicName, message);
+    if (Routes::deliver(topicName, routed))
+        rc = SUCCESS;
+
+#if MQTTCLIENT_TOPIC_TRIE
+    int matched[MAX_MESSAGE_HANDLERS];
+    int count = subscriptions.match(topicName, matched, MAX_MESSAGE_HANDLERS);
+
+    for (int j = 0; j < count; ++j)
+    {
+        int i = matched[j];
+        if (messageHandlers[i].fp.attached())
+        {
+            MessageData md(topicName, message);
+            messageHandlers[i].fp(md);
+            rc = SUCCESS;
+        }
+    }
+#else
+    // we have to find the right message handler - indexed by topic
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter != 0 && (MQTTPacket_equals(&topicName, (char*)messageHandlers[i].topicFilter) ||
+                isTopicMatched((char*)messageHandlers[i].topicFilter, topicName)))
+        {
+            if (messageHandlers[i].fp.attached())
+            {
+                MessageData md(topicName, message);
+                messageHandlers[i].fp(md);
+                rc = SUCCESS;
+            }
+        }
+    }
+#endif
+
+    if (rc == FAILURE && defaultMessageHandler.attached())
+    {
+        MessageData md(topicName, message);
+        defaultMessageHandler(md);
+        rc = SUCCESS;
+    }
+
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, int c, class Routes>
+int MQTT::AsyncClient<Network, Timer, a, MAX_MESSAGE_HANDLERS, c, Routes>::setMessageHandler(const char* topicFilter, messageHandler mh)
+{
+    int rc = FAILURE;
+    int i = -1;
+
+#if MQTTCLIENT_TOPIC_TRIE
+    i = subscriptions.find(topicFilter);    // subscribing to the same filter again replaces its handler
+#endif
+    if (i < 0)
+    {
+        for (i = 0; i < MAX_MESSAGE_HANDLERS && messageHandlers[i].topicFilter != 0; ++i)
+            ;
+        if (i == MAX_MESSAGE_HANDLERS)
+            goto exit;  // no free message handler
+#if MQTTCLIENT_TOPIC_TRIE
+        if (!subscriptions.insert(topicFilter, i))
+            goto exit;  // no room left in the node pool
+#endif
+    }
+    messageHandlers[i].topicFilter = topicFilter;
+    messageHandlers[i].fp.attach(mh);
+    rc = SUCCESS;
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int a, int MAX_MESSAGE_HANDLERS, int c, class Routes>
+void MQTT::AsyncClient<Network, Timer, a, MAX_MESSAGE_HANDLERS, c, Routes>::removeMessageHandler(const char* topicFilter)
+{
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter != 0 && strcmp(messageHandlers[i].topicFilter, topicFilter) == 0)
+        {
+            messageHandlers[i].topicFilter = 0;
+            messageHandlers[i].fp.detach();
+        }
+    }
+#if MQTTCLIENT_TOPIC_TRIE
+    subscriptions.remove(topicFilter);
+#endif
+}
+
+
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+void MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::complete(int packet_type, unsigned short packetid, int rc)
+{
+    if (ah)
+        ah(packet_type, packetid, rc);
+}
+
+
+/**
+ * Drop the session state and fail whatever requests are still outstanding.  The state is
+ * reset before the ack handler runs so that it may call connect() again.
+ */
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+void MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::close()
+{
+    int type = pendingType;
+    unsigned short id = pendingMsgid;
+
+    connstate = DISCONNECTED;
+    ping_outstanding = false;
+    transport.state = 0;
+#if MQTTCLIENT_RX_RING_SIZE > 0
+    rx.clear();
+#endif
+    pendingType = 0;
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+    batch.clear();
+#endif
+#if MQTTCLIENT_MQTTV5
+    aliases.reset(0);
+#endif
+    if (type != 0)
+        complete(type, id, FAILURE);
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    for (int i = 0; i < MAX_INFLIGHT; ++i)
+    {
+        if (inflight[i].msgid != 0)
+        {
+            id = inflight[i].msgid;
+            inflight[i].msgid = 0;
+            complete((inflight[i].type == PUBACK) ? PUBACK : PUBCOMP, id, FAILURE);
+        }
+    }
+#endif
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MAX_INFLIGHT, Routes>::handlePacket(int packet_type)
+{
+    int rc = SUCCESS;
+    int len = 0;
+    Timer timer = Timer(command_timeout_ms);
+
+    switch (packet_type)
+    {
+        case CONNACK:
+        {
+            unsigned char connack_rc = 255;
+            unsigned char sessionPresent = 0;
+#if MQTTCLIENT_MQTTV5
+            MQTTProperty array[MQTTCLIENT_CONNACK_PROPERTIES];
+            MQTTProperties props = {0, MQTTCLIENT_CONNACK_PROPERTIES, 0, array};
+            unsigned long aliasMax = 0;
+#else
+            MQTTProperties props = MQTTProperties_initializer;
+#endif
+            if (pendingType != CONNACK)
+                break;
+            pendingType = 0;
+            if (MQTTV5Deserialize_connack(properties(props), &sessionPresent, &connack_rc, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+                rc = FAILURE;
+            else if (connack_rc == 0)
+            {
+                connstate = CONNECTED;
+                session_present = (sessionPresent != 0);
+#if MQTTCLIENT_MQTTV5
+                if (mqttVersion == 5 && MQTTProperties_getNumericValue(&props, MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM, &aliasMax))
+                    aliases.reset(aliasMax);
+#endif
+            }
+            else
+                connstate = DISCONNECTED;   // refused by the server
+            complete(CONNACK, 0, (rc == SUCCESS) ? (int)connack_rc : (int)FAILURE);
+            break;
+        }
+        case SUBACK:
+        {
+            int count = 0, grantedQoS[MQTTCLIENT_SUBSCRIBE_FILTERS];
+            int result = QOS2, refused = 0;
+            unsigned short mypacketid;
+            MQTTProperties props = MQTTProperties_initializer;     // skipped
+            if (MQTTV5Deserialize_suback(&mypacketid, properties(props), MQTTCLIENT_SUBSCRIBE_FILTERS, &count, grantedQoS,
+                    readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+            {
+                rc = FAILURE;
+                break;
+            }
+            if (pendingType != SUBACK || mypacketid != pendingMsgid)
+                break;
+            pendingType = 0;
+            if (count != pendingCount)
+                refused = 0x80;
+            for (int i = 0; i < count && i < pendingCount; ++i)
+            {
+                grantedQoS[i] &= 0xFF;      // read as a signed char
+                if (grantedQoS[i] >= 0x80)
+                    refused = refused ? refused : grantedQoS[i];
+                else if (pendingHandlers != 0 && pendingHandlers[i] != 0 &&
+                        setMessageHandler(pendingFilters[i], pendingHandlers[i]) != SUCCESS)
+                    refused = refused ? refused : FAILURE;
+                else if (grantedQoS[i] < result)
+                    result = grantedQoS[i];
+            }
+            complete(SUBACK, mypacketid, refused ? refused : result);
+            break;
+        }
+        case UNSUBACK:
+        {
+            unsigned short mypacketid;
+            if (MQTTDeserialize_unsuback(&mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+            {
+                rc = FAILURE;
+                break;
+            }
+            if (pendingType != UNSUBACK || mypacketid != pendingMsgid)
+                break;
+            pendingType = 0;
+            removeMessageHandler(pendingFilter);
+            complete(UNSUBACK, mypacketid, SUCCESS);
+            break;
+        }
+        case PUBLISH:
+        {
+            MQTTString topicName = MQTTString_initializer;
+            MQTTProperties props = MQTTProperties_initializer;     // skipped
+            Message msg;
+            if (MQTTV5Deserialize_publish((unsigned char*)&msg.dup, (int*)&msg.qos, (unsigned char*)&msg.retained, (unsigned short*)&msg.id, &topicName,
+                                 properties(props), (unsigned char**)&msg.payload, (int*)&msg.payloadlen, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+            {
+                rc = FAILURE;
+                break;
+            }
+#if MQTTCLIENT_QOS2
+            if (msg.qos != QOS2)
+#endif
+                deliverMessage(topicName, msg);
+#if MQTTCLIENT_QOS2
+            else if (isQoS2msgidFree(msg.id))
+            {
+                if (useQoS2msgid(msg.id))
+                    deliverMessage(topicName, msg);
+                else
+                    WARN("Maximum number of incoming QoS2 messages exceeded");
+            }
+#endif
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+            if (msg.qos != QOS0)
+            {
+                len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, (msg.qos == QOS1) ? PUBACK : PUBREC, 0, msg.id);
+                if (len <= 0)
+                    rc = FAILURE;
+                else
+                    rc = sendPacket(len, timer);
+            }
+#endif
+            break;
+        }
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+        case PUBACK:
+        case PUBCOMP:
+        {
+            unsigned short mypacketid;
+            unsigned char dup, type;
+            InflightSlot* slot = 0;
+            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+                rc = FAILURE;
+            else if ((slot = findSlot(mypacketid)) != 0 && slot->type == packet_type)
+            {
+                slot->msgid = 0;
+                complete(packet_type, mypacketid, SUCCESS);
+            }
+            break;
+        }
+#endif
+#if MQTTCLIENT_QOS2
+        case PUBREC:
+        case PUBREL:
+        {
+            unsigned short mypacketid;
+            unsigned char dup, type;
+            InflightSlot* slot = 0;
+            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, readbuf, MAX_MQTT_PACKET_SIZE) != 1)
+                rc = FAILURE;
+            else if ((len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE,
+                         (packet_type == PUBREC) ? PUBREL : PUBCOMP, 0, mypacketid)) <= 0)
+                rc = FAILURE;
+            else if ((rc = sendPacket(len, timer)) != SUCCESS) // send the PUBREL or PUBCOMP packet
+                rc = FAILURE; // there was a problem
+            else if (packet_type == PUBREL)
+                freeQoS2msgid(mypacketid);
+            else if ((slot = findSlot(mypacketid)) != 0 && slot->type == PUBREC)
+            {
+                slot->type = PUBCOMP;
+                slot->retries = 0;
+                slot->timer.countdown_ms(command_timeout_ms);
+            }
+            break;
+        }
+#endif
+        case PINGRESP:
+            ping_outstanding = false;
+            break;
+    }
+
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::keepalive()
+{
+    int rc = SUCCESS;
+
+    if (keepAliveInterval == 0 || connstate != CONNECTED)
+        goto exit;
+
+    if (ping_outstanding)
+    {
+        if (ping_timer.expired())
+            rc = FAILURE;   // no pingresp within a keepalive interval, the connection is gone
+    }
+    else if (last_sent.expired() || last_received.expired())
+    {
+        Timer timer = Timer(1000);
+        int len = MQTTSerialize_pingreq(sendbuf, MAX_MQTT_PACKET_SIZE);
+        if (len > 0 && (rc = sendPacket(len, timer)) == SUCCESS) // send the ping packet
+        {
+            ping_outstanding = true;
+            ping_timer.countdown(keepAliveInterval);
+        }
+    }
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::poll()
+{
+    int rc = SUCCESS;
+    int packet_type;
+
+    if (connstate == DISCONNECTED)
+        goto exit;
+
+#if MQTTCLIENT_RX_RING_SIZE > 0
+    if (rx.fill(ipstack, 0) < 0)
+    {
+        rc = FAILURE;
+        goto exit;
+    }
+#endif
+    while ((packet_type = readPacket()) != 0)
+    {
+        if (packet_type < 0 || handlePacket(packet_type) != SUCCESS)
+        {
+            rc = FAILURE;
+            goto exit;
+        }
+        if (this->keepAliveInterval > 0)
+            last_received.countdown(this->keepAliveInterval); // record the fact that we have successfully received a packet
+        if (connstate == DISCONNECTED)
+            goto exit;
+    }
+
+    if (pendingType != 0 && pending_timer.expired())
+    {
+        if (pendingType == CONNACK)
+        {
+            rc = FAILURE;   // close() reports the failed connect
+            goto exit;
+        }
+        int type = pendingType;
+        pendingType = 0;
+        complete(type, pendingMsgid, FAILURE);
+    }
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    for (int i = 0; i < MAX_INFLIGHT; ++i)
+    {
+        InflightSlot* slot = &inflight[i];
+        if (slot->msgid == 0 || !slot->timer.expired())
+            continue;
+        if (slot->retries < MQTTCLIENT_PUBLISH_RETRIES)
+        {
+            if (retransmit(slot) != SUCCESS)
+            {
+                rc = FAILURE;
+                goto exit;
+            }
+        }
+        else
+        {
+            unsigned short id = slot->msgid;
+            slot->msgid = 0;
+            complete((slot->type == PUBACK) ? PUBACK : PUBCOMP, id, FAILURE);
+        }
+    }
+#endif
+
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+    if (batch.due())
+    {
+        Timer timer = Timer(command_timeout_ms);
+        if ((rc = flush(timer)) != SUCCESS)
+            goto exit;
+    }
+#endif
+
+    rc = keepalive();
+
+exit:
+    if (rc != SUCCESS || connstate == DISCONNECTED)
+    {
+        if (connstate != DISCONNECTED || pendingType != 0)
+            close();
+        rc = FAILURE;
+    }
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::connect(MQTTPacket_connectData& options)
+{
+    return connect(options, 0);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::connect(MQTTPacket_connectData& options, MQTTProperties* connectProperties)
+{
+    Timer connect_timer = Timer(command_timeout_ms);
+    int rc = FAILURE;
+    int len = 0;
+
+    if (connstate != DISCONNECTED) // don't send connect packet again if we are already connected
+        goto exit;
+#if MQTTCLIENT_MQTTV5
+    mqttVersion = options.MQTTVersion;
+#else
+    if (options.MQTTVersion == 5)
+        goto exit;      // MQTT 5 needs MQTTCLIENT_MQTTV5
+#endif
+
+    this->keepAliveInterval = options.keepAliveInterval;
+    ping_outstanding = false;
+    session_present = false;
+    transport.state = 0;
+#if MQTTCLIENT_RX_RING_SIZE > 0
+    rx.clear();
+#endif
+    if ((len = MQTTV5Serialize_connect(sendbuf, MAX_MQTT_PACKET_SIZE, &options, connectProperties, 0)) <= 0)
+        goto exit;
+    if ((rc = sendPacket(len, connect_timer)) != SUCCESS)  // send the connect packet
+        goto exit; // there was a problem
+
+    if (this->keepAliveInterval > 0)
+        last_received.countdown(this->keepAliveInterval);
+    connstate = CONNECTING;
+    pendingType = CONNACK;
+    pendingMsgid = 0;
+    pending_timer.countdown_ms(command_timeout_ms);
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MAX_INFLIGHT, Routes>::subscribe(const char* topicFilter, enum QoS qos, messageHandler mh)
+{
+    if (connstate != CONNECTED || pendingType != 0)
+        return FAILURE;     // pendingFilter and pendingHandler are in use
+    pendingFilter = topicFilter;
+    pendingHandler = mh;
+    return subscribe(1, &pendingFilter, &qos, &pendingHandler);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int MAX_MESSAGE_HANDLERS, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, MAX_MESSAGE_HANDLERS, MAX_INFLIGHT, Routes>::subscribe(int count,
+        const char* const topicFilters[], enum QoS qos[], messageHandler mhs[])
+{
+    int rc = FAILURE;
+    Timer timer = Timer(command_timeout_ms);
+    int len = 0;
+    int slots = 0, needed = 0;
+    MQTTString topics[MQTTCLIENT_SUBSCRIBE_FILTERS];
+    int requestedQoS[MQTTCLIENT_SUBSCRIBE_FILTERS];
+    MQTTProperties props = MQTTProperties_initializer;
+
+    if (connstate != CONNECTED || pendingType != 0 || count <= 0 || count > MQTTCLIENT_SUBSCRIBE_FILTERS)
+        goto exit;
+    for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+    {
+        if (messageHandlers[i].topicFilter == 0)
+            ++slots;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        topics[i].cstring = (char*)topicFilters[i];
+        topics[i].lenstring.len = 0;
+        topics[i].lenstring.data = 0;
+        requestedQoS[i] = qos[i];
+        if (mhs != 0 && mhs[i] != 0)
+            ++needed;
+    }
+    if (needed > slots)
+        goto exit;  // no room for the message handlers
+
+    pendingMsgid = packetid.getNext();
+    len = MQTTV5Serialize_subscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, pendingMsgid, properties(props), count, topics, requestedQoS);
+    if (len <= 0)
+        goto exit;
+    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the subscribe packet
+        goto exit;             // there was a problem
+
+    pendingType = SUBACK;
+    pendingFilters = topicFilters;
+    pendingHandlers = mhs;
+    pendingCount = count;
+    pending_timer.countdown_ms(command_timeout_ms);
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::unsubscribe(const char* topicFilter)
+{
+    int rc = FAILURE;
+    Timer timer = Timer(command_timeout_ms);
+    MQTTString topic = {(char*)topicFilter, {0, 0}};
+    MQTTProperties props = MQTTProperties_initializer;
+    int len = 0;
+
+    if (connstate != CONNECTED || pendingType != 0)
+        goto exit;
+
+    pendingMsgid = packetid.getNext();
+    if ((len = MQTTV5Serialize_unsubscribe(sendbuf, MAX_MQTT_PACKET_SIZE, 0, pendingMsgid, properties(props), 1, &topic)) <= 0)
+        goto exit;
+    if ((rc = sendPacket(len, timer)) != SUCCESS) // send the unsubscribe packet
+        goto exit; // there was a problem
+
+    pendingType = UNSUBACK;
+    pendingFilter = topicFilter;
+    pending_timer.countdown_ms(command_timeout_ms);
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::sendPublish(const char* topicName, PreparedTopic* prepared,
+        void* payload, size_t payloadlen, unsigned short id, enum QoS qos, bool retained, unsigned char dup, Timer& timer)
+{
+    int rc = FAILURE;
+    MQTTString topicString = MQTTString_initializer;
+    MQTTProperties props = MQTTProperties_initializer;
+    unsigned char* segment = 0;
+    int segmentlen = 0;
+    int len = 0;
+
+#if MQTTCLIENT_MQTTV5
+    if (prepared && mqttVersion == 5)
+    {
+        bool known = false;
+        unsigned short alias = aliases.find(prepared, known);
+        unsigned char* header = prepared->serializeV5(&len, dup, qos, retained, id, payloadlen, alias, known);
+        if (header)
+            rc = sendPacket(header, len, timer, (unsigned char*)payload, payloadlen);
+        if (rc != SUCCESS && !known)
+            aliases.remove(alias);      // the server never saw it
+        return rc;
+    }
+#endif
+    if (prepared)
+    {
+        unsigned char* header = prepared->serialize(&len, dup, qos, retained, id, payloadlen);
+        if (header)
+            rc = sendPacket(header, len, timer, (unsigned char*)payload, payloadlen);
+        return rc;
+    }
+
+    topicString.cstring = (char*)topicName;
+
+#if MQTTCLIENT_SCATTER_PUBLISH
+    // only the fixed header and topic go into sendbuf, the payload is written from the caller's memory
+    len = MQTTV5Serialize_publishHeader(sendbuf, MAX_MQTT_PACKET_SIZE, dup, qos, retained, id,
+              topicString, properties(props), payloadlen);
+    segment = (unsigned char*)payload;
+    segmentlen = payloadlen;
+#else
+    len = MQTTV5Serialize_publish(sendbuf, MAX_MQTT_PACKET_SIZE, dup, qos, retained, id,
+              topicString, properties(props), (unsigned char*)payload, payloadlen);
+#endif
+    if (len > 0)
+        rc = sendPacket(sendbuf, len, timer, segment, segmentlen); // send the publish packet
+
+    return rc;
+}
+
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+/**
+ * Find the in-flight slot for a packet id.  Packet id 0 finds a free slot.
+ */
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+typename MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::InflightSlot* MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::findSlot(unsigned short msgid)
+{
+    for (int i = 0; i < MAX_INFLIGHT; ++i)
+    {
+        if (inflight[i].msgid == msgid)
+            return &inflight[i];
+    }
+    return 0;
+}
+
+
+/**
+ * Send an unacknowledged publish again with DUP set, or its PUBREL if the PUBREC has already arrived.
+ */
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::retransmit(InflightSlot* slot)
+{
+    int rc = FAILURE;
+    Timer timer = Timer(command_timeout_ms);
+
+    if (slot->type == PUBCOMP)
+    {
+        int len = MQTTSerialize_ack(sendbuf, MAX_MQTT_PACKET_SIZE, PUBREL, 0, slot->msgid);
+        if (len > 0)
+            rc = sendPacket(len, timer);
+    }
+    else
+        rc = sendPublish(slot->topicName, slot->prepared, slot->payload, slot->payloadlen, slot->msgid, slot->qos, slot->retained, 1, timer);
+
+    slot->retries++;
+    slot->timer.countdown_ms(command_timeout_ms);
+    return rc;
+}
+#endif
+
+
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+unsigned long MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::next_ms()
+{
+    unsigned long ms = NO_DEADLINE;
+
+    if (connstate == DISCONNECTED)
+        goto exit;
+
+    if (connstate == CONNECTED && keepAliveInterval > 0)
+    {
+        if (ping_outstanding)
+            earliest(ms, ping_timer);
+        else
+        {
+            earliest(ms, last_sent);
+            earliest(ms, last_received);
+        }
+    }
+    if (pendingType != 0)
+        earliest(ms, pending_timer);
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    for (int i = 0; i < MAX_INFLIGHT; ++i)
+    {
+        if (inflight[i].msgid != 0)
+            earliest(ms, inflight[i].timer);
+    }
+#endif
+
+#if MQTTCLIENT_TX_BATCH_SIZE > 0
+    unsigned long flush_left;
+    if (batch.deadlineLeft(flush_left) && flush_left < ms)
+        ms = flush_left;
+#endif
+
+exit:
+    return ms;
+}
+
+
+template<class Network, class Timer, int a, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, a, b, MAX_INFLIGHT, Routes>::inflightCount()
+{
+    int count = 0;
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    for (int i = 0; i < MAX_INFLIGHT; ++i)
+    {
+        if (inflight[i].msgid != 0)
+            ++count;
+    }
+#endif
+    return count;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::startPublish(const char* topicName, PreparedTopic* prepared,
+        void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
+{
+    int rc = FAILURE;
+    Timer timer = Timer(command_timeout_ms);
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    InflightSlot* slot = 0;
+#endif
+
+    if (connstate != CONNECTED)
+        goto exit;
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (qos == QOS1 || qos == QOS2)
+    {
+        if ((slot = findSlot(0)) == 0)
+            goto exit;  // the in-flight window is full
+        do
+            id = packetid.getNext();
+        while (findSlot(id) != 0);  // skip ids still in flight after a wrap
+    }
+#endif
+
+    if ((rc = sendPublish(topicName, prepared, payload, payloadlen, id, qos, retained, 0, timer)) != SUCCESS)
+        goto exit; // there was a problem
+
+#if MQTTCLIENT_QOS1 || MQTTCLIENT_QOS2
+    if (slot)
+    {
+        slot->msgid = id;
+        slot->type = (qos == QOS1) ? PUBACK : PUBREC;
+        slot->retries = 0;
+        slot->topicName = topicName;
+        slot->prepared = prepared;
+        slot->payload = payload;
+        slot->payloadlen = payloadlen;
+        slot->qos = qos;
+        slot->retained = retained;
+        slot->timer.countdown_ms(command_timeout_ms);
+    }
+#endif
+
+exit:
+    return rc;
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::publish(const char* topicName, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
+{
+    return startPublish(topicName, 0, payload, payloadlen, id, qos, retained);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::publish(PreparedTopic& topic, void* payload, size_t payloadlen, unsigned short& id, enum QoS qos, bool retained)
+{
+    return startPublish(topic.topicName(), &topic, payload, payloadlen, id, qos, retained);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::publish(PreparedTopic& topic, void* payload, size_t payloadlen, enum QoS qos, bool retained)
+{
+    unsigned short id = 0;  // dummy - not used for anything
+    return publish(topic, payload, payloadlen, id, qos, retained);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::publish(const char* topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained)
+{
+    unsigned short id = 0;  // dummy - not used for anything
+    return publish(topicName, payload, payloadlen, id, qos, retained);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::publish(const char* topicName, Message& message)
+{
+    return publish(topicName, message.payload, message.payloadlen, message.qos, message.retained);
+}
+
+
+template<class Network, class Timer, int MAX_MQTT_PACKET_SIZE, int b, int MAX_INFLIGHT, class Routes>
+int MQTT::AsyncClient<Network, Timer, MAX_MQTT_PACKET_SIZE, b, MAX_INFLIGHT, Routes>::disconnect()
+{
+    int rc = FAILURE;
+    Timer timer = Timer(command_timeout_ms);
+    int len = MQTTSerialize_disconnect(sendbuf, MAX_MQTT_PACKET_SIZE);
+    if (len > 0 && connstate != DISCONNECTED && (rc = sendPacket(len, timer)) == SUCCESS)  // send the disconnect packet
+        rc = flush(timer);                      // along with anything still held back
+
+    close();
+    return rc;
+}
+
+
+#endif
@@ -0,0 +1,313 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    bounded views of a received message, without copies
+ *******************************************************************************/
+
+#if !defined(MQTTMESSAGEVIEW_H)
+#define MQTTMESSAGEVIEW_H
+
+#include "MQTTClient.h"
+#include <string.h>
+
+#if !defined(MQTTCLIENT_VIEW_WILDCARDS)
+    #define MQTTCLIENT_VIEW_WILDCARDS 4     // + and # segments of the topic kept by a MessageView
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * @class View
+ * @brief characters which are not NUL terminated: a pointer and a length
+ *
+ * The topic and payload of a received publish are in the client's read buffer, and neither ends
+ * in a NUL, so they cannot be given to strlen, atoi or String, and writing a NUL after them
+ * overwrites the next packet's bytes or runs off the end of the buffer.  A View carries the
+ * length instead, and its parsers stop at it.
+ */
+class View
+{
+public:
+
+    View() : data(0), len(0)
+    { }
+
+    View(const char* data, int len) : data(data), len(len)
+    { }
+
+    bool empty() const
+    {
+        return len == 0;
+    }
+
+    char operator[](int i) const
+    {
+        return data[i];
+    }
+
+    /** Is the view the same as a NUL terminated string? */
+    bool equals(const char* s) const
+    {
+        return (int)strlen(s) == len && (len == 0 || memcmp(data, s, len) == 0);
+    }
+
+    /** Parse the whole view, less any spaces around it, as a decimal integer
+     *  @param value - set to the number if there is one
+     *  @return true if the view is a number
+     */
+    bool toInt(long& value) const
+    {
+        int i = 0, end = len;
+        bool negative = false;
+        long n = 0;
+
+        while (i < end && data[i] == ' ')
+            ++i;
+        while (end > i && data[end - 1] == ' ')
+            --end;
+        if (i < end && (data[i] == '-' || data[i] == '+'))
+            negative = (data[i++] == '-');
+        if (i == end)
+            return false;
+        for (; i < end; ++i)
+        {
+            if (data[i] < '0' || data[i] > '9')
+                return false;
+            n = n * 10 + (data[i] - '0');
+        }
+        value = negative ? -n : n;
+        return true;
+    }
+
+    /** Find the value of a member of a JSON object anywhere in the view, such as "light" in
+     *  {"d":{"light":1}}.  The first member with the name is taken, at whatever depth.
+     *  @param name - the member name, without quotes
+     *  @return the value - without its quotes for a string, the whole {...} or [...] for an object
+     *      or array - or an empty view if there is no such member
+     */
+    View field(const char* name) const
+    {
+        int namelen = strlen(name);
+
+        for (int i = 0; i < len; ++i)
+        {
+            if (data[i] != '"')
+                continue;
+            int start = i + 1;
+            int end = skipString(i);
+            if (end >= len)
+                break;
+            i = end;
+            int colon = skipSpaces(end + 1);
+            if (colon >= len || data[colon] != ':')
+                continue;   // a string value, not a member name
+            if (end - start == namelen && strncmp(&data[start], name, namelen) == 0)
+                return value(skipSpaces(colon + 1));
+        }
+        return View();
+    }
+
+    /** Copy to a NUL terminated string, shortened if it does not fit
+     *  @return the number of characters copied
+     */
+    int copy(char* buf, int buflen) const
+    {
+        int n = (len < buflen - 1) ? len : buflen - 1;
+
+        if (buflen <= 0)
+            return 0;
+        if (n > 0)
+            memcpy(buf, data, n);
+        buf[n] = '\0';
+        return n;
+    }
+
+    const char* data;
+    int len;
+
+private:
+
+    int skipSpaces(int i) const
+    {
+        while (i < len && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n'))
+            ++i;
+        return i;
+    }
+
+    // the index of the quote which closes the string opening at i, or len if it is not closed
+    int skipString(int i) const
+    {
+        for (++i; i < len && data[i] != '"'; ++i)
+        {
+            if (data[i] == '\\')
+                ++i;
+        }
+        return (i < len) ? i : len;
+    }
+
+    // the JSON value starting at i
+    View value(int i) const
+    {
+        int start = i, depth = 0;
+
+        if (i >= len)
+            return View();
+        if (data[i] == '"')
+        {
+            int end = skipString(i);
+            return (end < len) ? View(&data[i + 1], end - i - 1) : View();
+        }
+        for (; i < len; ++i)
+        {
+            char c = data[i];
+            if (c == '"')
+                i = skipString(i);
+            else if (c == '{' || c == '[')
+                ++depth;
+            else if (c == '}' || c == ']')
+            {
+                if (depth == 0)
+                    break;      // the end of the object holding a number or literal
+                if (--depth == 0)
+                {
+                    ++i;
+                    break;
+                }
+            }
+            else if (depth == 0 && (c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+                break;
+        }
+        return View(&data[start], i - start);
+    }
+};
+
+
+/**
+ * @class MessageView
+ * @brief a received message as views into the client's read buffer
+ *
+ * Built in a message handler from its MessageData, or handed to a ViewRoute's handler.  The
+ * topic, payload and wildcard segments all point into the read buffer, so nothing is copied or
+ * allocated, and they are only valid until the handler returns.
+ */
+class MessageView
+{
+public:
+
+    /** @param md - the message data given to the handler
+     *  @param filter - the filter the message matched, for wildcard(), or 0
+     */
+    MessageView(MessageData& md, const char* filter = 0) : message(md.message),
+        topic(md.topicName.lenstring.data, md.topicName.lenstring.len),
+        payload((const char*)md.message.payload, (int)md.message.payloadlen), wildcards(0)
+    {
+        if (md.topicName.cstring)
+            topic = View(md.topicName.cstring, strlen(md.topicName.cstring));
+        if (filter)
+            matchWildcards(filter);
+    }
+
+    /** The topic level at index, from 0, or an empty view if the topic has fewer levels */
+    View level(int index) const
+    {
+        int start = 0;
+
+        for (int i = 0; i <= topic.len; ++i)
+        {
+            if (i == topic.len || topic[i] == '/')
+            {
+                if (index-- == 0)
+                    return View(&topic.data[start], i - start);
+                start = i + 1;
+            }
+        }
+        return View();
+    }
+
+    /** The part of the topic matched by the filter's + or # at index, from 0 - for
+     *  iot-2/cmd/+/fmt/json, wildcard(0) is the command name
+     */
+    View wildcard(int index) const
+    {
+        return (index < wildcards) ? segments[index] : View();
+    }
+
+    int wildcardCount() const
+    {
+        return wildcards;
+    }
+
+    Message& message;
+    View topic;
+    View payload;
+
+private:
+
+    // walk the filter and the topic level by level, noting what each wildcard matched
+    void matchWildcards(const char* filter)
+    {
+        int level = 0;
+
+        for (const char* f = filter; *f && wildcards < MQTTCLIENT_VIEW_WILDCARDS; ++level)
+        {
+            if (f[0] == '+' && (f[1] == '/' || f[1] == '\0'))
+                segments[wildcards++] = this->level(level);
+            else if (f[0] == '#')
+            {
+                View rest = this->level(level);     // empty when # matched the parent level
+                if (rest.data)
+                    rest.len = topic.data + topic.len - rest.data;
+                segments[wildcards++] = rest;
+                break;
+            }
+            while (*f && *f != '/')
+                ++f;
+            if (*f == '/')
+                ++f;
+        }
+    }
+
+    View segments[MQTTCLIENT_VIEW_WILDCARDS];
+    int wildcards;
+};
+
+
+/**
+ * @class ViewRoute
+ * @brief a Route whose handler takes a MessageView, with the segments its filter's wildcards matched
+ * @param FILTER the topic filter, a char array with external linkage
+ * @param HANDLER the function called for each message which matches FILTER
+ * @param NEXT the rest of the routes
+ */
+template<const char* FILTER, void (*HANDLER)(MessageView&), class NEXT = NoRoutes>
+struct ViewRoute
+{
+    static bool deliver(MQTTString& topicName, MessageData& md)
+    {
+        bool matched = topicMatched(FILTER, topicName);
+
+        if (matched)
+        {
+            MessageView view(md, FILTER);
+            HANDLER(view);
+        }
+        return NEXT::deliver(topicName, md) || matched;
+    }
+};
+
+
+}
+
+#endif
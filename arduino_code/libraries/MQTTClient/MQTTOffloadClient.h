@@ -0,0 +1,408 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    MQTT client which leaves the protocol to a daemon on the Yun's Linux side
+ *******************************************************************************/
+
+#if !defined(MQTTOFFLOADCLIENT_H)
+#define MQTTOFFLOADCLIENT_H
+
+#include "MQTTClient.h"
+#include <string.h>
+
+#if !defined(MQTTOFFLOAD_DAEMON)
+    #define MQTTOFFLOAD_DAEMON "/usr/bin/mqtt-offload"
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * The frames exchanged with the offload daemon over its stdin and stdout.  Each frame is a length
+ * byte, counting the type and the body, then the type and the body.  Strings in a body are a
+ * length byte and the characters, except for a topic or payload at the end, which runs to the end
+ * of the frame.  Packet ids are two bytes, high byte first.
+ */
+enum OffloadFrame
+{
+    // to the daemon
+    OFFLOAD_HELLO = 'H',        // largest frame the sketch can receive
+    OFFLOAD_CONNECT = 'C',      // port(2) keepalive(2) cleansession(1) MQTTVersion(1) host clientID username password
+    OFFLOAD_DISCONNECT = 'D',
+    OFFLOAD_TOPIC = 'T',        // topic id(1) topic - numbers a topic for OFFLOAD_PUBLISH
+    OFFLOAD_PUBLISH = 'P',      // packet id(2) qos|retained<<2 (1) topic id(1) payload
+    OFFLOAD_PUBLISH_NAMED = 'p',// packet id(2) qos|retained<<2 (1) topic payload
+    OFFLOAD_SUBSCRIBE = 'S',    // slot(1) qos(1) filter
+    OFFLOAD_UNSUBSCRIBE = 'U',  // slot(1)
+
+    // from the daemon
+    OFFLOAD_STATUS = 'K',       // connack return code(1), OFFLOAD_LOST when the connection is down
+    OFFLOAD_ACK = 'A',          // packet type(1) packet id(2) rc(1)
+    OFFLOAD_MESSAGE = 'M'       // slot(1) qos|retained<<2|dup<<3 (1) topic payload
+};
+
+enum { OFFLOAD_LOST = 0xFF };
+
+
+/**
+ * @class OffloadClient
+ * @brief MQTT client for the Yun which runs the protocol in a daemon on the Linux side
+ *
+ * With MQTT::Client, every byte of every packet crosses the Bridge inside generic socket frames,
+ * and the sketch holds the packet buffers and the session state in the AVR's 2.5 KB of RAM.  Here
+ * the sketch starts the daemon as a Bridge process and sends it compact frames over the process's
+ * stdin - "publish these bytes to topic 3" - and the daemon keeps the MQTT session: the TCP
+ * connection, keepalive, QoS 1 and 2 retries, reconnecting with backoff and subscribing again
+ * after a reconnect, and queueing publishes while the broker is unreachable.  poll() picks up
+ * the daemon's replies with one Bridge transfer when there are none.
+ *
+ * The calls do not wait for the broker.  As with MQTT::AsyncClient, outcomes are reported through
+ * the ack handler: CONNACK each time the daemon connects, or fails to, or loses the connection;
+ * SUBACK and UNSUBACK with the slot of the subscription as the packet id; and PUBACK or PUBCOMP
+ * once the broker has a QoS 1 or 2 publish.  Publishes are handed over at once, so their topic and
+ * payload need not outlive the call.
+ * @param Bridge a class with the transfer methods of BridgeClass
+ * @param MAX_FRAME the largest frame received from the daemon - messages which do not fit are
+ *     dropped by the daemon - at most 255
+ * @param MAX_MESSAGE_HANDLERS the number of subscriptions
+ */
+template<class Bridge, int MAX_FRAME = 100, int MAX_MESSAGE_HANDLERS = 2>
+class OffloadClient
+{
+public:
+
+    typedef void (*messageHandler)(MessageData&);
+    typedef void (*ackHandler)(int packet_type, unsigned short packetid, int rc);
+
+    enum State { STOPPED, DISCONNECTED, CONNECTING, CONNECTED };
+
+    OffloadClient(Bridge& bridge) : bridge(bridge), connstate(STOPPED), handle(0), received(0), topics(0), ah(0)
+    {
+        for (int i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
+            messageHandlers[i].topicFilter = 0;
+    }
+
+    void setAckHandler(ackHandler ah)
+    {
+        this->ah = ah;
+    }
+
+    /** Start the daemon.  Bridge.begin() must have been called.
+     *  @param daemon - the path of the daemon on the Linux side
+     *  @return success code -
+     */
+    int begin(const char* daemon = MQTTOFFLOAD_DAEMON)
+    {
+        unsigned char cmd[] = {'R'};
+        unsigned char res[2];
+        unsigned char hello[] = {MAX_FRAME};
+
+        if (bridge.transfer(cmd, 1, (const unsigned char*)daemon, strlen(daemon), res, 2) != 2 || res[0] != 0)
+            return FAILURE;
+        handle = res[1];
+        connstate = DISCONNECTED;
+        received = 0;
+        topics = 0;
+        return send(OFFLOAD_HELLO, hello, sizeof(hello));
+    }
+
+    /** Have the daemon connect to a broker, and stay connected until disconnect() is called.
+     *  The outcome is reported to the ack handler as CONNACK, and so is each reconnect.
+     *  @param host - the broker's host name
+     *  @param port - the broker's port
+     *  @param options - connect options; will messages are not supported
+     *  @return success code -
+     */
+    int connect(const char* host, int port, MQTTPacket_connectData& options)
+    {
+        unsigned char buf[MAX_FRAME];
+        int len = 0;
+
+        buf[len++] = (unsigned char)(port >> 8);
+        buf[len++] = (unsigned char)port;
+        buf[len++] = (unsigned char)(options.keepAliveInterval >> 8);
+        buf[len++] = (unsigned char)options.keepAliveInterval;
+        buf[len++] = options.cleansession;
+        buf[len++] = options.MQTTVersion;
+        if (!addString(buf, len, host) || !addString(buf, len, options.clientID.cstring) ||
+                !addString(buf, len, options.username.cstring) || !addString(buf, len, options.password.cstring))
+            return BUFFER_OVERFLOW;
+        if (send(OFFLOAD_CONNECT, buf, len) != SUCCESS)
+            return FAILURE;
+        connstate = CONNECTING;
+        return SUCCESS;
+    }
+
+    /** Give a topic a number, so that publishes to it send one byte instead of its name
+     *  @param topicName - the topic
+     *  @return the topic id, or FAILURE if 255 topics have been numbered
+     */
+    int topic(const char* topicName)
+    {
+        unsigned char buf[MAX_FRAME];
+        int len = 0;
+
+        if (topics == 255)
+            return FAILURE;
+        buf[len++] = topics;
+        if (!addString(buf, len, topicName, false) || send(OFFLOAD_TOPIC, buf, len) != SUCCESS)
+            return FAILURE;
+        return topics++;
+    }
+
+    /** Publish to a numbered topic
+     *  @param topicId - the number from topic()
+     *  @param payload - the data to send, copied before the call returns
+     *  @param id - the packet id used, for the PUBACK or PUBCOMP at QoS 1 or 2 - returned
+     *  @return success code - the message is with the daemon, which sends it when it can
+     */
+    int publish(int topicId, const void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false)
+    {
+        unsigned char cmd[] = {'I', handle, 0, OFFLOAD_PUBLISH, 0, 0, (unsigned char)(qos | (retained << 2)), (unsigned char)topicId};
+
+        if (connstate == STOPPED)
+            return FAILURE;
+        if (payloadlen > 255 - 5)
+            return BUFFER_OVERFLOW;
+        cmd[2] = 5 + payloadlen;
+        id = nextId(cmd + 4, qos);
+        bridge.transfer(cmd, sizeof(cmd), (const unsigned char*)payload, payloadlen, 0, 0);
+        return SUCCESS;
+    }
+
+    int publish(int topicId, const void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false)
+    {
+        unsigned short id = 0;
+        return publish(topicId, payload, payloadlen, id, qos, retained);
+    }
+
+    /** Publish to a topic given by name - one use topics, or more than 255 of them
+     */
+    int publish(const char* topicName, const void* payload, size_t payloadlen, unsigned short& id, enum QoS qos = QOS1, bool retained = false)
+    {
+        size_t topiclen = strlen(topicName);
+        unsigned char cmd[] = {'I', handle, 0, OFFLOAD_PUBLISH_NAMED, 0, 0, (unsigned char)(qos | (retained << 2)), (unsigned char)topiclen};
+
+        if (connstate == STOPPED)
+            return FAILURE;
+        if (topiclen > 255 || payloadlen + topiclen > 255 - 5)
+            return BUFFER_OVERFLOW;
+        cmd[2] = 5 + topiclen + payloadlen;
+        id = nextId(cmd + 4, qos);
+        bridge.transfer(cmd, sizeof(cmd), (const unsigned char*)topicName, topiclen, (const unsigned char*)payload, payloadlen, 0, 0);
+        return SUCCESS;
+    }
+
+    int publish(const char* topicName, const void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false)
+    {
+        unsigned short id = 0;
+        return publish(topicName, payload, payloadlen, id, qos, retained);
+    }
+
+    int publish(const char* topicName, Message& message)
+    {
+        return publish(topicName, message.payload, message.payloadlen, message.qos, message.retained);
+    }
+
+    /** Subscribe.  The daemon subscribes again each time it reconnects, until unsubscribe().
+     *  The SUBACK is reported with the subscription's slot as the packet id.
+     *  @param topicFilter - the filter, which must stay valid until unsubscribe
+     *  @return success code - FAILURE if all the slots are in use
+     */
+    int subscribe(const char* topicFilter, enum QoS qos, messageHandler mh)
+    {
+        unsigned char buf[MAX_FRAME];
+        int len = 0;
+        int slot;
+
+        for (slot = 0; slot < MAX_MESSAGE_HANDLERS; ++slot)
+        {
+            if (messageHandlers[slot].topicFilter == 0 || strcmp(messageHandlers[slot].topicFilter, topicFilter) == 0)
+                break;
+        }
+        if (slot == MAX_MESSAGE_HANDLERS)
+            return FAILURE;
+        buf[len++] = slot;
+        buf[len++] = qos;
+        if (!addString(buf, len, topicFilter, false))
+            return BUFFER_OVERFLOW;
+        if (send(OFFLOAD_SUBSCRIBE, buf, len) != SUCCESS)
+            return FAILURE;
+        messageHandlers[slot].topicFilter = topicFilter;
+        messageHandlers[slot].fp = mh;
+        return SUCCESS;
+    }
+
+    int unsubscribe(const char* topicFilter)
+    {
+        for (int slot = 0; slot < MAX_MESSAGE_HANDLERS; ++slot)
+        {
+            if (messageHandlers[slot].topicFilter && strcmp(messageHandlers[slot].topicFilter, topicFilter) == 0)
+            {
+                unsigned char buf[] = {(unsigned char)slot};
+
+                messageHandlers[slot].topicFilter = 0;
+                return send(OFFLOAD_UNSUBSCRIBE, buf, sizeof(buf));
+            }
+        }
+        return FAILURE;
+    }
+
+    /** Have the daemon disconnect from the broker, and stop reconnecting
+     */
+    int disconnect()
+    {
+        if (send(OFFLOAD_DISCONNECT, 0, 0) != SUCCESS)
+            return FAILURE;
+        connstate = DISCONNECTED;
+        return SUCCESS;
+    }
+
+    /** Fetch what the daemon has sent, and call the message and ack handlers for it
+     *  @return success code -
+     */
+    int poll()
+    {
+        unsigned char cmd[] = {'O', handle, (unsigned char)(MAX_FRAME - received)};
+        int n, start = 0;
+
+        if (connstate == STOPPED)
+            return FAILURE;
+        n = bridge.transfer(cmd, sizeof(cmd), &frame[received], MAX_FRAME - received);
+        if (n == 0)
+            return SUCCESS;
+        received += n;
+        while (received - start > 0 && received - start > frame[start])
+        {
+            handleFrame(&frame[start + 1], frame[start]);
+            start += frame[start] + 1;
+        }
+        received -= start;
+        memmove(frame, &frame[start], received);
+        if (received > 0 && frame[0] >= MAX_FRAME)
+            received = 0;   // the daemon was told the limit, so this is not a frame start
+        return SUCCESS;
+    }
+
+    enum State state()
+    {
+        return connstate;
+    }
+
+    bool isConnected()
+    {
+        return connstate == CONNECTED;
+    }
+
+private:
+
+    // write a frame to the daemon's stdin in one Bridge transfer
+    int send(unsigned char type, const unsigned char* body, int len)
+    {
+        unsigned char cmd[] = {'I', handle, (unsigned char)(len + 1), type};
+
+        if (connstate == STOPPED)
+            return FAILURE;
+        bridge.transfer(cmd, sizeof(cmd), body, len, 0, 0);
+        return SUCCESS;
+    }
+
+    // a length byte and the characters, or just the characters if the string ends the frame
+    static bool addString(unsigned char* buf, int& len, const char* s, bool prefixed = true)
+    {
+        int slen = (s) ? strlen(s) : 0;
+
+        if (len + slen + prefixed > MAX_FRAME - 1 || slen > 255)
+            return false;
+        if (prefixed)
+            buf[len++] = slen;
+        memcpy(&buf[len], s, slen);
+        len += slen;
+        return true;
+    }
+
+    unsigned short nextId(unsigned char* buf, enum QoS qos)
+    {
+        unsigned short id = (qos == QOS0) ? 0 : packetid.getNext();
+
+        buf[0] = (unsigned char)(id >> 8);
+        buf[1] = (unsigned char)id;
+        return id;
+    }
+
+    void handleFrame(unsigned char* body, int len)
+    {
+        if (len < 1)
+            return;
+        switch (body[0])
+        {
+            case OFFLOAD_STATUS:
+                if (len < 2)
+                    break;
+                connstate = (body[1] == 0) ? CONNECTED : (connstate == DISCONNECTED) ? DISCONNECTED : CONNECTING;
+                if (ah)
+                    ah(CONNACK, 0, (body[1] == OFFLOAD_LOST) ? (int)FAILURE : (int)body[1]);
+                break;
+            case OFFLOAD_ACK:
+                if (len < 5)
+                    break;
+                if (ah)
+                    ah(body[1], (body[2] << 8) | body[3], (body[4] == 0x80) ? (int)FAILURE : (int)body[4]);
+                break;
+            case OFFLOAD_MESSAGE:
+            {
+                if (len < 4 || body[1] >= MAX_MESSAGE_HANDLERS || body[3] > len - 4)
+                    break;
+                MQTTString topicName = MQTTString_initializer;
+                Message msg;
+
+                topicName.lenstring.len = body[3];
+                topicName.lenstring.data = (char*)&body[4];
+                msg.qos = (enum QoS)(body[2] & 3);
+                msg.retained = (body[2] >> 2) & 1;
+                msg.dup = (body[2] >> 3) & 1;
+                msg.id = 0;
+                msg.payload = &body[4 + body[3]];
+                msg.payloadlen = len - 4 - body[3];
+                if (messageHandlers[body[1]].topicFilter && messageHandlers[body[1]].fp)
+                {
+                    MessageData md(topicName, msg);
+                    messageHandlers[body[1]].fp(md);
+                }
+                break;
+            }
+        }
+    }
+
+    Bridge& bridge;
+    enum State connstate;
+    unsigned char handle;                   // the daemon's Bridge process handle
+    unsigned char frame[MAX_FRAME];         // a partially received frame, from the start
+    int received;
+    unsigned char topics;                   // topic ids given out
+    PacketId packetid;
+
+    struct MessageHandlers
+    {
+        const char* topicFilter;
+        messageHandler fp;
+    } messageHandlers[MAX_MESSAGE_HANDLERS];
+
+    ackHandler ah;
+};
+
+
+}
+
+#endif
@@ -88,6 +88,7 @@ typedef struct
 
 int MQTTstrlen(MQTTString mqttstring);
 
+#include "MQTTProperties.h"
 #include "MQTTConnect.h"
 #include "MQTTPublish.h"
 #include "MQTTSubscribe.h"
@@ -0,0 +1,234 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    publish topic with a pre-serialized header
+ *******************************************************************************/
+
+#if !defined(MQTTPREPAREDTOPIC_H)
+#define MQTTPREPAREDTOPIC_H
+
+#include "MQTTPacket.h"
+#include <string.h>
+
+#if !defined(MQTTCLIENT_MAX_TOPIC_LENGTH)
+    #define MQTTCLIENT_MAX_TOPIC_LENGTH 48
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * @class PreparedTopic
+ * @brief a publish topic whose header is serialized once
+ *
+ * The length prefixed topic name is written into the header template when the object is
+ * constructed.  Each publish then only fills in the fixed header byte, the remaining length and
+ * the packet id, in place, in front of and behind the cached topic.  The clients send the header
+ * straight from this object and the payload from the caller's memory.
+ */
+class PreparedTopic
+{
+public:
+
+    /** Prepare a topic
+     *  @param topicName - the topic to publish to, which must stay valid while the object is used
+     */
+    PreparedTopic(const char* topicName)
+    {
+        unsigned char* ptr = &buf[MAX_FIXED_HEADER];
+
+        name = topicName;
+        topiclen = strlen(topicName);
+        if (topiclen > MQTTCLIENT_MAX_TOPIC_LENGTH)
+            topiclen = -1;
+        else
+        {
+            writeCString(&ptr, topicName);
+            topiclen += 2;
+        }
+    }
+
+    /** Did the topic fit in the header template?
+     */
+    bool isValid()
+    {
+        return topiclen > 0;
+    }
+
+    const char* topicName()
+    {
+        return name;
+    }
+
+    /** Fill in the header of a publish to this topic
+     *  @param len - returns the length of the header
+     *  @param dup - the dup flag
+     *  @param qos - the QoS of the publish
+     *  @param retained - the retained flag
+     *  @param packetid - the packet id, used if qos > 0
+     *  @param payloadlen - the length of the payload which follows the header
+     *  @return the start of the header, or 0 if the topic did not fit
+     */
+    unsigned char* serialize(int* len, unsigned char dup, int qos, unsigned char retained, unsigned short packetid, int payloadlen)
+    {
+        unsigned char* end = &buf[MAX_FIXED_HEADER + topiclen];
+
+        if (topiclen < 0)
+            return 0;
+        if (qos > 0)
+            writeInt(&end, packetid);
+        return header(buf, end, len, dup, qos, retained, payloadlen);
+    }
+
+#if MQTTCLIENT_MQTTV5
+    /** Fill in the header of an MQTT 5 publish to this topic, which carries a topic alias property
+     *  when alias is not 0.  Once the server has been sent the topic name with an alias, later
+     *  publishes can leave the name out and send just the 2 byte alias.
+     *  @param alias - the topic alias, 0 for none
+     *  @param aliasOnly - send an empty topic name and the alias, instead of the topic name
+     *  @return the start of the header, or 0 if the topic did not fit
+     */
+    unsigned char* serializeV5(int* len, unsigned char dup, int qos, unsigned char retained, unsigned short packetid, int payloadlen,
+            unsigned short alias, bool aliasOnly)
+    {
+        unsigned char* base = (aliasOnly) ? aliasbuf : buf;
+        unsigned char* end = &base[MAX_FIXED_HEADER + ((aliasOnly) ? 2 : topiclen)];
+
+        if (topiclen < 0 || (aliasOnly && alias == 0))
+            return 0;
+        if (qos > 0)
+            writeInt(&end, packetid);
+        if (alias == 0)
+            writeChar(&end, 0);     // property length
+        else
+        {
+            writeChar(&end, 3);
+            writeChar(&end, MQTTPROPERTY_CODE_TOPIC_ALIAS);
+            writeInt(&end, alias);
+        }
+        return header(base, end, len, dup, qos, retained, payloadlen);
+    }
+#endif
+
+private:
+
+    enum { MAX_FIXED_HEADER = 5 };  // header byte and up to 4 remaining length bytes
+
+    // write the fixed header in front of the variable header which starts at base[MAX_FIXED_HEADER]
+    unsigned char* header(unsigned char* base, unsigned char* end, int* len, unsigned char dup, int qos, unsigned char retained, int payloadlen)
+    {
+        unsigned char remlen[4];
+        int remlenlen;
+        unsigned char* start;
+        MQTTHeader header = {0};
+
+        remlenlen = MQTTPacket_encode(remlen, (end - &base[MAX_FIXED_HEADER]) + payloadlen);
+        start = &base[MAX_FIXED_HEADER - 1 - remlenlen];
+
+        header.bits.type = PUBLISH;
+        header.bits.dup = dup;
+        header.bits.qos = qos;
+        header.bits.retain = retained;
+        start[0] = header.byte;
+        memcpy(&start[1], remlen, remlenlen);
+
+        *len = end - start;
+        return start;
+    }
+
+#if MQTTCLIENT_MQTTV5
+    unsigned char buf[MAX_FIXED_HEADER + 2 + MQTTCLIENT_MAX_TOPIC_LENGTH + 2 + 4];
+    unsigned char aliasbuf[MAX_FIXED_HEADER + 2 + 2 + 4];   // empty topic name, packet id, topic alias property
+#else
+    unsigned char buf[MAX_FIXED_HEADER + 2 + MQTTCLIENT_MAX_TOPIC_LENGTH + 2];
+#endif
+    int topiclen;                   // including the 2 byte length prefix
+    const char* name;
+};
+
+
+#if MQTTCLIENT_MQTTV5
+/**
+ * @class TopicAliases
+ * @brief the MQTT 5 topic aliases a client has given to prepared topics on the current connection
+ *
+ * The server's CONNACK says how many aliases it accepts.  Prepared topics are given the free
+ * aliases in the order they are first published to, until they run out; any further topics are
+ * always sent by name.  The aliases only last for one network connection.
+ * @param N the number of aliases kept
+ */
+template<int N>
+class TopicAliases
+{
+public:
+
+    TopicAliases()
+    {
+        reset(0);
+    }
+
+    /** Forget all aliases
+     *  @param max - the topic alias maximum of the new connection
+     */
+    void reset(unsigned short max)
+    {
+        limit = (max < N) ? max : N;
+        for (int i = 0; i < N; ++i)
+            topics[i] = 0;
+    }
+
+    /** Find the alias of a topic, or give it the next free one
+     *  @param topic - the prepared topic
+     *  @param known - returns whether the server has already been sent this alias
+     *  @return the alias, or 0 if there is none free
+     */
+    unsigned short find(PreparedTopic* topic, bool& known)
+    {
+        int free = -1;
+
+        known = false;
+        for (int i = 0; i < limit; ++i)
+        {
+            if (topics[i] == topic)
+            {
+                known = true;
+                return i + 1;
+            }
+            if (topics[i] == 0 && free < 0)
+                free = i;
+        }
+        if (free < 0)
+            return 0;
+        topics[free] = topic;
+        return free + 1;
+    }
+
+    /** Take back an alias which was never sent
+     */
+    void remove(unsigned short alias)
+    {
+        if (alias > 0 && alias <= limit)
+            topics[alias - 1] = 0;
+    }
+
+private:
+
+    PreparedTopic* topics[N];
+    unsigned short limit;
+};
+#endif
+
+}
+
+#endif
@@ -0,0 +1,359 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    MQTT 5 properties
+ *******************************************************************************/
+
+#include "MQTTPacket.h"
+#include "StackTrace.h"
+
+#include <string.h>
+
+
+/**
+  * Returns the wire type of a property
+  * @param identifier the property identifier
+  * @return one of MQTTPropertyTypes, or -1 for an unknown identifier
+  */
+int MQTTProperty_getType(int identifier)
+{
+	int rc = -1;
+
+	switch (identifier)
+	{
+	case MQTTPROPERTY_CODE_PAYLOAD_FORMAT_INDICATOR:
+	case MQTTPROPERTY_CODE_REQUEST_PROBLEM_INFORMATION:
+	case MQTTPROPERTY_CODE_REQUEST_RESPONSE_INFORMATION:
+	case MQTTPROPERTY_CODE_MAXIMUM_QOS:
+	case MQTTPROPERTY_CODE_RETAIN_AVAILABLE:
+	case MQTTPROPERTY_CODE_WILDCARD_SUBSCRIPTION_AVAILABLE:
+	case MQTTPROPERTY_CODE_SUBSCRIPTION_IDENTIFIERS_AVAILABLE:
+	case MQTTPROPERTY_CODE_SHARED_SUBSCRIPTION_AVAILABLE:
+		rc = MQTTPROPERTY_TYPE_BYTE;
+		break;
+	case MQTTPROPERTY_CODE_SERVER_KEEP_ALIVE:
+	case MQTTPROPERTY_CODE_RECEIVE_MAXIMUM:
+	case MQTTPROPERTY_CODE_TOPIC_ALIAS_MAXIMUM:
+	case MQTTPROPERTY_CODE_TOPIC_ALIAS:
+		rc = MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER;
+		break;
+	case MQTTPROPERTY_CODE_MESSAGE_EXPIRY_INTERVAL:
+	case MQTTPROPERTY_CODE_SESSION_EXPIRY_INTERVAL:
+	case MQTTPROPERTY_CODE_WILL_DELAY_INTERVAL:
+	case MQTTPROPERTY_CODE_MAXIMUM_PACKET_SIZE:
+		rc = MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER;
+		break;
+	case MQTTPROPERTY_CODE_SUBSCRIPTION_IDENTIFIER:
+		rc = MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER;
+		break;
+	case MQTTPROPERTY_CODE_CONTENT_TYPE:
+	case MQTTPROPERTY_CODE_RESPONSE_TOPIC:
+	case MQTTPROPERTY_CODE_ASSIGNED_CLIENT_IDENTIFER:
+	case MQTTPROPERTY_CODE_AUTHENTICATION_METHOD:
+	case MQTTPROPERTY_CODE_RESPONSE_INFORMATION:
+	case MQTTPROPERTY_CODE_SERVER_REFERENCE:
+	case MQTTPROPERTY_CODE_REASON_STRING:
+		rc = MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING;
+		break;
+	case MQTTPROPERTY_CODE_CORRELATION_DATA:
+	case MQTTPROPERTY_CODE_AUTHENTICATION_DATA:
+		rc = MQTTPROPERTY_TYPE_BINARY_DATA;
+		break;
+	case MQTTPROPERTY_CODE_USER_PROPERTY:
+		rc = MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR;
+		break;
+	}
+	return rc;
+}
+
+
+/* the number of bytes a variable byte integer takes */
+static int MQTTProperties_varlen(unsigned long value)
+{
+	return (value < 128) ? 1 : (value < 16384) ? 2 : (value < 2097152L) ? 3 : 4;
+}
+
+
+/* the serialized length of one property, including its identifier */
+static int MQTTProperty_len(const MQTTProperty* prop)
+{
+	int len = 1;
+
+	switch (MQTTProperty_getType(prop->identifier))
+	{
+	case MQTTPROPERTY_TYPE_BYTE:
+		len += 1;
+		break;
+	case MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER:
+		len += 2;
+		break;
+	case MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER:
+		len += 4;
+		break;
+	case MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER:
+		len += MQTTProperties_varlen(prop->value.integer4);
+		break;
+	case MQTTPROPERTY_TYPE_BINARY_DATA:
+	case MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING:
+		len += 2 + prop->value.data.len;
+		break;
+	case MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR:
+		len += 2 + prop->value.data.len + 2 + prop->value.value.len;
+		break;
+	default:
+		len = 0;
+	}
+	return len;
+}
+
+
+/**
+  * Returns the serialized length of a property list, including the variable byte integer length
+  * field which precedes it
+  * @param props the properties, or NULL for none
+  * @return the length in bytes
+  */
+int MQTTProperties_len(MQTTProperties* props)
+{
+	int len = (props) ? props->length : 0;
+
+	return len + MQTTProperties_varlen(len);
+}
+
+
+/**
+  * Adds a property to a list.  The property's value is copied, but strings and binary data are not.
+  * @param props the list to add to
+  * @param prop the property to add
+  * @return the new number of properties, or -1 if the array is full or the identifier is unknown
+  */
+int MQTTProperties_add(MQTTProperties* props, const MQTTProperty* prop)
+{
+	int rc = -1;
+	int len = 0;
+
+	FUNC_ENTRY;
+	if (props->count >= props->max_count || (len = MQTTProperty_len(prop)) == 0)
+		goto exit;
+
+	props->array[props->count] = *prop;
+	props->length += len;
+	rc = ++props->count;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+static void writeLenString(unsigned char** pptr, MQTTLenString string)
+{
+	writeInt(pptr, string.len);
+	memcpy(*pptr, string.data, string.len);
+	*pptr += string.len;
+}
+
+
+static void writeInt4(unsigned char** pptr, unsigned long value)
+{
+	writeChar(pptr, (char)(value >> 24));
+	writeChar(pptr, (char)(value >> 16));
+	writeChar(pptr, (char)(value >> 8));
+	writeChar(pptr, (char)value);
+}
+
+
+/**
+  * Serializes a property list: its length followed by each property
+  * @param pptr pointer to the output buffer - incremented by the number of bytes used & returned
+  * @param properties the properties to write
+  * @return the number of bytes written
+  */
+int MQTTProperties_write(unsigned char** pptr, const MQTTProperties* properties)
+{
+	unsigned char* ptr = *pptr;
+	int i;
+
+	FUNC_ENTRY;
+	*pptr += MQTTPacket_encode(*pptr, properties->length);
+	for (i = 0; i < properties->count; ++i)
+	{
+		const MQTTProperty* prop = &properties->array[i];
+
+		writeChar(pptr, prop->identifier);
+		switch (MQTTProperty_getType(prop->identifier))
+		{
+		case MQTTPROPERTY_TYPE_BYTE:
+			writeChar(pptr, prop->value.byte);
+			break;
+		case MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER:
+			writeInt(pptr, prop->value.integer2);
+			break;
+		case MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER:
+			writeInt4(pptr, prop->value.integer4);
+			break;
+		case MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER:
+			*pptr += MQTTPacket_encode(*pptr, (int)prop->value.integer4);
+			break;
+		case MQTTPROPERTY_TYPE_BINARY_DATA:
+		case MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING:
+			writeLenString(pptr, prop->value.data);
+			break;
+		case MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR:
+			writeLenString(pptr, prop->value.data);
+			writeLenString(pptr, prop->value.value);
+			break;
+		}
+	}
+	FUNC_EXIT_RC(*pptr - ptr);
+	return *pptr - ptr;
+}
+
+
+/* reads a variable byte integer without going past enddata, returns 0 on error */
+static int readVarInt(unsigned long* value, unsigned char** pptr, unsigned char* enddata)
+{
+	unsigned long multiplier = 1;
+	int len = 0;
+	unsigned char c;
+
+	*value = 0;
+	do
+	{
+		if (*pptr >= enddata || ++len > 4)
+			return 0;
+		c = readChar(pptr);
+		*value += (c & 127) * multiplier;
+		multiplier *= 128;
+	} while ((c & 128) != 0);
+	return len;
+}
+
+
+static int readLenString(MQTTLenString* string, unsigned char** pptr, unsigned char* enddata)
+{
+	if (enddata - *pptr < 2)
+		return 0;
+	string->len = readInt(pptr);
+	if (enddata - *pptr < string->len)
+		return 0;
+	string->data = (char*)*pptr;
+	*pptr += string->len;
+	return 1;
+}
+
+
+/**
+  * Deserializes a property list.  The properties are stored in properties->array until it is full,
+  * any more are checked and skipped, so an array with max_count 0 just steps over the list.
+  * @param properties returned properties - count and length are set
+  * @param pptr pointer to the input buffer - incremented by the number of bytes used & returned
+  * @param enddata pointer to the end of the data: do not read beyond
+  * @return error code.  1 is success, 0 is failure
+  */
+int MQTTProperties_read(MQTTProperties* properties, unsigned char** pptr, unsigned char* enddata)
+{
+	unsigned long length = 0;
+	unsigned char* end = NULL;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	properties->count = 0;
+	if (!readVarInt(&length, pptr, enddata) || (unsigned long)(enddata - *pptr) < length)
+		goto exit;
+	properties->length = (int)length;
+	end = *pptr + length;
+
+	while (*pptr < end)
+	{
+		MQTTProperty prop;
+		int type = MQTTProperty_getType(prop.identifier = readChar(pptr));
+
+		if (type == MQTTPROPERTY_TYPE_BYTE || type == MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER ||
+			type == MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER)
+		{
+			int size = (type == MQTTPROPERTY_TYPE_BYTE) ? 1 : (type == MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER) ? 2 : 4;
+
+			if (end - *pptr < size)
+				goto exit;
+			if (size == 1)
+				prop.value.byte = readChar(pptr);
+			else if (size == 2)
+				prop.value.integer2 = readInt(pptr);
+			else
+			{
+				prop.value.integer4 = (unsigned long)(unsigned int)readInt(pptr) << 16;
+				prop.value.integer4 |= (unsigned int)readInt(pptr);
+			}
+		}
+		else if (type == MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER)
+		{
+			if (!readVarInt(&prop.value.integer4, pptr, end))
+				goto exit;
+		}
+		else if (type == MQTTPROPERTY_TYPE_BINARY_DATA || type == MQTTPROPERTY_TYPE_UTF_8_ENCODED_STRING)
+		{
+			if (!readLenString(&prop.value.data, pptr, end))
+				goto exit;
+		}
+		else if (type == MQTTPROPERTY_TYPE_UTF_8_STRING_PAIR)
+		{
+			if (!readLenString(&prop.value.data, pptr, end) || !readLenString(&prop.value.value, pptr, end))
+				goto exit;
+		}
+		else
+			goto exit; /* an unknown identifier - its length cannot be known */
+
+		if (properties->count < properties->max_count)
+			properties->array[properties->count++] = prop;
+	}
+	rc = 1;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Finds the value of a numeric property
+  * @param props the properties to search
+  * @param identifier the property identifier
+  * @param value returned value of the first property with that identifier
+  * @return 1 if it was found, 0 if not
+  */
+int MQTTProperties_getNumericValue(MQTTProperties* props, int identifier, unsigned long* value)
+{
+	int i;
+
+	for (i = 0; i < props->count; ++i)
+	{
+		MQTTProperty* prop = &props->array[i];
+
+		if (prop->identifier != identifier)
+			continue;
+		switch (MQTTProperty_getType(identifier))
+		{
+		case MQTTPROPERTY_TYPE_BYTE:
+			*value = prop->value.byte;
+			return 1;
+		case MQTTPROPERTY_TYPE_TWO_BYTE_INTEGER:
+			*value = prop->value.integer2;
+			return 1;
+		case MQTTPROPERTY_TYPE_FOUR_BYTE_INTEGER:
+		case MQTTPROPERTY_TYPE_VARIABLE_BYTE_INTEGER:
+			*value = prop->value.integer4;
+			return 1;
+		}
+		break;
+	}
+	return 0;
+}
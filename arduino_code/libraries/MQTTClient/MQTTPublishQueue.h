@@ -0,0 +1,388 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    store-and-forward queue for publishes made while offline
+ *******************************************************************************/
+
+#if !defined(MQTTPUBLISHQUEUE_H)
+#define MQTTPUBLISHQUEUE_H
+
+#include "MQTTClient.h"
+#include <string.h>
+
+namespace MQTT
+{
+
+
+/**
+ * @class NoStore
+ * @brief spill store for a PublishQueue which has none - publishes which do not fit in RAM are dropped
+ */
+class NoStore
+{
+public:
+
+    bool append(const unsigned char* /*buf*/, int /*len*/)
+    {
+        return false;
+    }
+
+    int read(unsigned long /*pos*/, unsigned char* /*buf*/, int /*len*/)
+    {
+        return 0;
+    }
+
+    unsigned long size()
+    {
+        return 0;
+    }
+
+    void clear()
+    { }
+};
+
+
+enum Priority { BULK, URGENT };
+
+
+/**
+ * @class PublishQueue
+ * @brief bounded queue which holds publishes while the client is disconnected, and paces routine
+ * telemetry so that alarms are not kept waiting behind it
+ *
+ * Publishes are in one of two lanes.  BULK publishes - routine readings - go straight to the
+ * client while it is connected, nothing is queued and the token bucket set by setRate has a
+ * token.  Otherwise they are queued: in a RAM ring first and, once that is full, appended to the
+ * spill store.  drain sends them in the order they were made, one token each, so neither a
+ * backlog after an outage nor a burst of readings floods the link.  Records spilled before a
+ * reset are found in the store and sent too.
+ * URGENT publishes - alarms - skip the bulk backlog and the token bucket: they go to the client
+ * at once if it is connected, and are otherwise queued in a small lane of their own which drain
+ * empties before it sends any bulk record.  An alarm then waits for at most the one publish being
+ * written, or for the one QoS 1 or 2 record still awaiting its acknowledgement.
+ * A QoS 1 or 2 record is taken off the queue once the client has accepted it, and the next one
+ * is held back until the client has no publishes waiting for acknowledgement, because the payload
+ * is sent from the queue's own buffer.  drain therefore needs the inflightCount of AsyncClient.
+ * @param Timer a timer class with the methods: countdown_ms, expired, left_ms
+ * @param Store the spill store, with the methods: append, read, size, clear.  A record is
+ *     appended in up to three pieces.
+ * @param RAM_SIZE the size of the RAM ring for bulk publishes in bytes
+ * @param MAX_RECORD the largest queued publish: 3 bytes, the topic with its '\0' and the payload
+ * @param URGENT_SIZE the size of the RAM ring for urgent publishes in bytes.  When it is full,
+ *     urgent publishes are queued with the bulk ones.
+ */
+template<class Timer, class Store = NoStore, int RAM_SIZE = 256, int MAX_RECORD = 100, int URGENT_SIZE = MAX_RECORD>
+class PublishQueue
+{
+public:
+
+    PublishQueue(Store& store) : store(store)
+    {
+        readoff = 0;
+        lost = 0;
+        burst = MAX_BURST;
+        interval_ms = 0;
+        holding = false;
+    }
+
+    /** Limit the rate of bulk publishes with a token bucket which holds burst tokens and is
+     *  refilled at burst tokens every interval_ms.  Each bulk publish takes a token, whether it
+     *  goes straight to the client or is sent later by drain.
+     *  @param burst - the number of publishes which can be sent together
+     *  @param interval_ms - the time taken to refill the bucket, 0 for no limit
+     */
+    void setRate(int burst, unsigned long interval_ms)
+    {
+        this->burst = burst;
+        this->interval_ms = interval_ms;
+    }
+
+    /** Publish now if the client is connected, nothing is queued ahead of the publish and, for a
+     *  bulk publish, the rate allows it.  Otherwise queue the publish.
+     *  @return success code - FAILURE if the publish could be neither sent nor queued
+     */
+    template<class Client>
+    int publish(Client& client, const char* topicName, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false,
+            enum Priority priority = BULK)
+    {
+        if (ready(client, priority) && client.publish(topicName, payload, payloadlen, qos, retained) == SUCCESS)
+            return SUCCESS;
+        return push(topicName, payload, payloadlen, qos, retained, priority);
+    }
+
+    template<class Client>
+    int publish(Client& client, PreparedTopic& topic, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false,
+            enum Priority priority = BULK)
+    {
+        if (ready(client, priority) && client.publish(topic, payload, payloadlen, qos, retained) == SUCCESS)
+            return SUCCESS;
+        return push(topic.topicName(), payload, payloadlen, qos, retained, priority);
+    }
+
+    /** Queue a publish for drain to send, without trying the client first.  The queue keeps a
+     *  copy, so payload can be reused at once - as it cannot be after a QoS 1 or 2 publish
+     *  sends it, until it is acknowledged.
+     *  @return success code - FAILURE if the publish could not be queued
+     */
+    int enqueue(const char* topicName, void* payload, size_t payloadlen, enum QoS qos = QOS0, bool retained = false,
+            enum Priority priority = BULK)
+    {
+        return push(topicName, payload, payloadlen, qos, retained, priority);
+    }
+
+    /** Send queued publishes: all the urgent ones, then bulk ones as far as the rate allows, at
+     *  most burst of them a call.  Call it from the main loop, after poll.
+     *  @return the number of publishes sent, or FAILURE if the client rejected one - it stays queued
+     */
+    template<class Client>
+    int drain(Client& client)
+    {
+        int sent = 0, bulk_sent = 0;
+
+        if (!client.isConnected())
+            goto exit;
+        while (urgent.records > 0)
+        {
+            if (holding && client.inflightCount() > 0)
+                goto exit;  // current is still in use by the last QoS 1 or 2 record
+            int len = urgent.peek(current);
+            if (send(client, len) != SUCCESS)
+            {
+                sent = FAILURE;
+                goto exit;
+            }
+            urgent.pop(len);
+            ++sent;
+        }
+        while (bulk_sent < burst && !empty())
+        {
+            if (holding && client.inflightCount() > 0)
+                break;
+            int len = peek();
+            if (len <= 0)
+                continue;   // an unreadable spilled record has been dropped
+            if (!takeToken())
+                break;
+            if (send(client, len) != SUCCESS)
+            {
+                sent = FAILURE;
+                goto exit;
+            }
+            pop(len);
+            ++sent;
+            ++bulk_sent;
+        }
+
+    exit:
+        return sent;
+    }
+
+    bool empty()
+    {
+        return bulk.records == 0 && urgent.records == 0 && !spilled();
+    }
+
+    /** The number of publishes queued in RAM
+     */
+    int count()
+    {
+        return bulk.records + urgent.records;
+    }
+
+    /** The number of publishes which were dropped because they could not be queued
+     */
+    unsigned long dropped()
+    {
+        return lost;
+    }
+
+private:
+
+    enum { MAX_BURST = 8, HEADER = 3 };     // record: 2 byte length, flags, then the topic with its '\0' and the payload
+
+    // a ring of records in RAM
+    template<int SIZE>
+    struct Lane
+    {
+        Lane() : head(0), tail(0), used(0), records(0)
+        { }
+
+        bool fits(int len)
+        {
+            return used + len <= SIZE;
+        }
+
+        void put(const unsigned char* buf, int len)
+        {
+            int first = (head + len <= SIZE) ? len : SIZE - head;
+
+            memcpy(&ring[head], buf, first);
+            memcpy(ring, &buf[first], len - first);
+            head = (head + len) % SIZE;
+            used += len;
+        }
+
+        // copy the oldest record into record, returns its length
+        int peek(unsigned char* record)
+        {
+            int len = ((ring[tail] << 8) | ring[(tail + 1) % SIZE]) + 2;
+            int first = (tail + len <= SIZE) ? len : SIZE - tail;
+
+            memcpy(record, &ring[tail], first);
+            memcpy(&record[first], ring, len - first);
+            return len;
+        }
+
+        void pop(int len)
+        {
+            tail = (tail + len) % SIZE;
+            used -= len;
+            --records;
+        }
+
+        unsigned char ring[SIZE];
+        int head, tail, used;
+        int records;
+    };
+
+    template<class Client>
+    bool ready(Client& client, enum Priority priority)
+    {
+        if (!client.isConnected())
+            return false;
+        if (priority == URGENT)
+            return urgent.records == 0;
+        return empty() && takeToken();
+    }
+
+    /* The bucket is kept as the time until it is full again: each token adds interval_ms / burst
+     * to it, and a token can be taken while that leaves it at most interval_ms. */
+    bool takeToken()
+    {
+        if (interval_ms == 0 || burst <= 0)
+            return true;
+
+        unsigned long per_token = interval_ms / burst;
+        unsigned long refill = bucket_timer.left_ms();
+
+        if (refill + per_token > interval_ms)
+            return false;
+        bucket_timer.countdown_ms(refill + per_token);
+        return true;
+    }
+
+    bool spilled()
+    {
+        return readoff < store.size();
+    }
+
+    int push(const char* topicName, void* payload, size_t payloadlen, enum QoS qos, bool retained, enum Priority priority)
+    {
+        unsigned char header[HEADER];
+        int topiclen = strlen(topicName) + 1;
+        int len = HEADER + topiclen + payloadlen;
+
+        if (len > MAX_RECORD)
+            goto dropped;
+        header[0] = (len - 2) >> 8;
+        header[1] = (len - 2) & 0xFF;
+        header[2] = qos | (retained ? 0x04 : 0);
+
+        if (priority == URGENT && urgent.fits(len))
+        {
+            urgent.put(header, HEADER);
+            urgent.put((unsigned char*)topicName, topiclen);
+            urgent.put((unsigned char*)payload, payloadlen);
+            ++urgent.records;
+            return SUCCESS;
+        }
+        if (!spilled() && bulk.fits(len))
+        {   // only while nothing is spilled, so that the order is kept
+            bulk.put(header, HEADER);
+            bulk.put((unsigned char*)topicName, topiclen);
+            bulk.put((unsigned char*)payload, payloadlen);
+            ++bulk.records;
+            return SUCCESS;
+        }
+        if (store.append(header, HEADER) && store.append((unsigned char*)topicName, topiclen) &&
+            (payloadlen == 0 || store.append((unsigned char*)payload, payloadlen)))
+            return SUCCESS;
+
+    dropped:
+        ++lost;
+        return FAILURE;
+    }
+
+    // copy the oldest bulk record into current, returns its length
+    int peek()
+    {
+        int len;
+
+        if (bulk.records > 0)
+            return bulk.peek(current);
+
+        int n = store.read(readoff, current, MAX_RECORD);
+        len = (n >= 2) ? ((current[0] << 8) | current[1]) + 2 : 0;
+        if (len <= HEADER || len > n || memchr(&current[HEADER], '\0', len - HEADER) == 0)
+        {   // a torn or corrupt record, left by a reset during an append
+            ++lost;
+            store.clear();
+            readoff = 0;
+            return 0;
+        }
+        return len;
+    }
+
+    void pop(int len)
+    {
+        if (bulk.records > 0)
+            bulk.pop(len);
+        else if ((readoff += len) >= store.size())
+        {
+            store.clear();
+            readoff = 0;
+        }
+    }
+
+    template<class Client>
+    int send(Client& client, int len)
+    {
+        char* topicName = (char*)&current[HEADER];
+        int topiclen = strlen(topicName) + 1;
+        enum QoS qos = (enum QoS)(current[2] & 0x03);
+        bool retained = (current[2] & 0x04) != 0;
+        int rc;
+
+        rc = client.publish(topicName, &current[HEADER + topiclen], len - HEADER - topiclen, qos, retained);
+        holding = (rc == SUCCESS && qos != QOS0);
+        return rc;
+    }
+
+    Store& store;
+
+    Lane<RAM_SIZE> bulk;                // the store holds newer bulk records than these
+    Lane<URGENT_SIZE> urgent;
+    unsigned long readoff;              // next record to send from the store
+
+    unsigned char current[MAX_RECORD];  // the record being queued or sent
+    bool holding;                       // current is the payload of an unacknowledged publish
+
+    int burst;
+    unsigned long interval_ms;
+    Timer bucket_timer;                 // runs until the token bucket is full again
+    unsigned long lost;
+};
+
+}
+
+#endif
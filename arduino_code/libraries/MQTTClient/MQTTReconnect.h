@@ -0,0 +1,189 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    non-blocking reconnect with jittered exponential backoff
+ *******************************************************************************/
+
+#if !defined(MQTTRECONNECT_H)
+#define MQTTRECONNECT_H
+
+#include "MQTTClient.h"
+
+namespace MQTT
+{
+
+
+/**
+ * @class Reconnector
+ * @brief keeps an AsyncClient connected without ever waiting for the server
+ *
+ * poll() makes at most one connect attempt a call, through the connect handler, which opens the
+ * network connection and sends the CONNECT - the only blocking part of an attempt.  The CONNACK
+ * is then left to the client's own poll.  An attempt which fails, is refused or times out, and a
+ * connection which drops, is followed by a wait before the next attempt.  The wait doubles with
+ * each failure from min_ms up to max_ms, and is drawn at random from the upper half of that, so
+ * that devices which lost the same broker do not all come back at once.  A connack resets it.
+ * The state handler is told each time the link goes ONLINE or back to WAITING, so the rest of the
+ * sketch - sampling, queueing, relay commands - runs on whatever the state.
+ * @param Client a client with the methods: state, isConnected - AsyncClient
+ * @param Timer a timer class with the methods: countdown_ms, left_ms
+ */
+template<class Client, class Timer>
+class Reconnector
+{
+public:
+
+    /** Open the network connection and send the CONNECT
+     *  @return SUCCESS if the CONNECT was sent
+     */
+    typedef int (*connectHandler)();
+
+    /** Callback for a change of state
+     *  @param state - the new state
+     *  @param failures - the attempts which have failed since the last connack
+     */
+    typedef void (*stateHandler)(int state, int failures);
+
+    enum State { WAITING, CONNECTING, ONLINE };
+
+    /** Construct the reconnector.  The first attempt is made on the first poll.
+     *  @param client - the MQTT client
+     *  @param ch - makes an attempt
+     *  @param min_ms - the longest wait after the first failure or a dropped connection
+     *  @param max_ms - the longest wait however many attempts have failed
+     */
+    Reconnector(Client& client, connectHandler ch, unsigned long min_ms = 1000, unsigned long max_ms = 60000)
+        : client(client), ch(ch), sh(0), min_ms(min_ms), max_ms(max_ms)
+    {
+        link = WAITING;
+        failures = 0;
+        rand = 0x2545F491UL;
+    }
+
+    void setStateHandler(stateHandler sh)
+    {
+        this->sh = sh;
+    }
+
+    /** Mix some entropy - an unconnected analog pin, a MAC address - into the jitter, so that
+     *  devices started together draw different waits
+     */
+    void seed(unsigned long entropy)
+    {
+        rand ^= entropy;
+        if (rand == 0)
+            rand = 0x2545F491UL;
+    }
+
+    /** Move the state on.  Call it from the main loop, after the client's poll.
+     */
+    void poll()
+    {
+        switch (link)
+        {
+        case WAITING:
+            if (timer.left_ms() == 0)
+                attempt();
+            break;
+        case CONNECTING:
+            if (client.isConnected())
+            {
+                failures = 0;
+                change(ONLINE);
+            }
+            else if (client.state() == Client::DISCONNECTED)
+                backoff();      // refused, timed out or dropped before the connack
+            break;
+        case ONLINE:
+            if (!client.isConnected())
+                backoff();
+            break;
+        }
+    }
+
+    /** The time until poll next has something to do
+     *  @return the time in ms, 0 if an attempt is due, or Client::NO_DEADLINE when the client's
+     *      own timers are the ones which matter
+     */
+    unsigned long next_ms()
+    {
+        return (link == WAITING) ? timer.left_ms() : Client::NO_DEADLINE;
+    }
+
+    enum State state()
+    {
+        return link;
+    }
+
+    int failed()
+    {
+        return failures;
+    }
+
+private:
+
+    void attempt()
+    {
+        change(CONNECTING);
+        if (ch() != SUCCESS)
+            backoff();
+    }
+
+    // wait somewhere in the upper half of min_ms doubled for each failure, at most max_ms
+    void backoff()
+    {
+        unsigned long ceiling = min_ms;
+        unsigned long wait;
+
+        for (int i = 0; i < failures && ceiling < max_ms; ++i)
+            ceiling <<= 1;
+        if (ceiling > max_ms)
+            ceiling = max_ms;
+        wait = ceiling - ceiling / 2 + next() % (ceiling / 2 + 1);
+        if (failures < 0x7FFF)
+            ++failures;
+        timer.countdown_ms(wait);
+        change(WAITING);
+    }
+
+    // xorshift32: enough to spread the waits, and repeatable once seeded
+    unsigned long next()
+    {
+        rand ^= (rand << 13) & 0xFFFFFFFFUL;
+        rand ^= (rand & 0xFFFFFFFFUL) >> 17;
+        rand ^= (rand << 5) & 0xFFFFFFFFUL;
+        rand &= 0xFFFFFFFFUL;
+        return rand;
+    }
+
+    void change(enum State state)
+    {
+        link = state;
+        if (sh != 0)
+            sh(state, failures);
+    }
+
+    Client& client;
+    connectHandler ch;
+    stateHandler sh;
+
+    unsigned long min_ms, max_ms;
+    enum State link;
+    int failures;               // since the last connack
+    Timer timer;                // runs until the next attempt, while WAITING
+    unsigned long rand;
+};
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    message handlers bound to topic filters at compile time
+ *******************************************************************************/
+
+#if !defined(MQTTROUTES_H)
+#define MQTTROUTES_H
+
+#include "MQTTPacket.h"
+
+namespace MQTT
+{
+
+
+struct MessageData;
+
+
+/**
+ * Does a topic name match a topic filter?  The filter is assumed to be in the correct format:
+ * # only at the end, and + and # only next to separators.
+ */
+inline bool topicMatched(const char* filter, MQTTString& topicName)
+{
+    const char* curf = filter;
+    const char* curn = topicName.lenstring.data;
+    const char* curn_end = curn + topicName.lenstring.len;
+
+    while (*curf && curn < curn_end)
+    {
+        if (*curn == '/' && *curf != '/')
+            break;
+        if (*curf != '+' && *curf != '#' && *curf != *curn)
+            break;
+        if (*curf == '+')
+        {   // skip until we meet the next separator, or end of string
+            while (curn + 1 < curn_end && curn[1] != '/')
+                ++curn;
+        }
+        else if (*curf == '#')
+            curn = curn_end - 1;    // skip until end of string
+        curf++;
+        curn++;
+    }
+
+    return (curn == curn_end) && (*curf == '\0');
+}
+
+
+/**
+ * The end of a list of routes, and the default for Client and AsyncClient, which then only have
+ * the message handlers given to subscribe.
+ */
+struct NoRoutes
+{
+    static bool deliver(MQTTString& /*topicName*/, MessageData& /*md*/)
+    {
+        return false;
+    }
+};
+
+
+/**
+ * @class Route
+ * @brief a message handler bound to a topic filter at compile time
+ *
+ * A list of routes is given to Client or AsyncClient as its Routes template parameter:
+ *
+ *   extern const char commandFilter[] = "iot-2/cmd/+/fmt/json";
+ *   typedef MQTT::Route<commandFilter, messageArrived> Routes;
+ *   MQTT::AsyncClient<IPStack, Countdown, 100, 0, 1, Routes> client(ipstack);
+ *   ...
+ *   client.subscribe(commandFilter, MQTT::QOS0);
+ *
+ * Messages are matched against the routes before the message handler table, and each handler
+ * is called directly, so the compiler can inline it into the client's delivery code.  The table
+ * slots and the FP call behind them are then not needed: a subscribe without a message handler
+ * takes no slot, and MAX_MESSAGE_HANDLERS can be 0 if all the filters are bound here.  The
+ * filter still has to be subscribed to, as the server knows nothing of the routes.
+ * @param FILTER the topic filter, a char array with external linkage
+ * @param HANDLER the function called for each message which matches FILTER
+ * @param NEXT the rest of the routes
+ */
+template<const char* FILTER, void (*HANDLER)(MessageData&), class NEXT = NoRoutes>
+struct Route
+{
+    /** Call the handler of every route which matches the topic, as the handler table does
+     *  @return whether any route matched
+     */
+    static bool deliver(MQTTString& topicName, MessageData& md)
+    {
+        bool matched = topicMatched(FILTER, topicName);
+
+        if (matched)
+            HANDLER(md);
+        return NEXT::deliver(topicName, md) || matched;
+    }
+};
+
+
+}
+
+#endif
@@ -0,0 +1,184 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    receive ring buffer for bulk network reads
+ *******************************************************************************/
+
+#if !defined(MQTTRXRING_H)
+#define MQTTRXRING_H
+
+#include "MQTTPacket.h"
+#include <string.h>
+
+namespace MQTT
+{
+
+
+/**
+ * @class RxRing
+ * @brief receive buffer which takes whatever the network has in one read, and hands it out a
+ * packet at a time
+ *
+ * Reading a packet straight from the network takes a read for the header byte, one for each
+ * remaining length byte and one for the rest, and over the Yun's Bridge every read is a round
+ * trip.  fill() asks the network how much it has and reads all of it that fits, so packets
+ * which arrive together cost one available() and one read between them.  next() then parses the
+ * packets out of the ring, and keeps a partly received one until the rest has arrived.
+ * @param Network a network class with the methods: available, read
+ * @param SIZE the size of the ring in bytes, at least the largest packet to be received.  A larger
+ *     packet is dropped, as one larger than the client's read buffer is.
+ */
+template<class Network, int SIZE>
+class RxRing
+{
+public:
+
+    RxRing()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        head = count = 0;
+        backlog = skip = 0;
+    }
+
+    /** Read what the network has, as far as it fits, in one call to read - two if it wraps
+     *  @param timeout_ms - how long to wait for data if there is none yet, 0 not to wait
+     *  @return the number of bytes read, 0 if none, or -1 if the network failed or no data came
+     */
+    int fill(Network& network, int timeout_ms)
+    {
+        int avail = network.available();
+        int total = 0;
+
+        backlog = 0;
+        if (avail <= 0)
+        {
+            if (timeout_ms <= 0)
+                return 0;
+            avail = 1;      // let read wait for the first byte, the rest can come next time
+        }
+        if (count == 0)
+            head = 0;       // keep the free space in one piece
+        while (avail > 0 && count < SIZE)
+        {
+            int tail = (head + count) % SIZE;
+            int space = (tail >= head) ? SIZE - tail : head - tail;
+            int len = (avail < space) ? avail : space;
+            int rc = network.read(&buf[tail], len, timeout_ms);
+
+            if (rc <= 0)
+                return (total > 0) ? total : -1;
+            count += rc;
+            total += rc;
+            avail -= rc;
+            if (rc < len)
+                break;
+        }
+        backlog = avail;
+        return total;
+    }
+
+    /** Did the last fill leave data in the network because the ring was full?
+     */
+    bool behind()
+    {
+        return backlog > 0;
+    }
+
+    /** Take the next complete packet out of the ring
+     *  @param packet - the buffer the packet is copied to
+     *  @param buflen - the length of packet
+     *  @param len - returns the length of the packet, if not 0
+     *  @return the MQTT packet type, 0 if there is no complete packet yet,
+     *      MQTTPACKET_READ_ERROR for a bad remaining length, or MQTTPACKET_BUFFER_TOO_SHORT
+     *      for a packet larger than buflen or than the ring - it is then dropped as it arrives
+     */
+    int next(unsigned char* packet, int buflen, int* len = 0)
+    {
+        int rem_len = 0;
+        int multiplier = 1;
+        int total = 1;
+        unsigned char c;
+        MQTTHeader header = {0};
+
+        if (skip > 0)
+        {
+            int n = (skip < count) ? skip : count;
+            consume(n);
+            skip -= n;
+            if (skip > 0)
+                return 0;
+        }
+
+        do
+        {
+            if (total > 4)
+                return MQTTPACKET_READ_ERROR;
+            if (total >= count)
+                return 0;
+            c = at(total++);
+            rem_len += (c & 127) * multiplier;
+            multiplier *= 128;
+        } while ((c & 128) != 0);
+
+        total += rem_len;
+        if (total > buflen || total > SIZE)
+        {   // it could never be whole in packet, or in the ring: drop it as it arrives
+            skip = total;
+            return MQTTPACKET_BUFFER_TOO_SHORT;
+        }
+        if (total > count)
+            return 0;
+
+        int first = SIZE - head;
+        if (first >= total)
+            memcpy(packet, &buf[head], total);
+        else
+        {
+            memcpy(packet, &buf[head], first);
+            memcpy(&packet[first], buf, total - first);
+        }
+        consume(total);
+        if (len)
+            *len = total;
+        header.byte = packet[0];
+        return (header.bits.type != 0) ? (int)header.bits.type : (int)MQTTPACKET_READ_ERROR;
+    }
+
+private:
+
+    unsigned char at(int offset)
+    {
+        return buf[(head + offset) % SIZE];
+    }
+
+    void consume(int n)
+    {
+        head = (head + n) % SIZE;
+        count -= n;
+    }
+
+    unsigned char buf[SIZE];
+    int head;               // the first byte not handed out yet
+    int count;              // the bytes held
+    int backlog;            // what the network still had after the last fill
+    int skip;               // bytes still to drop of a packet too large to hand out
+};
+
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    SD card spill store for the publish queue
+ *******************************************************************************/
+
+#if !defined(MQTTSDSTORE_H)
+#define MQTTSDSTORE_H
+
+#include <SD.h>
+
+namespace MQTT
+{
+
+
+/**
+ * @class SDStore
+ * @brief append-only file on an SD card, used as the spill store of a PublishQueue
+ *
+ * The file is opened for each operation and closed again, which writes the data to the card, so
+ * that spilled publishes survive a reset and the SD library's single open file is left free
+ * in between.  SD.begin must have been called before the queue is used.
+ */
+class SDStore
+{
+public:
+
+    /** @param path - an 8.3 file name, which must stay valid while the store is used
+     */
+    SDStore(const char* path) : path(path), length(0), known(false)
+    { }
+
+    bool append(const unsigned char* buf, int len)
+    {
+        SDLib::File f = SDLib::SD.open(path, O_READ | O_WRITE | O_CREAT | O_APPEND);
+        bool rc = false;
+
+        if (f)
+        {
+            rc = (f.write(buf, len) == (size_t)len);
+            length = f.size();
+            known = true;
+            f.close();
+        }
+        return rc;
+    }
+
+    int read(unsigned long pos, unsigned char* buf, int len)
+    {
+        SDLib::File f = SDLib::SD.open(path, O_READ);
+        int rc = 0;
+
+        if (f)
+        {
+            if (f.seek(pos))
+                rc = f.read(buf, len);
+            f.close();
+        }
+        return (rc < 0) ? 0 : rc;
+    }
+
+    unsigned long size()
+    {
+        if (!known)
+        {   // left over from before a reset?
+            SDLib::File f = SDLib::SD.open(path, O_READ);
+            length = f ? f.size() : 0;
+            if (f)
+                f.close();
+            known = true;
+        }
+        return length;
+    }
+
+    void clear()
+    {
+        SDLib::SD.remove(path);
+        length = 0;
+        known = true;
+    }
+
+private:
+
+    const char* path;
+    unsigned long length;
+    bool known;
+};
+
+}
+
+#endif
@@ -0,0 +1,633 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    MQTT-SN client over UDP, for telemetry through a gateway
+ *******************************************************************************/
+
+#if !defined(MQTTSNCLIENT_H)
+#define MQTTSNCLIENT_H
+
+#include "MQTTClient.h"
+#include <string.h>
+
+#if !defined(MQTTCLIENT_SN_RETRIES)
+    #define MQTTCLIENT_SN_RETRIES 3     // sends of a request before the gateway is taken to be lost
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * MQTT-SN 1.2 message types.  Only those sent or handled by SNClient and its test gateway are here.
+ */
+enum SNMsgType
+{
+    SN_CONNECT = 0x04, SN_CONNACK = 0x05,
+    SN_REGISTER = 0x0A, SN_REGACK = 0x0B,
+    SN_PUBLISH = 0x0C, SN_PUBACK = 0x0D,
+    SN_PINGREQ = 0x16, SN_PINGRESP = 0x17,
+    SN_DISCONNECT = 0x18
+};
+
+enum SNReturnCode { SN_ACCEPTED, SN_CONGESTION, SN_INVALID_TOPIC_ID, SN_NOT_SUPPORTED };
+
+enum SNTopicType
+{
+    SN_TOPIC_NORMAL = 0,        // an id from REGISTER
+    SN_TOPIC_PREDEFINED = 1,    // an id agreed with the gateway beforehand
+    SN_TOPIC_SHORT = 2          // a two character topic name, sent in place of the id
+};
+
+/**
+ * QoS -1 publishes need no connection: they are sent to the gateway whenever the client has
+ * begun, to a predefined or short topic.  In the flags it is the QoS field's fourth value, 3.
+ */
+enum SNQoS { SN_QOSM1 = -1, SN_QOS0 = 0, SN_QOS1 = 1 };
+
+enum
+{
+    SN_FLAG_DUP = 0x80, SN_FLAG_QOS = 0x60, SN_FLAG_RETAIN = 0x10, SN_FLAG_CLEAN = 0x04, SN_FLAG_TOPIC_TYPE = 0x03,
+    SN_PROTOCOL_ID = 0x01
+};
+
+
+/**
+ * @class SNClient
+ * @brief MQTT-SN client, sending each packet as one UDP datagram to a gateway
+ *
+ * With MQTT::Client, each reading is a TCP segment on the session's one connection: a lost
+ * segment holds back every packet behind it until it is resent, and the topic name goes with
+ * every publish.  Here a publish is a datagram with a 7 byte header - length, type, flags, a two
+ * byte topic id and a two byte message id - and a lost one costs only itself.  The gateway keeps
+ * the MQTT session with the broker.
+ *
+ * Topics are numbered with registerTopic, or agreed with the gateway beforehand (predefined), or
+ * are two characters long (short).  QoS 0 and 1 publishes need a connection; QoS -1 publishes, to
+ * predefined or short topics only, do not.  As with MQTT::AsyncClient, nothing waits: the calls
+ * send their packet and return, and the CONNACK, REGACK and PUBACK are reported to the ack handler
+ * from poll, with their MQTT-SN return code, or FAILURE once a request has been sent
+ * MQTTCLIENT_SN_RETRIES times without a reply.  The gateway is then taken to be lost: the client
+ * is disconnected, and DISCONNECT is reported with FAILURE.  A DISCONNECT from the gateway is
+ * reported with SUCCESS.  One CONNECT or REGISTER and one QoS 1 publish can be outstanding at once.
+ * @param UDP a class with the methods of Arduino's UDP: begin, beginPacket, write, endPacket,
+ *     parsePacket, available, read - such as BridgeUDP
+ * @param Timer a timer class with the methods: countdown_ms, expired, left_ms
+ * @param MAX_PACKET_SIZE the largest packet sent or received - received packets which are larger
+ *     are dropped
+ * @param MAX_TOPICS the number of registered topics
+ */
+template<class UDP, class Timer, int MAX_PACKET_SIZE = 64, int MAX_TOPICS = 4>
+class SNClient
+{
+public:
+
+    typedef void (*ackHandler)(int msg_type, unsigned short msgid, int rc);
+
+    enum State { DISCONNECTED, CONNECTING, CONNECTED };
+
+    /** @param command_timeout_ms - the time to wait for a reply before sending a request again
+     */
+    SNClient(UDP& udp, unsigned int command_timeout_ms = 10000) : udp(udp), host(0), port(0), connstate(DISCONNECTED),
+        command_timeout_ms(command_timeout_ms), ah(0), next_msgid(0)
+    {
+        request.type = inflight.type = ping.type = 0;
+        clearTopics();
+    }
+
+    void setAckHandler(ackHandler ah)
+    {
+        this->ah = ah;
+    }
+
+    /** Open the UDP socket and set the gateway it sends to
+     *  @param host - the gateway's host name or address, which must outlive the client's use of it
+     *  @param port - the gateway's port
+     *  @param localPort - the port the socket listens on
+     *  @return success code -
+     */
+    int begin(const char* host, unsigned short port, unsigned short localPort)
+    {
+        this->host = host;
+        this->port = port;
+        return udp.begin(localPort) ? SUCCESS : FAILURE;
+    }
+
+    /** Send a CONNECT.  The outcome is reported to the ack handler as CONNACK.  Registered topic
+     *  ids are forgotten, as they belong to the session.
+     *  @param clientID - the client id, which must outlive the connection, as it is sent again
+     *      if the CONNECT is lost
+     *  @param duration - the keepalive in seconds: a PINGREQ is sent when nothing else has been
+     *  @param cleanSession - start a new session at the gateway
+     *  @return success code -
+     */
+    int connect(const char* clientID, unsigned short duration = 60, bool cleanSession = true)
+    {
+        int rc = FAILURE;
+
+        if (host == 0 || connstate != DISCONNECTED)
+            goto exit;
+        this->clientID = clientID;
+        this->duration = duration;
+        this->cleanSession = cleanSession;
+        clearTopics();
+        if ((rc = sendConnect()) != SUCCESS)
+            goto exit;
+        start(request, SN_CONNACK, 0);
+        connstate = CONNECTING;
+
+    exit:
+        return rc;
+    }
+
+    /** Ask the gateway for the id of a topic.  The REGACK is reported to the ack handler, after
+     *  which topicId gives the id.
+     *  @param topicName - the topic, which must outlive the client's use of it
+     *  @param msgid - the message id of the REGISTER, for the REGACK - returned
+     *  @return success code - FAILURE if a request is outstanding or MAX_TOPICS are registered
+     */
+    int registerTopic(const char* topicName, unsigned short& msgid)
+    {
+        int rc = FAILURE, i = slot(topicName);
+
+        if (connstate != CONNECTED || request.type != 0)
+            goto exit;
+        if (i == MAX_TOPICS && (i = slot(0)) == MAX_TOPICS)
+            goto exit;
+        topics[i].name = topicName;
+        topics[i].id = 0;
+        registering = i;
+        msgid = nextId();
+        if ((rc = sendRegister(msgid)) != SUCCESS)
+        {
+            topics[i].name = 0;
+            goto exit;
+        }
+        start(request, SN_REGACK, msgid);
+
+    exit:
+        return rc;
+    }
+
+    /** The id the gateway gave a topic, or 0 if it is not registered
+     */
+    unsigned short topicId(const char* topicName)
+    {
+        int i = slot(topicName);
+        return (i < MAX_TOPICS) ? topics[i].id : 0;
+    }
+
+    /** Publish to a topic id
+     *  @param topicId - a registered or predefined id, or the two characters of a short topic
+     *  @param payload - the data to send.  At QoS 1 it must stay unchanged until the PUBACK, as
+     *      it is sent again if the publish is lost.
+     *  @param msgid - the message id used, for the PUBACK at QoS 1 - returned
+     *  @param type - the kind of topic id
+     *  @return success code - FAILURE if QoS 1 is asked for while a QoS 1 publish is outstanding
+     */
+    int publish(unsigned short topicId, const void* payload, size_t payloadlen, unsigned short& msgid, enum SNQoS qos = SN_QOS1,
+            bool retained = false, enum SNTopicType type = SN_TOPIC_NORMAL)
+    {
+        Publish pub;
+        int rc = FAILURE;
+
+        if (host == 0)
+            goto exit;
+        if (qos == SN_QOSM1 ? type == SN_TOPIC_NORMAL : connstate != CONNECTED)
+            goto exit;
+        if (qos == SN_QOS1 && inflight.type != 0)
+            goto exit;
+        msgid = (qos == SN_QOS1) ? nextId() : 0;
+        pub.topicId = topicId;
+        pub.flags = ((qos & 3) << 5) | (retained ? SN_FLAG_RETAIN : 0) | type;
+        pub.payload = (const unsigned char*)payload;
+        pub.payloadlen = payloadlen;
+        if ((rc = sendPublish(pub, msgid, 0)) != SUCCESS)
+            goto exit;
+        if (qos == SN_QOS1)
+        {
+            inflightPub = pub;
+            start(inflight, SN_PUBACK, msgid);
+        }
+
+    exit:
+        return rc;
+    }
+
+    int publish(unsigned short topicId, const void* payload, size_t payloadlen, enum SNQoS qos = SN_QOS0,
+            bool retained = false, enum SNTopicType type = SN_TOPIC_NORMAL)
+    {
+        unsigned short msgid = 0;
+        return publish(topicId, payload, payloadlen, msgid, qos, retained, type);
+    }
+
+    /** Publish to a registered topic, or a short one of two characters, by name
+     *  @return success code - FAILURE if the topic is neither
+     */
+    int publish(const char* topicName, const void* payload, size_t payloadlen, enum SNQoS qos = SN_QOS0, bool retained = false)
+    {
+        unsigned short id = topicId(topicName);
+
+        if (id != 0)
+            return publish(id, payload, payloadlen, qos, retained, SN_TOPIC_NORMAL);
+        if (strlen(topicName) == 2)
+            return publish((unsigned short)((topicName[0] << 8) | (unsigned char)topicName[1]), payload, payloadlen, qos, retained, SN_TOPIC_SHORT);
+        return FAILURE;
+    }
+
+    /** Read any packets from the gateway, send a PINGREQ when the keepalive is due, and send
+     *  requests again which have not been answered.  Call it from the main loop.
+     *  @return success code - FAILURE once the gateway is taken to be lost
+     */
+    int poll()
+    {
+        int len, rc = SUCCESS;
+
+        while (udp.parsePacket() > 0)
+        {
+            if ((len = udp.available()) > 0 && len <= MAX_PACKET_SIZE && udp.read(readbuf, len) == len)
+                handlePacket(len);
+        }
+        if (connstate == DISCONNECTED)
+            goto exit;
+        if (connstate == CONNECTED && duration > 0 && ping.type == 0 && keepalive_timer.expired() && sendPing() == SUCCESS)
+            start(ping, SN_PINGRESP, 0);
+        if (!retry(request) || !retry(inflight) || !retry(ping))
+        {
+            lost();
+            rc = FAILURE;
+        }
+
+    exit:
+        return rc;
+    }
+
+    /** The time until poll has something to do other than read, for a sketch which sleeps
+     */
+    unsigned long next_ms()
+    {
+        unsigned long next = command_timeout_ms;
+
+        if (connstate == DISCONNECTED)
+            return next;
+        if (connstate == CONNECTED && duration > 0 && ping.type == 0)
+            next = keepalive_timer.left_ms();
+        if (request.type != 0 && request.timer.left_ms() < next)
+            next = request.timer.left_ms();
+        if (inflight.type != 0 && inflight.timer.left_ms() < next)
+            next = inflight.timer.left_ms();
+        if (ping.type != 0 && ping.timer.left_ms() < next)
+            next = ping.timer.left_ms();
+        return next;
+    }
+
+    /** Send a DISCONNECT.  Outstanding requests are reported with FAILURE.
+     */
+    int disconnect()
+    {
+        int rc = FAILURE;
+
+        if (connstate == DISCONNECTED)
+            goto exit;
+        rc = sendEmpty(SN_DISCONNECT);
+        close();
+
+    exit:
+        return rc;
+    }
+
+    enum State state()
+    {
+        return connstate;
+    }
+
+    bool isConnected()
+    {
+        return connstate == CONNECTED;
+    }
+
+private:
+
+    struct Publish
+    {
+        unsigned short topicId;
+        unsigned char flags;
+        const unsigned char* payload;
+        int payloadlen;
+    };
+
+    struct Pending
+    {
+        unsigned char type;         // the reply awaited, 0 for none
+        unsigned short msgid;
+        int sends;
+        Timer timer;                // runs until the request is sent again
+    };
+
+    void clearTopics()
+    {
+        for (int i = 0; i < MAX_TOPICS; ++i)
+            topics[i].name = 0;
+    }
+
+    // the topic table slot holding topicName, or MAX_TOPICS; slot(0) finds a free one
+    int slot(const char* topicName)
+    {
+        int i = 0;
+
+        for (; i < MAX_TOPICS; ++i)
+        {
+            if (topicName == 0 ? topics[i].name == 0 : (topics[i].name != 0 && strcmp(topics[i].name, topicName) == 0))
+                break;
+        }
+        return i;
+    }
+
+    unsigned short nextId()
+    {
+        return next_msgid = (next_msgid == 0xFFFF) ? 1 : next_msgid + 1;
+    }
+
+    void start(Pending& p, unsigned char type, unsigned short msgid)
+    {
+        p.type = type;
+        p.msgid = msgid;
+        p.sends = 1;
+        p.timer.countdown_ms(command_timeout_ms);
+    }
+
+    // send the request again if its reply is overdue, returns false if it has been sent enough times
+    bool retry(Pending& p)
+    {
+        if (p.type == 0 || !p.timer.expired())
+            return true;
+        if (p.sends >= MQTTCLIENT_SN_RETRIES)
+            return false;
+        switch (p.type)
+        {
+            case SN_CONNACK:
+                sendConnect();
+                break;
+            case SN_REGACK:
+                sendRegister(p.msgid);
+                break;
+            case SN_PUBACK:
+                sendPublish(inflightPub, p.msgid, SN_FLAG_DUP);
+                break;
+            case SN_PINGRESP:
+                sendPing();
+                break;
+        }
+        ++p.sends;
+        p.timer.countdown_ms(command_timeout_ms);
+        return true;
+    }
+
+    void handlePacket(int len)
+    {
+        unsigned char* ptr = readbuf;
+        unsigned char* end = readbuf + len;
+        int packetlen = *ptr++;
+        unsigned short topicId, msgid;
+        int rc;
+
+        if (packetlen == 0x01 && len >= 4)
+        {   // a three byte length
+            packetlen = readInt(&ptr);
+        }
+        if (packetlen != len || ptr == end)
+            return;
+
+        switch (*ptr++)
+        {
+            case SN_CONNACK:
+                if (request.type != SN_CONNACK || ptr == end)
+                    break;
+                request.type = 0;
+                rc = *ptr;
+                connstate = (rc == SN_ACCEPTED) ? CONNECTED : DISCONNECTED;
+                keepalive_timer.countdown(duration);
+                if (ah)
+                    ah(SN_CONNACK, 0, rc);
+                break;
+            case SN_REGACK:
+                if (end - ptr < 5)
+                    break;
+                topicId = readInt(&ptr);
+                msgid = readInt(&ptr);
+                rc = *ptr;
+                if (request.type != SN_REGACK || msgid != request.msgid)
+                    break;
+                request.type = 0;
+                if (rc == SN_ACCEPTED && topicId != 0)
+                    topics[registering].id = topicId;
+                else
+                    topics[registering].name = 0;
+                if (ah)
+                    ah(SN_REGACK, msgid, rc);
+                break;
+            case SN_PUBACK:
+                if (end - ptr < 5)
+                    break;
+                topicId = readInt(&ptr);
+                msgid = readInt(&ptr);
+                rc = *ptr;
+                if (inflight.type == SN_PUBACK && msgid == inflight.msgid)
+                    inflight.type = 0;
+                else if (msgid != 0)
+                    break;          // a duplicate PUBACK
+                if (rc == SN_INVALID_TOPIC_ID)
+                    forget(topicId);
+                if (ah)
+                    ah(SN_PUBACK, msgid, rc);
+                break;
+            case SN_PINGRESP:
+                ping.type = 0;
+                break;
+            case SN_PINGREQ:
+                if (connstate == CONNECTED)
+                    sendEmpty(SN_PINGRESP);
+                break;
+            case SN_DISCONNECT:
+                if (connstate == DISCONNECTED)
+                    break;
+                close();
+                if (ah)
+                    ah(SN_DISCONNECT, 0, SUCCESS);
+                break;
+        }
+    }
+
+    // the gateway no longer knows the id: it has to be registered again
+    void forget(unsigned short topicId)
+    {
+        for (int i = 0; i < MAX_TOPICS; ++i)
+        {
+            if (topics[i].name != 0 && topics[i].id == topicId)
+                topics[i].name = 0;
+        }
+    }
+
+    // disconnected: report the requests which will now get no reply
+    void close()
+    {
+        connstate = DISCONNECTED;
+        ping.type = 0;
+        if (request.type != 0 && ah)
+            ah(request.type, request.msgid, FAILURE);
+        if (request.type == SN_REGACK)
+            topics[registering].name = 0;
+        request.type = 0;
+        if (inflight.type != 0 && ah)
+            ah(SN_PUBACK, inflight.msgid, FAILURE);
+        inflight.type = 0;
+    }
+
+    void lost()
+    {
+        bool connecting = (connstate == CONNECTING);
+
+        close();
+        if (!connecting && ah)
+            ah(SN_DISCONNECT, 0, FAILURE);
+    }
+
+    // write the length and type which start every packet, returns the header's length or 0 if the packet does not fit
+    int header(unsigned char*& ptr, int bodylen, unsigned char type)
+    {
+        int len = bodylen + 2;
+
+        if (len > 255)
+            len += 2;
+        if (len > MAX_PACKET_SIZE || len > 0xFFFF)
+            return 0;
+        ptr = sendbuf;
+        if (len <= 255)
+            *ptr++ = len;
+        else
+        {
+            *ptr++ = 0x01;
+            writeInt(&ptr, len);
+        }
+        *ptr++ = type;
+        return len;
+    }
+
+    int sendPacket(int len)
+    {
+        int rc = FAILURE;
+
+        if (udp.beginPacket(host, port) != 1)
+            goto exit;
+        if (udp.write(sendbuf, len) == 0)
+            goto exit;
+        if (udp.endPacket() != 1)
+            goto exit;
+        if (connstate == CONNECTED)
+            keepalive_timer.countdown(duration);
+        rc = SUCCESS;
+
+    exit:
+        return rc;
+    }
+
+    int sendConnect()
+    {
+        unsigned char* ptr;
+        int idlen = strlen(clientID);
+        int len = header(ptr, 4 + idlen, SN_CONNECT);
+
+        if (len == 0)
+            return BUFFER_OVERFLOW;
+        *ptr++ = cleanSession ? SN_FLAG_CLEAN : 0;
+        *ptr++ = SN_PROTOCOL_ID;
+        writeInt(&ptr, duration);
+        memcpy(ptr, clientID, idlen);
+        return sendPacket(len);
+    }
+
+    int sendRegister(unsigned short msgid)
+    {
+        unsigned char* ptr;
+        int namelen = strlen(topics[registering].name);
+        int len = header(ptr, 4 + namelen, SN_REGISTER);
+
+        if (len == 0)
+            return BUFFER_OVERFLOW;
+        writeInt(&ptr, 0);
+        writeInt(&ptr, msgid);
+        memcpy(ptr, topics[registering].name, namelen);
+        return sendPacket(len);
+    }
+
+    int sendPublish(Publish& pub, unsigned short msgid, unsigned char dup)
+    {
+        unsigned char* ptr;
+        int len = header(ptr, 5 + pub.payloadlen, SN_PUBLISH);
+
+        if (len == 0)
+            return BUFFER_OVERFLOW;
+        *ptr++ = pub.flags | dup;
+        writeInt(&ptr, pub.topicId);
+        writeInt(&ptr, msgid);
+        if (pub.payloadlen > 0)
+            memcpy(ptr, pub.payload, pub.payloadlen);
+        return sendPacket(len);
+    }
+
+    int sendPing()
+    {
+        return sendEmpty(SN_PINGREQ);
+    }
+
+    int sendEmpty(unsigned char type)
+    {
+        unsigned char* ptr;
+        return sendPacket(header(ptr, 0, type));
+    }
+
+    UDP& udp;
+    const char* host;
+    unsigned short port;
+
+    enum State connstate;
+    const char* clientID;
+    unsigned short duration;
+    bool cleanSession;
+    Timer keepalive_timer;          // runs until a PINGREQ is due
+
+    unsigned int command_timeout_ms;
+    ackHandler ah;
+    unsigned short next_msgid;
+
+    Pending request;                // CONNECT or REGISTER
+    Pending inflight;               // QoS 1 PUBLISH
+    Pending ping;
+
+    Publish inflightPub;            // sent again with DUP until its PUBACK
+
+    struct
+    {
+        const char* name;           // 0 for a free slot
+        unsigned short id;          // 0 while the REGISTER is outstanding
+    } topics[MAX_TOPICS];
+    int registering;                // the slot of the outstanding REGISTER
+
+    unsigned char sendbuf[MAX_PACKET_SIZE];
+    unsigned char readbuf[MAX_PACKET_SIZE];
+};
+
+
+}
+
+#endif
@@ -0,0 +1,278 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    topic filter trie for message handler dispatch
+ *******************************************************************************/
+
+#if !defined(MQTTTOPICTRIE_H)
+#define MQTTTOPICTRIE_H
+
+#include "MQTTPacket.h"
+#include <string.h>
+
+namespace MQTT
+{
+
+
+/**
+ * @class TopicTrie
+ * @brief index of subscription topic filters, for routing incoming publishes
+ *
+ * Filters are split into levels at '/' and stored as a trie whose nodes come from a fixed pool,
+ * so no memory is allocated.  '+' and '#' levels are ordinary nodes which the matcher follows
+ * for any level, so the cost of a lookup depends on the depth of the topic, not on the number
+ * of filters.  Nodes point into the filter strings, which must stay valid while subscribed.
+ * @param MAX_NODES the size of the node pool - a filter takes one node per level, shared
+ *     with other filters which have the same leading levels
+ */
+template<int MAX_NODES>
+class TopicTrie
+{
+public:
+
+    TopicTrie()
+    {
+        nodes[0].level = "";
+        nodes[0].len = 0;
+        nodes[0].value = -1;
+        nodes[0].child = nodes[0].sibling = NONE;
+        freelist = NONE;
+        for (int i = MAX_NODES - 1; i > 0; --i)
+            release(i);
+    }
+
+    /** Add a filter
+     *  @param topicFilter - the filter, which can include wildcards
+     *  @param value - the value returned by match for topics which match this filter, >= 0
+     *  @return true on success, false if the node pool is exhausted
+     */
+    bool insert(const char* topicFilter, int value)
+    {
+        unsigned short node = 0;
+        const char* level = topicFilter;
+
+        while (true)
+        {
+            const char* end = levelEnd(level);
+            unsigned short next = findChild(node, level, end - level);
+            if (next == NONE)
+            {
+                if ((next = allocate()) == NONE)
+                {
+                    prune(topicFilter);     // drop the levels added so far
+                    return false;
+                }
+                nodes[next].level = level;
+                nodes[next].len = end - level;
+                nodes[next].sibling = nodes[node].child;
+                nodes[node].child = next;
+            }
+            node = next;
+            if (*end == '\0')
+                break;
+            level = end + 1;
+        }
+        nodes[node].value = value;
+        return true;
+    }
+
+    /** Find the value stored for a filter by an exact comparison
+     *  @param topicFilter - the filter
+     *  @return the value, or -1 if the filter is not present
+     */
+    int find(const char* topicFilter)
+    {
+        unsigned short node = 0;
+        const char* level = topicFilter;
+
+        while (true)
+        {
+            const char* end = levelEnd(level);
+            if ((node = findChild(node, level, end - level)) == NONE)
+                return -1;
+            if (*end == '\0')
+                return nodes[node].value;
+            level = end + 1;
+        }
+    }
+
+    /** Remove a filter
+     *  @param topicFilter - the filter
+     *  @return true if the filter was present
+     */
+    bool remove(const char* topicFilter)
+    {
+        bool found = false;
+        remove(0, topicFilter, found);
+        return found;
+    }
+
+    /** Find the filters which match a topic name
+     *  @param topicName - the topic of an incoming publish
+     *  @param values - receives the value of each matching filter
+     *  @param maxvalues - the size of the values array
+     *  @return the number of values stored
+     */
+    int match(MQTTString& topicName, int* values, int maxvalues)
+    {
+        Matches m = {values, maxvalues, 0};
+        const char* name = topicName.lenstring.data;
+        int namelen = topicName.lenstring.len;
+
+        if (name == 0)
+        {
+            name = topicName.cstring;
+            namelen = strlen(name);
+        }
+        match(0, name, name + namelen, m);
+        return m.count;
+    }
+
+private:
+
+    enum { NONE = 0xFFFF };
+
+    struct Node
+    {
+        const char* level;          // points into the subscribed filter
+        unsigned char len;
+        short value;                // -1 if no filter ends at this node
+        unsigned short child;       // first child, siblings are chained through sibling
+        unsigned short sibling;
+    };
+
+    struct Matches
+    {
+        int* values;
+        int max;
+        int count;
+    };
+
+    static const char* levelEnd(const char* level)
+    {
+        while (*level != '\0' && *level != '/')
+            ++level;
+        return level;
+    }
+
+    unsigned short findChild(unsigned short node, const char* level, int len)
+    {
+        unsigned short child = nodes[node].child;
+
+        while (child != NONE && (nodes[child].len != len || memcmp(nodes[child].level, level, len) != 0))
+            child = nodes[child].sibling;
+        return child;
+    }
+
+    unsigned short allocate()
+    {
+        unsigned short node = freelist;
+
+        if (node != NONE)
+        {
+            freelist = nodes[node].sibling;
+            nodes[node].value = -1;
+            nodes[node].child = NONE;
+        }
+        return node;
+    }
+
+    void release(unsigned short node)
+    {
+        nodes[node].sibling = freelist;
+        freelist = node;
+    }
+
+    void add(Matches& m, short value)
+    {
+        if (value >= 0 && m.count < m.max)
+            m.values[m.count++] = value;
+    }
+
+    void match(unsigned short node, const char* level, const char* end, Matches& m)
+    {
+        const char* next = level;
+
+        while (next < end && *next != '/')
+            ++next;
+        for (unsigned short child = nodes[node].child; child != NONE; child = nodes[child].sibling)
+        {
+            Node& c = nodes[child];
+            if (c.len == 1 && c.level[0] == '#')
+                add(m, c.value);    // matches this and all the remaining levels
+            else if ((c.len == 1 && c.level[0] == '+') ||
+                     (c.len == next - level && memcmp(c.level, level, c.len) == 0))
+            {
+                if (next < end)
+                    match(child, next + 1, end, m);
+                else
+                {
+                    add(m, c.value);
+                    unsigned short hash = findChild(child, "#", 1);   // "a/#" also matches "a"
+                    if (hash != NONE)
+                        add(m, nodes[hash].value);
+                }
+            }
+        }
+    }
+
+    // returns true once node has no children left
+    bool remove(unsigned short node, const char* level, bool& found)
+    {
+        const char* end = levelEnd(level);
+        unsigned short prev = NONE;
+        unsigned short child = nodes[node].child;
+
+        while (child != NONE && (nodes[child].len != end - level || memcmp(nodes[child].level, level, end - level) != 0))
+        {
+            prev = child;
+            child = nodes[child].sibling;
+        }
+        if (child == NONE)
+            return nodes[node].child == NONE;   // the end of a partially inserted filter
+
+        bool unused;
+        if (*end == '\0')
+        {
+            found = nodes[child].value >= 0;
+            nodes[child].value = -1;
+            unused = (nodes[child].child == NONE);
+        }
+        else
+            unused = remove(child, end + 1, found) && nodes[child].value < 0;
+
+        if (unused)
+        {
+            if (prev == NONE)
+                nodes[node].child = nodes[child].sibling;
+            else
+                nodes[prev].sibling = nodes[child].sibling;
+            release(child);
+        }
+        return nodes[node].child == NONE;
+    }
+
+    // remove the nodes of a partially inserted filter
+    void prune(const char* topicFilter)
+    {
+        bool found = false;
+        remove(0, topicFilter, found);
+    }
+
+    Node nodes[MAX_NODES];          // node 0 is the root
+    unsigned short freelist;
+};
+
+}
+
+#endif
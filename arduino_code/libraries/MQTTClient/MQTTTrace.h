@@ -0,0 +1,181 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    binary trace ring of packets sent and received
+ *******************************************************************************/
+
+#if !defined(MQTTTRACE_H)
+#define MQTTTRACE_H
+
+#if !defined(MQTTCLIENT_TRACE_CLOCK)
+    #define MQTTCLIENT_TRACE_CLOCK() micros()  // timestamp of each record, wraps as an unsigned long
+#endif
+
+namespace MQTT
+{
+
+
+enum TraceDirection { TRACE_SENT = 0, TRACE_RECEIVED = 1 };
+
+
+/**
+ * @class Trace
+ * @brief fixed size ring of the last packets sent and received, kept in binary for production use
+ *
+ * MQTT_DEBUG formats every packet with sprintf onto a 150 byte stack buffer and prints it, which
+ * changes the timing being looked at and costs more flash than the Yun can spare.  A record here
+ * is the clock, the packet's first header byte, its length and packet id, and the direction:
+ * a handful of stores and a look at the two or three bytes which hold the remaining length and
+ * the id.  Nothing is formatted until dump() writes the ring, oldest record first, to any
+ * Stream - Serial, or a Bridge File - for trace/TraceDecode on the host to print.
+ *
+ * Sent packets are recorded when the client hands them on, which while corked is when they join
+ * the transmit batch rather than when the batch is written.
+ * @param RECORDS the number of packets kept; older ones are overwritten
+ */
+template<int RECORDS>
+class Trace
+{
+public:
+
+    // the dump starts with this header, all numbers little endian
+    enum
+    {
+        MAGIC0 = 'M', MAGIC1 = 'Q', MAGIC2 = 'T', MAGIC3 = 'R',
+        VERSION = 1,
+        HEADER_SIZE = 16,   // magic(4) version(1) record size(1) records kept(2) total recorded(4) clock at dump(4)
+        RECORD_SIZE = 10    // clock(4) length(2) packet id(2) header byte(1) direction(1)
+    };
+
+    Trace()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        next = 0;
+        total = 0;
+    }
+
+    /** Record a whole serialized packet, or the part of it up to the payload
+     *  @param direction - TRACE_SENT or TRACE_RECEIVED
+     *  @param packet - the packet, starting with its fixed header
+     */
+    void record(unsigned char direction, const unsigned char* packet)
+    {
+        Record& r = ring[next];
+        const unsigned char* p = packet + 1;
+        unsigned long remaining = 0;
+        unsigned char shift = 0;
+        unsigned char type = packet[0] >> 4;
+
+        r.clock = MQTTCLIENT_TRACE_CLOCK();
+        do
+        {
+            remaining |= (unsigned long)(*p & 127) << shift;
+            shift += 7;
+        } while ((*p++ & 128) && shift < 28);
+        r.length = (unsigned short)(remaining + (p - packet));
+        r.header = packet[0];
+        r.direction = direction;
+        if (type == PUBLISH)    // the id follows the topic, and only at QoS 1 and 2
+        {
+            p += 2 + (p[0] << 8 | p[1]);
+            r.id = (packet[0] & 0x06) ? (unsigned short)(p[0] << 8 | p[1]) : 0;
+        }
+        else    // PUBACK to UNSUBACK start with the id, CONNECT, PINGs and the rest have none
+            r.id = (type >= PUBACK && type <= UNSUBACK) ? (unsigned short)(p[0] << 8 | p[1]) : 0;
+        next = (next + 1 == RECORDS) ? 0 : next + 1;
+        ++total;
+    }
+
+    /** the number of packets recorded since the last clear, including those overwritten */
+    unsigned long recorded()
+    {
+        return total;
+    }
+
+    /** Write the header and the records kept, oldest first, in pieces of a few records
+     *  @param out - anything with write(const uint8_t*, size_t), such as Serial or a Bridge File
+     *  @return the number of bytes written
+     */
+    template<class Stream>
+    int dump(Stream& out)
+    {
+        unsigned char buf[8 * RECORD_SIZE];
+        int kept = (total < (unsigned long)RECORDS) ? (int)total : RECORDS;
+        int index = (total < (unsigned long)RECORDS) ? 0 : next;
+        int written = 0;
+        int len = 0;
+
+        buf[0] = MAGIC0;
+        buf[1] = MAGIC1;
+        buf[2] = MAGIC2;
+        buf[3] = MAGIC3;
+        buf[4] = VERSION;
+        buf[5] = RECORD_SIZE;
+        put(&buf[6], kept, 2);
+        put(&buf[8], total, 4);
+        put(&buf[12], MQTTCLIENT_TRACE_CLOCK(), 4);
+        written += out.write(buf, HEADER_SIZE);
+
+        for (int i = 0; i < kept; ++i)
+        {
+            Record& r = ring[index];
+
+            put(&buf[len], r.clock, 4);
+            put(&buf[len + 4], r.length, 2);
+            put(&buf[len + 6], r.id, 2);
+            buf[len + 8] = r.header;
+            buf[len + 9] = r.direction;
+            len += RECORD_SIZE;
+            if (len == sizeof(buf) || i == kept - 1)
+            {
+                written += out.write(buf, len);
+                len = 0;
+            }
+            index = (index + 1 == RECORDS) ? 0 : index + 1;
+        }
+        return written;
+    }
+
+private:
+
+    static void put(unsigned char* buf, unsigned long value, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i)
+        {
+            buf[i] = (unsigned char)value;
+            value >>= 8;
+        }
+    }
+
+    struct Record
+    {
+        unsigned long clock;
+        unsigned short length;
+        unsigned short id;
+        unsigned char header;
+        unsigned char direction;
+    };
+
+    Record ring[RECORDS];
+    int next;               // the slot the next record goes in
+    unsigned long total;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    transmit batching for corked clients
+ *******************************************************************************/
+
+#if !defined(MQTTTXBATCH_H)
+#define MQTTTXBATCH_H
+
+#include <string.h>
+
+namespace MQTT
+{
+
+
+/**
+ * @class TxBatch
+ * @brief transmit buffer which collects serialized packets while a client is corked
+ *
+ * While corked, the client appends each packet here instead of writing it to the network, and
+ * writes the whole buffer in one go when it is uncorked, when the next packet does not fit, or
+ * when the flush deadline set by cork has passed.  Over a link where every write has a fixed
+ * cost, such as the Yun's Bridge, several packets then cost one write.
+ * @param Timer a timer class with the methods: countdown_ms, expired, left_ms
+ * @param SIZE the size of the buffer in bytes
+ */
+template<class Timer, int SIZE>
+class TxBatch
+{
+public:
+
+    TxBatch() : len(0), corked(false), flush_ms(0)
+    { }
+
+    /** Start collecting packets
+     *  @param flush_ms - write the batch this long after the first packet was added to it,
+     *      0 to wait for uncork or a full buffer
+     */
+    void cork(unsigned long flush_ms)
+    {
+        corked = true;
+        this->flush_ms = flush_ms;
+    }
+
+    void uncork()
+    {
+        corked = false;
+    }
+
+    bool isCorked()
+    {
+        return corked;
+    }
+
+    /** Is there room for a packet of this length?
+     */
+    bool fits(int length)
+    {
+        return len + length <= SIZE;
+    }
+
+    /** Add a packet to the batch.  The caller checks that it fits.
+     *  @param buf - the packet, or its header when the payload is held elsewhere
+     *  @param length - the length of buf
+     *  @param payload - the rest of the packet, or 0
+     *  @param payloadlen - the length of payload
+     */
+    void append(unsigned char* buf, int length, unsigned char* payload, int payloadlen)
+    {
+        if (len == 0 && flush_ms > 0)
+            deadline.countdown_ms(flush_ms);
+        memcpy(&this->buf[len], buf, length);
+        len += length;
+        if (payloadlen > 0)
+        {
+            memcpy(&this->buf[len], payload, payloadlen);
+            len += payloadlen;
+        }
+    }
+
+    /** Has the flush deadline of a non-empty batch passed?
+     */
+    bool due()
+    {
+        return len > 0 && flush_ms > 0 && deadline.expired();
+    }
+
+    /** Does the batch have a flush deadline, and how far off is it?
+     *  @param ms - returns the time left until the batch is due, if there is a deadline
+     */
+    bool deadlineLeft(unsigned long& ms)
+    {
+        if (len == 0 || flush_ms == 0)
+            return false;
+        ms = deadline.left_ms();
+        return true;
+    }
+
+    unsigned char* data()
+    {
+        return buf;
+    }
+
+    int length()
+    {
+        return len;
+    }
+
+    void clear()
+    {
+        len = 0;
+    }
+
+private:
+
+    unsigned char buf[SIZE];
+    int len;
+    bool corked;
+    unsigned long flush_ms;
+    Timer deadline;
+};
+
+}
+
+#endif
@@ -26,10 +26,25 @@
   * @return the length of buffer needed to contain the serialized version of the packet
   */
 int MQTTSerialize_unsubscribeLength(int count, MQTTString topicFilters[])
+{
+	return MQTTV5Serialize_unsubscribeLength(NULL, count, topicFilters);
+}
+
+
+/**
+  * Determines the length of the MQTT unsubscribe packet that would be produced using the supplied parameters
+  * @param properties the MQTT 5 properties, or NULL for an MQTT 3.1.1 unsubscribe
+  * @param count the number of topic filter strings in topicFilters
+  * @param topicFilters the array of topic filter strings to be used in the publish
+  * @return the length of buffer needed to contain the serialized version of the packet
+  */
+int MQTTV5Serialize_unsubscribeLength(MQTTProperties* properties, int count, MQTTString topicFilters[])
 {
 	int i;
 	int len = 2; /* packetid */
 
+	if (properties)
+		len += MQTTProperties_len(properties);
 	for (i = 0; i < count; ++i)
 		len += 2 + MQTTstrlen(topicFilters[i]); /* length + topic*/
 	return len;
@@ -48,6 +63,24 @@ int MQTTSerialize_unsubscribeLength(int count, MQTTString topicFilters[])
   */
 int MQTTSerialize_unsubscribe(unsigned char* buf, int buflen, unsigned char dup, unsigned short packetid,
 		int count, MQTTString topicFilters[])
+{
+	return MQTTV5Serialize_unsubscribe(buf, buflen, dup, packetid, NULL, count, topicFilters);
+}
+
+
+/**
+  * Serializes the supplied unsubscribe data and MQTT 5 properties into the supplied buffer, ready for sending
+  * @param buf the raw buffer data, of the correct length determined by the remaining length field
+  * @param buflen the length in bytes of the data in the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param properties the MQTT 5 properties, or NULL for an MQTT 3.1.1 unsubscribe
+  * @param count - number of members in the topicFilters array
+  * @param topicFilters - array of topic filter names
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTV5Serialize_unsubscribe(unsigned char* buf, int buflen, unsigned char dup, unsigned short packetid,
+		MQTTProperties* properties, int count, MQTTString topicFilters[])
 {
 	unsigned char *ptr = buf;
 	MQTTHeader header = {0};
@@ -56,7 +89,7 @@ int MQTTSerialize_unsubscribe(unsigned char* buf, int buflen, unsigned char dup,
 	int i = 0;
 
 	FUNC_ENTRY;
-	if (MQTTPacket_len(rem_len = MQTTSerialize_unsubscribeLength(count, topicFilters)) > buflen)
+	if (MQTTPacket_len(rem_len = MQTTV5Serialize_unsubscribeLength(properties, count, topicFilters)) > buflen)
 	{
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
@@ -72,6 +105,9 @@ int MQTTSerialize_unsubscribe(unsigned char* buf, int buflen, unsigned char dup,
 
 	writeInt(&ptr, packetid);
 
+	if (properties)
+		MQTTProperties_write(&ptr, properties);
+
 	for (i = 0; i < count; ++i)
 		writeMQTTString(&ptr, topicFilters[i]);
 
@@ -83,7 +119,8 @@ exit:
 
 
 /**
-  * Deserializes the supplied (wire) buffer into unsuback data
+  * Deserializes the supplied (wire) buffer into unsuback data.  Only the packet identifier is read, so
+  * this serves for MQTT 5 too, whose reason codes and properties follow it.
   * @param packetid returned integer - the MQTT packet identifier
   * @param buf the raw buffer data, of the correct length determined by the remaining length field
   * @param buflen the length in bytes of the data in the supplied buffer
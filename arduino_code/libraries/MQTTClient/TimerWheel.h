@@ -0,0 +1,259 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    hierarchical timer wheel for the main loop
+ *******************************************************************************/
+
+#if !defined(TIMERWHEEL_H)
+#define TIMERWHEEL_H
+
+/**
+ * A timer which can be armed in a TimerWheel.  It calls its handler when it expires, and does
+ * not move in memory while it is armed.
+ */
+class WheelTimer
+{
+public:
+
+    typedef void (*handler)(void* arg);
+
+    WheelTimer(handler fn, void* arg = 0) : next(0), pprev(0), expires(0), period(0), fn(fn), arg(arg)
+    { }
+
+    bool isArmed()
+    {
+        return pprev != 0;
+    }
+
+private:
+
+    template<int BITS, int LEVELS> friend class TimerWheel;
+
+    WheelTimer* next;
+    WheelTimer** pprev;         // the pointer to this one in its slot list, 0 when not armed
+    unsigned long expires;      // millis() tick
+    unsigned long period;       // 0 for a one shot
+    handler fn;
+    void* arg;
+};
+
+
+/**
+ * @class TimerWheel
+ * @brief hierarchical timer wheel on millis(), with one tick per millisecond
+ *
+ * Level 0 has a slot for each of the next 2^BITS ticks, each higher level a slot for each 2^BITS
+ * slots of the level below.  Arming and stopping a timer are O(1).  Each tick run() empties one
+ * level 0 slot, and every 2^BITS ticks moves the timers of one higher level slot down, so its
+ * cost does not grow with the number of armed timers.  Timers further out than the top level
+ * reaches are parked in it and moved down as often as needed.
+ * Ticks are compared by their difference, so the wheel works across the wrap of millis(), for
+ * intervals of up to 24 days.
+ * @param BITS the slots per level are 2^BITS, at most 5
+ * @param LEVELS the number of levels - the defaults reach 2^16 ms, about a minute, before parking
+ */
+template<int BITS = 4, int LEVELS = 4>
+class TimerWheel
+{
+public:
+
+    static const unsigned long NONE = 0xFFFFFFFFUL;     // next_ms when no timer is armed
+
+    TimerWheel()
+    {
+        now = millis();
+        armed = 0;
+        for (int i = 0; i < LEVELS; ++i)
+            for (int j = 0; j < SLOTS; ++j)
+                wheel[i][j] = 0;
+    }
+
+    /** Arm a timer, or move one which is already armed
+     *  @param timer - the timer
+     *  @param ms - the time from now until it expires
+     *  @param period - the interval it then repeats at, 0 to expire once
+     */
+    void start(WheelTimer& timer, unsigned long ms, unsigned long period = 0)
+    {
+        stop(timer);
+        timer.expires = millis() + ms;
+        timer.period = period;
+        add(&timer);
+        ++armed;
+    }
+
+    void stop(WheelTimer& timer)
+    {
+        if (timer.pprev)
+        {
+            unlink(&timer);
+            --armed;
+        }
+    }
+
+    /** Call the handlers of the timers which have expired.  A handler may start and stop any
+     *  timer, including its own.
+     *  @return the number of handlers called
+     */
+    int run()
+    {
+        unsigned long target = millis();
+        int fired = 0;
+
+        if (armed == 0)
+        {
+            now = target + 1;
+            return 0;
+        }
+        while ((long)(target - now) >= 0)
+        {
+            int index = now & MASK;
+
+            if (index == 0)
+                cascade();
+            // a handler may stop the others in the slot, or start one which is due at once
+            while (wheel[0][index])
+            {
+                WheelTimer* timer = wheel[0][index];
+
+                unlink(timer);
+                --armed;
+                if (timer->period > 0)
+                {
+                    timer->expires += timer->period;
+                    if ((long)(timer->expires - now) <= 0)
+                        timer->expires = now + timer->period;   // run was not called for a whole period
+                    add(timer);
+                    ++armed;
+                }
+                timer->fn(timer->arg);
+                ++fired;
+            }
+            ++now;
+        }
+        return fired;
+    }
+
+    /** How long until the next timer expires?  The main loop can sleep or do other work for this
+     *  long without run() being late.
+     *  @return the time in ms, 0 if run() has a handler to call now, or NONE if no timer is armed
+     */
+    unsigned long next_ms()
+    {
+        unsigned long earliest = 0;
+        bool found = false;
+
+        if (armed == 0)
+            return NONE;
+        for (int level = 0; level < LEVELS; ++level)
+        {
+            // level 0 starts with the slot run() has not emptied yet.  A higher level starts
+            // with its current slot too while run() has yet to cascade it, as now is at the
+            // start of its round, and otherwise with the next slot - the current one then
+            // holds the next round's timers and comes round last
+            int current = (now >> (BITS * level)) & MASK;
+            int first = (level == 0 || (now & ((1UL << (BITS * level)) - 1)) == 0) ? 0 : 1;
+
+            for (int i = first; i < first + SLOTS; ++i)
+            {
+                WheelTimer* timer = wheel[level][(current + i) & MASK];
+
+                if (timer == 0)
+                    continue;
+                for (; timer; timer = timer->next)
+                {
+                    if (!found || (long)(timer->expires - earliest) < 0)
+                        earliest = timer->expires;
+                    found = true;
+                }
+                if (level < LEVELS - 1)
+                    break;  // the top level is looked at whole: the timers parked in it are out of order
+            }
+        }
+        long left = (long)(earliest - millis());
+        return (left > 0) ? left : 0;
+    }
+
+    /** The number of armed timers
+     */
+    int count()
+    {
+        return armed;
+    }
+
+private:
+
+    enum { SLOTS = 1 << BITS, MASK = SLOTS - 1 };
+
+    void unlink(WheelTimer* timer)
+    {
+        *timer->pprev = timer->next;
+        if (timer->next)
+            timer->next->pprev = timer->pprev;
+        timer->next = 0;
+        timer->pprev = 0;
+    }
+
+    // put a timer in the slot for its expiry, seen from now
+    void add(WheelTimer* timer)
+    {
+        long ticks = (long)(timer->expires - now);
+        WheelTimer** slot;
+
+        if (ticks < 0)
+            slot = &wheel[0][now & MASK];   // overdue, at the next tick
+        else
+        {
+            unsigned long at = timer->expires;
+            int level = 0;
+
+            while (level < LEVELS - 1 && (unsigned long)ticks >= (1UL << (BITS * (level + 1))))
+                ++level;
+            if ((unsigned long)ticks >= (1UL << (BITS * LEVELS)))
+                at = now + (1UL << (BITS * LEVELS)) - 1;    // beyond the top level, park it
+            slot = &wheel[level][(at >> (BITS * level)) & MASK];
+        }
+        timer->next = *slot;
+        if (timer->next)
+            timer->next->pprev = &timer->next;
+        timer->pprev = slot;
+        *slot = timer;
+    }
+
+    // at the start of each round of a level, move the timers of the next slot above down
+    void cascade()
+    {
+        for (int level = 1; level < LEVELS; ++level)
+        {
+            int index = (now >> (BITS * level)) & MASK;
+            WheelTimer* list = wheel[level][index];
+
+            wheel[level][index] = 0;
+            while (list)
+            {
+                WheelTimer* timer = list;
+
+                list = timer->next;
+                add(timer);
+            }
+            if (index != 0)
+                break;
+        }
+    }
+
+    WheelTimer* wheel[LEVELS][SLOTS];
+    unsigned long now;          // the next tick for run() to handle
+    int armed;
+};
+
+#endif
@@ -28,7 +28,7 @@ public:
         iface.setTimeout(1000);    // 1 second Timeout 
     }
     
-    int connect(char* hostname, int port)
+    int connect(const char* hostname, int port)
     {
         return iface.connect(hostname, port);
     }
@@ -38,14 +38,32 @@ public:
         return iface.connect(hostname, port);
     }
 
-    int read(char* buffer, int len, int timeout)
+    int available()
     {
-        iface.setTimeout(timeout);
-        while(!iface.available());
-        return iface.readBytes(buffer, len);
+        return iface.available();
+    }
+
+    /** Read len bytes, waiting until they have all arrived or timeout ms have passed
+     *  @return the number of bytes read, which is less than len if the time ran out first, or -1 if
+     *  none arrived
+     */
+    int read(unsigned char* buffer, int len, int timeout)
+    {
+        int rc = 0;
+
+        if (iface.available() >= len)
+            rc = iface.read(buffer, len);       // all there already, in one read
+        if (rc < 0)
+            rc = 0;
+        if (rc < len)
+        {
+            iface.setTimeout((timeout > 0) ? timeout : 0);
+            rc += iface.readBytes((char*)&buffer[rc], len - rc);
+        }
+        return (rc > 0) ? rc : -1;
     }
     
-    int write(char* buffer, int len, int timeout)
+    int write(unsigned char* buffer, int len, int timeout)
     {
         iface.setTimeout(timeout);  
         return iface.write((uint8_t*)buffer, len);
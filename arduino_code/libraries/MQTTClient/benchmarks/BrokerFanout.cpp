@@ -0,0 +1,177 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    host benchmark of the local broker engine
+ *******************************************************************************/
+
+/*
+ * Times the MQTT::Broker engine without sockets: a publish fanned out to 1 to 500 subscribers
+ * of one filter at QoS 0 and 1, and a publish routed to one subscriber among 1 to 2000 devices
+ * which each have their own filter, as in the room network.  The transport only counts bytes.
+ * Built and run on the host, from this directory:
+ *
+ *   for f in ../MQTT*.c; do gcc -O2 -c -I.. $f; done
+ *   g++ -O2 -I.. -I../broker BrokerFanout.cpp MQTT*.o -o BrokerFanout
+ *   ./BrokerFanout
+ *
+ * Output is one CSV line per run: benchmark,param,subscribers,ns_per_publish,publishes_per_s,bytes_out
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTBroker.h"
+
+#define PUBLISHER 0
+#define PAYLOAD "{\"d\":{\"device\":\"Arduino Yun\",\"t\":21}}"
+
+struct Counter
+{
+    Counter() : bytes(0) { }
+
+    int write(int /*conn*/, const unsigned char* /*buf*/, int len)
+    {
+        bytes += len;
+        return len;
+    }
+
+    void disconnect(int conn)
+    {
+        fprintf(stderr, "connection %d dropped\n", conn);
+    }
+
+    unsigned long bytes;
+};
+
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static int packet(unsigned char* buf, int buflen, MQTTString topic, int qos)
+{
+    return MQTTSerialize_publish(buf, buflen, 0, qos, 0, 1, topic, (unsigned char*)PAYLOAD, strlen(PAYLOAD));
+}
+
+
+static void connect(MQTT::Broker<Counter>& broker, int conn, const char* filter, int qos)
+{
+    MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
+    MQTTString topicFilter = MQTTString_initializer;
+    unsigned char buf[128];
+    char clientID[32];
+
+    sprintf(clientID, "client-%d", conn);
+    options.clientID.cstring = clientID;
+    broker.opened(conn);
+    broker.received(conn, buf, MQTTSerialize_connect(buf, sizeof(buf), &options));
+    if (filter)
+    {
+        topicFilter.cstring = (char*)filter;
+        broker.received(conn, buf, MQTTSerialize_subscribe(buf, sizeof(buf), 0, 1, 1, &topicFilter, &qos));
+    }
+}
+
+
+// each subscriber acks its QoS 1 deliveries, so the in-flight window never fills
+static void ack(MQTT::Broker<Counter>& broker, int subscribers, unsigned short id)
+{
+    unsigned char buf[4];
+    int len = MQTTSerialize_puback(buf, sizeof(buf), id);
+
+    for (int s = 1; s <= subscribers; ++s)
+        broker.received(s, buf, len);
+}
+
+
+static void fanout(int subscribers, int qos)
+{
+    Counter counter;
+    MQTT::Broker<Counter> broker(counter);
+    MQTTString topic = MQTTString_initializer;
+    unsigned char buf[128];
+    char param[16];
+    long n = 2000000 / subscribers;
+    double start, elapsed = 0;
+    int len;
+
+    connect(broker, PUBLISHER, 0, 0);
+    for (int s = 1; s <= subscribers; ++s)
+        connect(broker, s, "room/+/evt", qos);
+    topic.cstring = (char*)"room/1/evt";
+    len = packet(buf, sizeof(buf), topic, qos);
+
+    counter.bytes = 0;
+    for (long i = 0; i < n; ++i)
+    {
+        start = now_ns();
+        broker.received(PUBLISHER, buf, len);
+        elapsed += now_ns() - start;
+        if (qos > 0)
+            ack(broker, subscribers, (unsigned short)(i % 65535 + 1));
+    }
+    sprintf(param, "qos%d", qos);
+    printf("fanout,%s,%d,%.1f,%.0f,%lu\n", param, subscribers, elapsed / n, n * 1e9 / elapsed, counter.bytes);
+}
+
+
+static void route(int devices)
+{
+    Counter counter;
+    MQTT::Broker<Counter> broker(counter);
+    static unsigned char bufs[2000][128];
+    static int lens[2000];
+    char name[32];
+    long n = 1000000;
+    double start;
+
+    connect(broker, PUBLISHER, 0, 0);
+    for (int d = 1; d <= devices; ++d)
+    {
+        MQTTString topic = MQTTString_initializer;
+
+        sprintf(name, "room/%d/cmd", d);
+        connect(broker, d, name, 0);
+        topic.cstring = name;
+        lens[d - 1] = packet(bufs[d - 1], sizeof(bufs[0]), topic, 0);
+    }
+
+    counter.bytes = 0;
+    start = now_ns();
+    for (long i = 0; i < n; ++i)
+        broker.received(PUBLISHER, bufs[i % devices], lens[i % devices]);
+    double elapsed = now_ns() - start;
+    printf("route,qos0,%d,%.1f,%.0f,%lu\n", devices, elapsed / n, n * 1e9 / elapsed, counter.bytes);
+}
+
+
+int main()
+{
+    static const int subscribers[] = {1, 10, 100, 500};
+    static const int devices[] = {1, 10, 100, 1000, 2000};
+
+    printf("benchmark,param,subscribers,ns_per_publish,publishes_per_s,bytes_out\n");
+    for (unsigned int s = 0; s < sizeof(subscribers) / sizeof(subscribers[0]); ++s)
+    {
+        fanout(subscribers[s], 0);
+        fanout(subscribers[s], 1);
+    }
+    for (unsigned int d = 0; d < sizeof(devices) / sizeof(devices[0]); ++d)
+        route(devices[d]);
+    return 0;
+}
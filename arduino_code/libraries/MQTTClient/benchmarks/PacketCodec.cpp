@@ -0,0 +1,229 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    host benchmark of the MQTTPacket codec
+ *******************************************************************************/
+
+/*
+ * Times the C serializers and deserializers the clients use for every packet: publish with
+ * payloads from 0 B to 64 KB, connect, the remaining length varint for each of its 1 to 4 byte
+ * forms, length prefixed strings, and reading a whole packet through MQTTPacket_read.
+ * Built and run on the host, from this directory:
+ *
+ *   for f in ../MQTT*.c; do gcc -O2 -c -I.. $f; done
+ *   g++ -O2 -I.. PacketCodec.cpp MQTT*.o -o PacketCodec
+ *   ./PacketCodec
+ *
+ * Output is one CSV line per run: benchmark,param,bytes,ns_per_packet,packets_per_s,check
+ * where bytes is the length of the packet or field handled and check is a sum of the results,
+ * printed so that the work cannot be optimised away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTPacket.h"
+
+#define MAX_PAYLOAD 65536
+#define BUFSIZE (MAX_PAYLOAD + 128)
+#define TOPIC "iot-2/evt/status/fmt/json"
+#define WORK 200000000L     // bytes handled per run, to keep each run about as long as the others
+
+static unsigned char buf[BUFSIZE];
+static unsigned char payload[MAX_PAYLOAD];
+
+// the reader MQTTPacket_decode and MQTTPacket_read pull bytes from
+static unsigned char* readptr;
+
+static int getbytes(unsigned char* c, int count)
+{
+    memcpy(c, readptr, count);
+    readptr += count;
+    return count;
+}
+
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static long iterations(int bytes)
+{
+    long n = WORK / (bytes + 64);
+    return (n > 1000000) ? 1000000 : (n < 200) ? 200 : n;
+}
+
+
+static void report(const char* benchmark, const char* param, int bytes, long n, double start, long check)
+{
+    double ns = (now_ns() - start) / n;
+    printf("%s,%s,%d,%.1f,%.0f,%ld\n", benchmark, param, bytes, ns, 1e9 / ns, check);
+}
+
+
+static void publish(int payloadlen, int qos)
+{
+    MQTTString topic = MQTTString_initializer;
+    char param[32];
+    long n, check;
+    double start;
+    int len;
+
+    topic.cstring = (char*)TOPIC;
+    sprintf(param, "qos%d/%d", qos, payloadlen);
+    len = MQTTSerialize_publish(buf, BUFSIZE, 0, qos, 0, 1, topic, payload, payloadlen);
+    n = iterations(len);
+
+    check = 0;
+    start = now_ns();
+    for (long i = 0; i < n; ++i)
+        check += MQTTSerialize_publish(buf, BUFSIZE, 0, qos, 0, (unsigned short)(i | 1), topic, payload, payloadlen);
+    report("serialize_publish", param, len, n, start, check);
+
+    check = 0;
+    start = now_ns();
+    for (long i = 0; i < n; ++i)
+    {
+        unsigned char dup, retained;
+        unsigned short packetid;
+        int rqos, rlen;
+        unsigned char* rpayload;
+        MQTTString rtopic;
+
+        if (MQTTDeserialize_publish(&dup, &rqos, &retained, &packetid, &rtopic, &rpayload, &rlen, buf, len) == 1)
+            check += rlen + rtopic.lenstring.len;
+    }
+    report("deserialize_publish", param, len, n, start, check);
+
+    check = 0;
+    start = now_ns();
+    for (long i = 0; i < n; ++i)
+    {
+        readptr = buf;
+        check += MQTTPacket_read(buf, BUFSIZE, getbytes);
+    }
+    report("packet_read", param, len, n, start, check);
+}
+
+
+static void connect()
+{
+    MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
+    long n, check;
+    double start;
+    int len;
+
+    options.clientID.cstring = (char*)"d:3gyk83:arduinoyun:Arduino_Yun";
+    options.username.cstring = (char*)"use-token-auth";
+    options.password.cstring = (char*)"Uo?vI2T(vUNR?&o-NO";
+    options.keepAliveInterval = 10;
+    len = MQTTSerialize_connect(buf, BUFSIZE, &options);
+    n = iterations(len);
+
+    check = 0;
+    start = now_ns();
+    for (long i = 0; i < n; ++i)
+        check += MQTTSerialize_connect(buf, BUFSIZE, &options);
+    report("serialize_connect", "user+password", len, n, start, check);
+}
+
+
+// the smallest and largest remaining lengths of each varint size
+static void remainingLength()
+{
+    static const int values[] = {0, 127, 128, 16383, 16384, 2097151, 2097152, 268435455};
+    unsigned char enc[4];
+    char param[32];
+
+    for (unsigned int v = 0; v < sizeof(values) / sizeof(values[0]); ++v)
+    {
+        int len = MQTTPacket_encode(enc, values[v]);
+        long n = 20000000;
+        long check;
+        double start;
+
+        sprintf(param, "%d", values[v]);
+        check = 0;
+        start = now_ns();
+        for (long i = 0; i < n; ++i)
+            check += MQTTPacket_encode(buf, values[v]);
+        report("encode_remaining_length", param, len, n, start, check);
+
+        memcpy(buf, enc, len);
+        check = 0;
+        start = now_ns();
+        for (long i = 0; i < n; ++i)
+        {
+            int value;
+
+            readptr = buf;
+            MQTTPacket_decode(getbytes, &value);
+            check += value;
+        }
+        report("decode_remaining_length", param, len, n, start, check);
+    }
+}
+
+
+static void lenString()
+{
+    static const int lengths[] = {0, 25, 255, 4096, 65535};
+    char param[32];
+
+    for (unsigned int l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l)
+    {
+        unsigned char* ptr = buf;
+        long n = iterations(lengths[l] + 2);
+        long check;
+        double start;
+
+        writeInt(&ptr, lengths[l]);
+        memset(ptr, 's', lengths[l]);
+        sprintf(param, "%d", lengths[l]);
+        check = 0;
+        start = now_ns();
+        for (long i = 0; i < n; ++i)
+        {
+            MQTTString s;
+
+            ptr = buf;
+            if (readMQTTLenString(&s, &ptr, buf + lengths[l] + 2))
+                check += s.lenstring.len;
+        }
+        report("read_len_string", param, lengths[l] + 2, n, start, check);
+    }
+}
+
+
+int main()
+{
+    static const int sizes[] = {0, 16, 64, 100, 1024, 4096, 16384, MAX_PAYLOAD};
+
+    memset(payload, 'p', MAX_PAYLOAD);
+    printf("benchmark,param,bytes,ns_per_packet,packets_per_s,check\n");
+    for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        publish(sizes[s], 0);
+        publish(sizes[s], 1);
+    }
+    connect();
+    remainingLength();
+    lenString();
+    return 0;
+}
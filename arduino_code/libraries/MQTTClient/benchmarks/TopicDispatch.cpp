@@ -0,0 +1,229 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    host benchmark of incoming publish dispatch
+ *******************************************************************************/
+
+/*
+ * Compares the linear scan of MQTT::Client::deliverMessage (MQTTPacket_equals followed by
+ * isTopicMatched for every handler) with MQTT::TopicTrie, for 5, 50 and 500 subscriptions.
+ * Then, for the sketch's one command filter, compares a handler table slot called through FP
+ * with the same handler bound at compile time as an MQTT::Route.
+ * Built and run on the host, from this directory:
+ *
+ *   gcc -O2 -c -I.. ../MQTTPacket.c
+ *   g++ -O2 -I.. TopicDispatch.cpp MQTTPacket.o -o TopicDispatch
+ *   ./TopicDispatch
+ *
+ * Output is one CSV line per run: benchmark,filters,ns_per_msg,matches
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTClient.h"
+#include "MQTTTopicTrie.h"
+
+#define MAX_FILTERS 500
+#define TOPICS 64
+#define ITERATIONS 200000
+
+static char filters[MAX_FILTERS][48];
+static char topics[TOPICS][48];
+
+
+// the matcher from MQTT::Client::isTopicMatched
+static bool isTopicMatched(char* topicFilter, MQTTString& topicName)
+{
+    char* curf = topicFilter;
+    char* curn = topicName.lenstring.data;
+    char* curn_end = curn + topicName.lenstring.len;
+
+    while (*curf && curn < curn_end)
+    {
+        if (*curn == '/' && *curf != '/')
+            break;
+        if (*curf != '+' && *curf != '#' && *curf != *curn)
+            break;
+        if (*curf == '+')
+        {   // skip until we meet the next separator, or end of string
+            char* nextpos = curn + 1;
+            while (nextpos < curn_end && *nextpos != '/')
+                nextpos = ++curn + 1;
+        }
+        else if (*curf == '#')
+            curn = curn_end - 1;    // skip until end of string
+        curf++;
+        curn++;
+    };
+
+    return (curn == curn_end) && (*curf == '\0');
+}
+
+
+static int linear(int count, MQTTString& topicName)
+{
+    int matches = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (MQTTPacket_equals(&topicName, filters[i]) || isTopicMatched(filters[i], topicName))
+            ++matches;
+    }
+    return matches;
+}
+
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// a mix of exact, '+' and '#' filters over a room/device/reading hierarchy
+static void makeFilters()
+{
+    for (int i = 0; i < MAX_FILTERS; ++i)
+    {
+        switch (i % 4)
+        {
+            case 0: sprintf(filters[i], "iot-2/room%d/cmd/light", i / 4); break;
+            case 1: sprintf(filters[i], "iot-2/room%d/cmd/+", i / 4); break;
+            case 2: sprintf(filters[i], "iot-2/room%d/evt/+/fmt/json", i / 4); break;
+            case 3: sprintf(filters[i], "iot-2/room%d/status/#", i / 4); break;
+        }
+    }
+    for (int i = 0; i < TOPICS; ++i)
+    {
+        switch (i % 3)
+        {
+            case 0: sprintf(topics[i], "iot-2/room%d/cmd/light", i % 7); break;
+            case 1: sprintf(topics[i], "iot-2/room%d/evt/status/fmt/json", i % 5); break;
+            case 2: sprintf(topics[i], "iot-2/room%d/status/a/b", i % 11); break;
+        }
+    }
+}
+
+
+template<int NODES>
+static void run(int count)
+{
+    static MQTT::TopicTrie<NODES> trie;
+    MQTTString names[TOPICS];
+    int values[MAX_FILTERS];
+    long matches;
+    double start;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (!trie.insert(filters[i], i))
+        {
+            fprintf(stderr, "node pool too small for %d filters\n", count);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < TOPICS; ++i)
+    {
+        names[i].cstring = 0;
+        names[i].lenstring.data = topics[i];
+        names[i].lenstring.len = strlen(topics[i]);
+    }
+
+    matches = 0;
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; ++i)
+        matches += linear(count, names[i % TOPICS]);
+    printf("linear,%d,%.1f,%ld\n", count, (now_ns() - start) / ITERATIONS, matches);
+
+    matches = 0;
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; ++i)
+        matches += trie.match(names[i % TOPICS], values, MAX_FILTERS);
+    printf("trie,%d,%.1f,%ld\n", count, (now_ns() - start) / ITERATIONS, matches);
+}
+
+
+static long delivered;
+
+static void onCommand(MQTT::MessageData& md)
+{
+    delivered += md.message.qos + 1;
+}
+
+extern const char commandFilter[] = "iot-2/cmd/+/fmt/json";
+
+
+// one subscription, as in the sketch: the handler table with its FP, and the same filter as a route
+static void bound()
+{
+    static const char* commands[] = {"iot-2/cmd/light/fmt/json", "iot-2/cmd/fan/fmt/json", "iot-2/evt/status/fmt/json"};
+    struct
+    {
+        const char* topicFilter;
+        FP<void, MQTT::MessageData&> fp;
+    } messageHandlers[1];
+    MQTTString names[3];
+    MQTT::Message message = {MQTT::QOS0, false, false, 0, 0, 0};
+    double start;
+
+    messageHandlers[0].topicFilter = commandFilter;
+    messageHandlers[0].fp.attach(onCommand);
+    for (int i = 0; i < 3; ++i)
+    {
+        names[i].cstring = 0;
+        names[i].lenstring.data = (char*)commands[i];
+        names[i].lenstring.len = strlen(commands[i]);
+    }
+
+    delivered = 0;
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS * 10; ++i)
+    {
+        MQTTString& topicName = names[i % 3];
+        for (int j = 0; j < 1; ++j)
+        {
+            if (messageHandlers[j].topicFilter != 0 && (MQTTPacket_equals(&topicName, (char*)messageHandlers[j].topicFilter) ||
+                    isTopicMatched((char*)messageHandlers[j].topicFilter, topicName)))
+            {
+                MQTT::MessageData md(topicName, message);
+                messageHandlers[j].fp(md);
+            }
+        }
+    }
+    printf("fp_table,1,%.1f,%ld\n", (now_ns() - start) / (ITERATIONS * 10), delivered);
+
+    delivered = 0;
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS * 10; ++i)
+    {
+        MQTT::MessageData md(names[i % 3], message);
+        MQTT::Route<commandFilter, onCommand>::deliver(names[i % 3], md);
+    }
+    printf("route,1,%.1f,%ld\n", (now_ns() - start) / (ITERATIONS * 10), delivered);
+}
+
+
+int main()
+{
+    makeFilters();
+    printf("benchmark,filters,ns_per_msg,matches\n");
+    run<5 * 6 + 1>(5);
+    run<50 * 6 + 1>(50);
+    run<500 * 6 + 1>(500);
+    bound();
+    return 0;
+}
@@ -0,0 +1,305 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    TCP front end for the local broker
+ *******************************************************************************/
+
+/*
+ * A local MQTT broker for the room network, to run on the Linux side of the Yun or on any
+ * Linux board, so that the room's devices and controllers talk to each other without the
+ * round trip to the cloud broker.  One thread polls non-blocking sockets and feeds the
+ * MQTT::Broker engine.  Built from this directory:
+ *
+ *   for f in ../MQTT*.c; do gcc -O2 -c -I.. $f; done
+ *   g++ -O2 -I.. BrokerMain.cpp MQTT*.o -o mqttbroker
+ *   ./mqttbroker [-p port] [-s stats_interval_s]
+ *
+ * With -s, a CSV line of the engine's counters is printed to stdout at each interval:
+ * time_s,connections,sessions,retained,packets_in,packets_out,published,delivered,queued,dropped
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <vector>
+
+#include "MQTTBroker.h"
+
+#define DEFAULT_PORT 1883
+#define READ_SIZE 16384
+#define MAX_OUTPUT (4 * 1024 * 1024)    // a client this far behind is disconnected
+
+static unsigned long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * Holds each connection's output until its socket can take it, and closes connections the
+ * engine has finished with once their output is written.
+ */
+class Sockets
+{
+public:
+
+    struct Output
+    {
+        std::vector<unsigned char> data;
+        size_t sent;
+        bool closing;
+    };
+
+    int write(int conn, const unsigned char* buf, int len)
+    {
+        Output& o = out[conn];
+
+        if (o.closing)
+            return -1;
+        if (o.data.size() - o.sent + len > MAX_OUTPUT)
+        {
+            o.closing = true;
+            o.data.clear();
+            o.sent = 0;
+            lagging.push_back(conn);
+            return -1;
+        }
+        o.data.insert(o.data.end(), buf, buf + len);
+        return len;
+    }
+
+    void disconnect(int conn)
+    {
+        out[conn].closing = true;
+    }
+
+    // write what a socket will take, and close it if it is finished with
+    void flush(int fd)
+    {
+        Output& o = out[fd];
+
+        while (o.sent < o.data.size())
+        {
+            ssize_t rc = send(fd, &o.data[o.sent], o.data.size() - o.sent, MSG_NOSIGNAL);
+
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                break;
+            if (rc <= 0)
+            {
+                o.data.clear();
+                o.sent = 0;
+                o.closing = true;
+                break;
+            }
+            o.sent += rc;
+        }
+        if (o.sent == o.data.size())
+        {
+            o.data.clear();
+            o.sent = 0;
+        }
+        else if (o.sent > READ_SIZE)
+        {
+            o.data.erase(o.data.begin(), o.data.begin() + o.sent);
+            o.sent = 0;
+        }
+        if (o.closing && o.data.empty())
+        {
+            close(fd);
+            out.erase(fd);
+        }
+    }
+
+    bool pending(int fd)
+    {
+        return out[fd].sent < out[fd].data.size();
+    }
+
+    bool closing(int fd)
+    {
+        return out[fd].closing;
+    }
+
+    void opened(int fd)
+    {
+        Output& o = out[fd];
+
+        o.data.clear();
+        o.sent = 0;
+        o.closing = false;
+    }
+
+    std::map<int, Output> out;
+    std::vector<int> lagging;       // connections dropped for falling behind, for the engine to forget
+};
+
+
+static int listenOn(int port)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 256) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+
+int main(int argc, char** argv)
+{
+    int port = DEFAULT_PORT;
+    int statsInterval = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:")) != -1)
+    {
+        if (opt == 'p')
+            port = atoi(optarg);
+        else if (opt == 's')
+            statsInterval = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "usage: %s [-p port] [-s stats_interval_s]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int listener = listenOn(port);
+    if (listener < 0)
+    {
+        perror("listen");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Sockets sockets;
+    MQTT::Broker<Sockets> broker(sockets);
+    static unsigned char buf[READ_SIZE];
+    std::vector<struct pollfd> fds;
+    unsigned long start = now_ms();
+    unsigned long nextStats = start + statsInterval * 1000UL;
+
+    if (statsInterval > 0)
+        printf("time_s,connections,sessions,retained,packets_in,packets_out,published,delivered,queued,dropped\n");
+    fprintf(stderr, "mqttbroker listening on port %d\n", port);
+
+    while (true)
+    {
+        std::map<int, Sockets::Output>::iterator it;
+        struct pollfd p;
+
+        fds.clear();
+        p.fd = listener;
+        p.events = POLLIN;
+        p.revents = 0;
+        fds.push_back(p);
+        for (it = sockets.out.begin(); it != sockets.out.end(); ++it)
+        {
+            p.fd = it->first;
+            p.events = (it->second.closing ? 0 : POLLIN) | (sockets.pending(it->first) ? POLLOUT : 0);
+            fds.push_back(p);
+        }
+
+        if (poll(&fds[0], fds.size(), 100) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return 1;
+        }
+        broker.tick(now_ms());
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd;
+
+            while ((fd = accept(listener, 0, 0)) >= 0)
+            {
+                int on = 1;
+
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                sockets.opened(fd);
+                broker.opened(fd);
+            }
+        }
+
+        for (unsigned int i = 1; i < fds.size(); ++i)
+        {
+            int fd = fds[i].fd;
+
+            if (sockets.out.count(fd) == 0 || sockets.closing(fd))
+                continue;
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t rc = recv(fd, buf, sizeof(buf), 0);
+
+                if (rc > 0)
+                    broker.received(fd, buf, rc);
+                else if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                {
+                    broker.closed(fd);
+                    sockets.disconnect(fd);
+                }
+            }
+        }
+
+        while (!sockets.lagging.empty())
+        {
+            broker.closed(sockets.lagging.back());
+            sockets.lagging.pop_back();
+        }
+
+        // write everything produced this round, a socket at a time
+        std::vector<int> open;
+        for (it = sockets.out.begin(); it != sockets.out.end(); ++it)
+            open.push_back(it->first);
+        for (unsigned int i = 0; i < open.size(); ++i)
+            sockets.flush(open[i]);
+
+        if (statsInterval > 0 && (long)(now_ms() - nextStats) >= 0)
+        {
+            MQTT::Broker<Sockets>::Stats& s = broker.stats;
+
+            printf("%lu,%d,%d,%d,%lu,%lu,%lu,%lu,%lu,%lu\n", (now_ms() - start) / 1000, broker.connectionCount(),
+                    broker.sessionCount(), broker.retainedCount(), s.packetsIn, s.packetsOut, s.published,
+                    s.delivered, s.queued, s.dropped);
+            fflush(stdout);
+            nextStats += statsInterval * 1000UL;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,419 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    load generator for the local broker
+ *******************************************************************************/
+
+/*
+ * Simulates a room network against a broker: each device publishes telemetry to room/<n>/evt
+ * and listens for commands on room/<n>/cmd, and one controller subscribes to room/+/evt and
+ * sends commands back to the devices.  Every payload starts with the time it was sent, so the
+ * receiver measures the latency through the broker.  Built from this directory:
+ *
+ *   for f in ../MQTT*.c; do gcc -O2 -c -I.. $f; done
+ *   g++ -O2 -I.. LoadGen.cpp MQTT*.o -o mqttload
+ *   ./mqttload [-h host] [-p port] [-n devices] [-r publishes_per_s_per_device]
+ *              [-c commands_per_s] [-d duration_s] [-q qos] [-s payload_bytes]
+ *
+ * Output is a CSV line for each stream, telemetry and command:
+ * stream,devices,qos,payload,sent,received,msgs_per_s,p50_us,p99_us,max_us
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "MQTTPacket.h"
+
+#define READ_SIZE 16384
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+struct Stream
+{
+    const char* name;
+    long sent;
+    std::vector<double> latencies;
+};
+
+
+struct Peer
+{
+    int fd;
+    int index;                      // the device number, -1 for the controller
+    bool connected;                 // CONNACK and SUBACK received
+    std::vector<unsigned char> rx;
+    std::vector<unsigned char> tx;
+    unsigned short lastId;
+    double nextPublish;
+};
+
+
+static int qos = 0;
+static int payloadSize = 32;
+static Stream telemetry = {"telemetry", 0, std::vector<double>()};
+static Stream commands = {"command", 0, std::vector<double>()};
+
+
+static int connectTo(const char* host, int port)
+{
+    struct addrinfo hints, *res;
+    char service[16];
+    int fd, on = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf(service, "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0)
+        return -1;
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+    {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+    return fd;
+}
+
+
+static void queue(Peer& p, const unsigned char* buf, int len)
+{
+    if (len > 0)
+        p.tx.insert(p.tx.end(), buf, buf + len);
+}
+
+
+static bool flush(Peer& p)
+{
+    size_t sent = 0;
+
+    while (sent < p.tx.size())
+    {
+        ssize_t rc = send(p.fd, &p.tx[sent], p.tx.size() - sent, MSG_NOSIGNAL);
+
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        if (rc <= 0)
+            return false;
+        sent += rc;
+    }
+    p.tx.erase(p.tx.begin(), p.tx.begin() + sent);
+    return true;
+}
+
+
+static void start(Peer& p)
+{
+    MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
+    MQTTString filter = MQTTString_initializer;
+    unsigned char buf[128];
+    char clientID[32], topic[32];
+    int granted = qos;
+
+    if (p.index < 0)
+        strcpy(clientID, "controller");
+    else
+        sprintf(clientID, "device-%d", p.index);
+    options.clientID.cstring = clientID;
+    options.keepAliveInterval = 60;
+    queue(p, buf, MQTTSerialize_connect(buf, sizeof(buf), &options));
+
+    if (p.index < 0)
+        strcpy(topic, "room/+/evt");
+    else
+        sprintf(topic, "room/%d/cmd", p.index);
+    filter.cstring = topic;
+    queue(p, buf, MQTTSerialize_subscribe(buf, sizeof(buf), 0, ++p.lastId, 1, &filter, &granted));
+}
+
+
+static void publish(Peer& p, int target, Stream& stream)
+{
+    std::vector<unsigned char> payload(payloadSize, 'x');
+    std::vector<unsigned char> buf(payloadSize + 64);
+    MQTTString topic = MQTTString_initializer;
+    char name[32];
+    double sent = now_us();
+    unsigned short id = 0;
+
+    memcpy(&payload[0], &sent, sizeof(sent));
+    sprintf(name, (p.index < 0) ? "room/%d/cmd" : "room/%d/evt", target);
+    topic.cstring = name;
+    if (qos > 0)
+    {
+        id = p.lastId = (p.lastId == 65535) ? 1 : p.lastId + 1;
+    }
+    queue(p, &buf[0], MQTTSerialize_publish(&buf[0], buf.size(), 0, qos, 0, id, topic, &payload[0], payloadSize));
+    ++stream.sent;
+}
+
+
+// handle the packets received so far
+static void receive(Peer& p)
+{
+    size_t start = 0;
+
+    while (true)
+    {
+        size_t avail = p.rx.size() - start;
+        int rem_len = 0, multiplier = 1, total = 1;
+        unsigned char byte;
+
+        do
+        {
+            if ((size_t)total >= avail)
+                goto partial;
+            byte = p.rx[start + total++];
+            rem_len += (byte & 127) * multiplier;
+            multiplier *= 128;
+        } while ((byte & 128) != 0);
+        total += rem_len;
+        if ((size_t)total > avail)
+            goto partial;
+
+        {
+            unsigned char* packet = &p.rx[start];
+            MQTTHeader header = {0};
+
+            header.byte = packet[0];
+            if (header.bits.type == SUBACK)
+                p.connected = true;
+            else if (header.bits.type == PUBLISH)
+            {
+                unsigned char dup, retained;
+                unsigned short id;
+                int rqos, payloadlen;
+                unsigned char* payload;
+                MQTTString topic;
+                double sent;
+
+                if (MQTTDeserialize_publish(&dup, &rqos, &retained, &id, &topic, &payload, &payloadlen, packet, total) == 1 &&
+                        payloadlen >= (int)sizeof(sent))
+                {
+                    memcpy(&sent, payload, sizeof(sent));
+                    ((p.index < 0) ? telemetry : commands).latencies.push_back(now_us() - sent);
+                    if (rqos == 1)
+                    {
+                        unsigned char ack[4];
+                        queue(p, ack, MQTTSerialize_puback(ack, sizeof(ack), id));
+                    }
+                }
+            }
+        }
+        start += total;
+    }
+
+partial:
+    p.rx.erase(p.rx.begin(), p.rx.begin() + start);
+}
+
+
+static double percentile(std::vector<double>& v, double pc)
+{
+    if (v.empty())
+        return 0;
+    size_t i = (size_t)(pc * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+
+static void report(Stream& s, int devices, double seconds)
+{
+    double p50 = percentile(s.latencies, 0.50);
+    double p99 = percentile(s.latencies, 0.99);
+    double max = s.latencies.empty() ? 0 : *std::max_element(s.latencies.begin(), s.latencies.end());
+
+    printf("%s,%d,%d,%d,%ld,%lu,%.0f,%.0f,%.0f,%.0f\n", s.name, devices, qos, payloadSize, s.sent,
+            (unsigned long)s.latencies.size(), s.latencies.size() / seconds, p50, p99, max);
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* host = "127.0.0.1";
+    int port = 1883;
+    int devices = 200;
+    double rate = 1;            // publishes per second from each device
+    double commandRate = 50;    // commands per second from the controller
+    double duration = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:r:c:d:q:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': devices = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'c': commandRate = atof(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'q': qos = atoi(optarg); break;
+            case 's': payloadSize = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-n devices] [-r rate] [-c command_rate] "
+                        "[-d duration_s] [-q qos] [-s payload_bytes]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (payloadSize < (int)sizeof(double))
+        payloadSize = sizeof(double);
+    if (qos < 0 || qos > 1)
+    {
+        fprintf(stderr, "qos must be 0 or 1\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // the controller is peers[devices]
+    std::vector<Peer> peers(devices + 1);
+    for (int i = 0; i <= devices; ++i)
+    {
+        Peer& p = peers[i];
+
+        p.index = (i < devices) ? i : -1;
+        p.connected = false;
+        p.lastId = 0;
+        if ((p.fd = connectTo(host, port)) < 0)
+        {
+            fprintf(stderr, "cannot connect to %s:%d: %s\n", host, port, strerror(errno));
+            return 1;
+        }
+        start(p);
+    }
+
+    // wait for every subscription, so that nothing sent is lost to a late one
+    std::vector<struct pollfd> fds(peers.size());
+    static unsigned char buf[READ_SIZE];
+    double started = now_us(), ended = 0;
+    double stopAt = 0, nextCommand = 0;
+    int ready = 0, target = 0;
+    bool running = false;
+
+    while (true)
+    {
+        double now = now_us();
+
+        if (!running && ready == (int)peers.size())
+        {
+            running = true;
+            started = now;
+            stopAt = now + duration * 1e6;
+            nextCommand = now;
+            for (int i = 0; i < devices; ++i)
+                peers[i].nextPublish = now + 1e6 / rate * i / devices;    // spread over the first period
+        }
+        if (running && now >= stopAt && ended == 0)
+            ended = now;
+        if (ended > 0 && now - ended > 500000)
+            break;      // half a second for the last deliveries
+
+        if (running && ended == 0)
+        {
+            for (int i = 0; i < devices; ++i)
+            {
+                while (peers[i].nextPublish <= now)
+                {
+                    publish(peers[i], i, telemetry);
+                    peers[i].nextPublish += 1e6 / rate;
+                }
+            }
+            while (commandRate > 0 && nextCommand <= now)
+            {
+                publish(peers[devices], target, commands);
+                target = (target + 1) % devices;
+                nextCommand += 1e6 / commandRate;
+            }
+        }
+
+        for (unsigned int i = 0; i < peers.size(); ++i)
+        {
+            if (!flush(peers[i]))
+            {
+                fprintf(stderr, "connection %d lost\n", peers[i].index);
+                return 1;
+            }
+            fds[i].fd = peers[i].fd;
+            fds[i].events = POLLIN | (peers[i].tx.empty() ? 0 : POLLOUT);
+            fds[i].revents = 0;
+        }
+        poll(&fds[0], fds.size(), 1);
+
+        for (unsigned int i = 0; i < peers.size(); ++i)
+        {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t rc = recv(peers[i].fd, buf, sizeof(buf), 0);
+            if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                fprintf(stderr, "connection %d closed by the broker\n", peers[i].index);
+                return 1;
+            }
+            if (rc > 0)
+            {
+                bool wasConnected = peers[i].connected;
+
+                peers[i].rx.insert(peers[i].rx.end(), buf, buf + rc);
+                receive(peers[i]);
+                if (!wasConnected && peers[i].connected)
+                    ++ready;
+            }
+        }
+        if (!running && now - started > 30e6)
+        {
+            fprintf(stderr, "only %d of %d clients subscribed\n", ready, (int)peers.size());
+            return 1;
+        }
+    }
+
+    double seconds = (ended - started) / 1e6;
+    printf("stream,devices,qos,payload,sent,received,msgs_per_s,p50_us,p99_us,max_us\n");
+    report(telemetry, devices, seconds);
+    report(commands, devices, seconds);
+
+    unsigned char disconnect[2];
+    for (unsigned int i = 0; i < peers.size(); ++i)
+    {
+        send(peers[i].fd, disconnect, MQTTSerialize_disconnect(disconnect, sizeof(disconnect)), MSG_NOSIGNAL);
+        close(peers[i].fd);
+    }
+    return 0;
+}
@@ -0,0 +1,906 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    local broker engine on the server side codecs
+ *******************************************************************************/
+
+#if !defined(MQTTBROKER_H)
+#define MQTTBROKER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdio.h>
+#include <string.h>
+
+#include "MQTTPacket.h"
+#include "MQTTTopicTrie.h"
+
+#if !defined(MQTTBROKER_TRIE_NODES)
+    #define MQTTBROKER_TRIE_NODES 16384     // index nodes for wildcard filters, one per distinct level, at most 65534
+#endif
+#if !defined(MQTTBROKER_MAX_PACKET_SIZE)
+    #define MQTTBROKER_MAX_PACKET_SIZE (65536 + 512)    // larger packets close the connection
+#endif
+#if !defined(MQTTBROKER_MAX_FILTERS)
+    #define MQTTBROKER_MAX_FILTERS 16       // topic filters in one SUBSCRIBE or UNSUBSCRIBE
+#endif
+#if !defined(MQTTBROKER_MAX_INFLIGHT)
+    #define MQTTBROKER_MAX_INFLIGHT 32      // QoS 1 publishes sent to a client and not yet acknowledged
+#endif
+#if !defined(MQTTBROKER_MAX_QUEUED)
+    #define MQTTBROKER_MAX_QUEUED 256       // QoS 1 publishes held for a client which is offline or has a full window
+#endif
+
+namespace MQTT
+{
+
+
+/**
+ * @class Broker
+ * @brief an MQTT 3.1.1 broker engine for the LAN, built on the server side codecs
+ *
+ * The engine does no I/O of its own.  The transport reports new connections, received bytes and
+ * closed connections, and the engine writes its packets back through the transport, so the same
+ * engine can run behind sockets or, in a test, behind plain buffers.
+ *
+ * It handles CONNECT with clean and persistent sessions, will messages and keepalive timeouts,
+ * SUBSCRIBE and UNSUBSCRIBE, retained messages, and the publish fan-out, which looks the topic
+ * up in a map of the filters without wildcards and in a TopicTrie of those with them.
+ * Publishes are delivered at QoS 0 or 1; QoS 2 is accepted from clients and delivered at QoS 1.  A publish is serialized once for all the subscribers it goes to at each
+ * QoS, and QoS 1 copies only have their packet id filled in.  There is no authentication: the
+ * broker is meant for a trusted room network.
+ *
+ * @param Transport a class with the methods
+ *     int write(int conn, const unsigned char* buf, int len) - queue bytes for a connection
+ *     void disconnect(int conn) - close a connection once its queued bytes are written; the
+ *         engine has forgotten it, so the transport must not report it again
+ */
+template<class Transport>
+class Broker
+{
+public:
+
+    struct Stats
+    {
+        unsigned long packetsIn;
+        unsigned long packetsOut;
+        unsigned long published;    // PUBLISH packets received from clients
+        unsigned long delivered;    // PUBLISH packets sent to subscribers
+        unsigned long queued;       // QoS 1 publishes held back for later
+        unsigned long dropped;      // publishes not delivered because a queue was full
+    };
+
+    Broker(Transport& transport) : transport(transport), now(0), generation(0), autoId(0)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    ~Broker()
+    {
+        typename std::map<int, Connection*>::iterator c;
+        typename std::map<std::string, Session*>::iterator s;
+
+        for (c = connections.begin(); c != connections.end(); ++c)
+            delete c->second;
+        for (s = sessions.begin(); s != sessions.end(); ++s)
+            delete s->second;
+        for (unsigned int i = 0; i < filters.size(); ++i)
+            delete filters[i];
+    }
+
+    /** A client has connected to the network port
+     *  @param conn - the transport's identifier for the connection
+     */
+    void opened(int conn)
+    {
+        Connection* c = new Connection();
+
+        c->id = conn;
+        c->session = 0;
+        c->keepAlive = 0;
+        c->opened = c->lastHeard = now;
+        c->hasWill = false;
+        connections[conn] = c;
+    }
+
+    /** Bytes have arrived on a connection.  They are parsed into packets, and anything partial
+     *  is kept for the next call.
+     */
+    void received(int conn, const unsigned char* data, int len)
+    {
+        typename std::map<int, Connection*>::iterator it = connections.find(conn);
+        Connection* c;
+        size_t start = 0;
+
+        if (it == connections.end())
+            return;
+        c = it->second;
+        c->rx.insert(c->rx.end(), data, data + len);
+        c->lastHeard = now;
+
+        while (true)
+        {
+            size_t avail = c->rx.size() - start;
+            int rem_len = 0;
+            int multiplier = 1;
+            int total = 1;
+            unsigned char byte;
+
+            do
+            {
+                if (total > 4)
+                {
+                    drop(c, true);      // malformed remaining length
+                    return;
+                }
+                if ((size_t)total >= avail)
+                    goto partial;
+                byte = c->rx[start + total++];
+                rem_len += (byte & 127) * multiplier;
+                multiplier *= 128;
+            } while ((byte & 128) != 0);
+
+            total += rem_len;
+            if (total > MQTTBROKER_MAX_PACKET_SIZE)
+            {
+                drop(c, true);
+                return;
+            }
+            if ((size_t)total > avail)
+                goto partial;
+
+            ++stats.packetsIn;
+            if (!handle(c, &c->rx[start], total))
+                return;         // c has been dropped
+            start += total;
+        }
+
+    partial:
+        c->rx.erase(c->rx.begin(), c->rx.begin() + start);
+    }
+
+    /** The network connection has gone.  The client's will is published if it did not send
+     *  DISCONNECT first.
+     */
+    void closed(int conn)
+    {
+        typename std::map<int, Connection*>::iterator it = connections.find(conn);
+
+        if (it != connections.end())
+            end(it->second, true);
+    }
+
+    /** Advance the engine's clock, and close connections which have been silent for one and a
+     *  half keepalive intervals, or which have not sent CONNECT within CONNECT_TIMEOUT_MS.
+     *  @param now_ms - a millisecond clock
+     */
+    void tick(unsigned long now_ms)
+    {
+        std::vector<Connection*> expired;
+        typename std::map<int, Connection*>::iterator it;
+
+        now = now_ms;
+        for (it = connections.begin(); it != connections.end(); ++it)
+        {
+            Connection* c = it->second;
+
+            if (c->session == 0 && now - c->opened > CONNECT_TIMEOUT_MS)
+                expired.push_back(c);
+            else if (c->keepAlive > 0 && now - c->lastHeard > c->keepAlive * 1500UL)
+                expired.push_back(c);
+        }
+        for (unsigned int i = 0; i < expired.size(); ++i)
+            drop(expired[i], true);
+    }
+
+    int connectionCount()
+    {
+        return connections.size();
+    }
+
+    int sessionCount()
+    {
+        return sessions.size();
+    }
+
+    int retainedCount()
+    {
+        return retained.size();
+    }
+
+    Stats stats;
+
+    enum { CONNECT_TIMEOUT_MS = 10000 };
+
+private:
+
+    struct Session
+    {
+        std::string clientID;
+        int conn;                                       // -1 while offline
+        bool clean;
+        unsigned short lastId;
+        std::map<std::string, int> subscriptions;       // filter -> granted QoS
+        std::map<unsigned short, std::string> inflight; // QoS 1 publishes awaiting PUBACK
+        std::deque<std::string> queue;                  // QoS 1 publishes not sent yet, packet id 0
+        std::set<unsigned short> incomingQoS2;          // awaiting PUBREL
+        unsigned long generation;                       // the fan-out which last found this session
+        int qos;                                        // and the highest QoS it matched with
+    };
+
+    struct Connection
+    {
+        int id;
+        Session* session;               // 0 until CONNECT
+        std::vector<unsigned char> rx;  // a partially received packet
+        unsigned int keepAlive;
+        unsigned long opened;
+        unsigned long lastHeard;
+        bool hasWill;
+        std::string willTopic;
+        std::string willPayload;
+        int willQoS;
+        bool willRetained;
+    };
+
+    struct Filter
+    {
+        std::string text;               // the trie points into this
+        std::vector<std::pair<Session*, int> > subscribers;
+    };
+
+    struct Retained
+    {
+        std::string payload;
+        int qos;
+    };
+
+    static std::string str(MQTTString& s)
+    {
+        if (s.lenstring.data)
+            return std::string(s.lenstring.data, s.lenstring.len);
+        return (s.cstring) ? std::string(s.cstring) : std::string();
+    }
+
+    void send(int conn, const unsigned char* buf, int len)
+    {
+        ++stats.packetsOut;
+        transport.write(conn, buf, len);
+    }
+
+    // returns false if c was dropped
+    bool handle(Connection* c, unsigned char* buf, int len)
+    {
+        MQTTHeader header = {0};
+        unsigned char out[8];
+        unsigned char packettype, dup;
+        unsigned short id;
+
+        header.byte = buf[0];
+        if (c->session == 0 && header.bits.type != CONNECT)
+        {
+            drop(c, false);
+            return false;
+        }
+
+        switch (header.bits.type)
+        {
+            case CONNECT:
+                return connect(c, buf, len);
+            case SUBSCRIBE:
+                return subscribe(c, buf, len);
+            case UNSUBSCRIBE:
+                return unsubscribe(c, buf, len);
+            case PUBLISH:
+                return publish(c, buf, len);
+            case PUBACK:
+                if (MQTTDeserialize_ack(&packettype, &dup, &id, buf, len) != 1)
+                    break;
+                c->session->inflight.erase(id);
+                pump(c->session);
+                return true;
+            case PUBREL:
+                if (MQTTDeserialize_ack(&packettype, &dup, &id, buf, len) != 1)
+                    break;
+                c->session->incomingQoS2.erase(id);
+                send(c->id, out, MQTTSerialize_pubcomp(out, sizeof(out), id));
+                return true;
+            case PINGREQ:
+                out[0] = 0xD0;  // PINGRESP
+                out[1] = 0;
+                send(c->id, out, 2);
+                return true;
+            case DISCONNECT:
+                c->hasWill = false;
+                drop(c, false);
+                return false;
+        }
+        drop(c, true);      // a malformed packet, or one a client must not send
+        return false;
+    }
+
+    bool connect(Connection* c, unsigned char* buf, int len)
+    {
+        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+        unsigned char out[4];
+        std::string clientID;
+        Session* session;
+        bool present = false;
+
+        if (c->session)
+        {
+            drop(c, true);  // a second CONNECT is a protocol violation
+            return false;
+        }
+        data.MQTTVersion = 0;
+        if (MQTTDeserialize_connect(&data, buf, len) != 1)
+        {
+            if (data.MQTTVersion != 0 && data.MQTTVersion != 3 && data.MQTTVersion != 4)
+                send(c->id, out, MQTTSerialize_connack(out, sizeof(out), 1, 0));   // unacceptable protocol version
+            drop(c, false);
+            return false;
+        }
+
+        clientID = str(data.clientID);
+        if (clientID.empty())
+        {
+            char id[32];
+
+            if (!data.cleansession)
+            {
+                send(c->id, out, MQTTSerialize_connack(out, sizeof(out), 2, 0));   // identifier rejected
+                drop(c, false);
+                return false;
+            }
+            sprintf(id, "auto-%lu", ++autoId);
+            clientID = id;
+        }
+
+        typename std::map<std::string, Session*>::iterator it = sessions.find(clientID);
+        if (it != sessions.end())
+        {
+            session = it->second;
+            if (session->conn >= 0)
+                drop(connections[session->conn], true);     // the new connection takes the session over
+            if ((it = sessions.find(clientID)) == sessions.end())
+                session = 0;        // it was a clean session, and has gone with the old connection
+            else if (data.cleansession)
+            {
+                removeSession(session);
+                session = 0;
+            }
+            else
+                present = true;
+        }
+        else
+            session = 0;
+        if (session == 0)
+        {
+            session = new Session();
+            session->clientID = clientID;
+            session->lastId = 0;
+            session->generation = 0;
+            session->qos = 0;
+            sessions[clientID] = session;
+        }
+        session->clean = data.cleansession;
+        session->conn = c->id;
+
+        c->session = session;
+        c->keepAlive = data.keepAliveInterval;
+        c->hasWill = data.willFlag;
+        if (c->hasWill)
+        {
+            c->willTopic = str(data.will.topicName);
+            c->willPayload = str(data.will.message);
+            c->willQoS = data.will.qos;
+            c->willRetained = data.will.retained;
+        }
+
+        send(c->id, out, MQTTSerialize_connack(out, sizeof(out), 0, present));
+
+        // a resumed session gets its unacknowledged publishes again, then what was queued
+        std::map<unsigned short, std::string>::iterator f;
+        for (f = session->inflight.begin(); f != session->inflight.end(); ++f)
+        {
+            f->second[0] |= 0x08;   // dup
+            send(c->id, (unsigned char*)f->second.data(), f->second.size());
+        }
+        pump(session);
+        return true;
+    }
+
+    bool subscribe(Connection* c, unsigned char* buf, int len)
+    {
+        MQTTString topicFilters[MQTTBROKER_MAX_FILTERS];
+        int requested[MQTTBROKER_MAX_FILTERS];
+        int granted[MQTTBROKER_MAX_FILTERS];
+        unsigned char out[8 + MQTTBROKER_MAX_FILTERS];
+        unsigned char dup;
+        unsigned short id;
+        int count = 0;
+
+        if (MQTTDeserialize_subscribe(&dup, &id, MQTTBROKER_MAX_FILTERS, &count, topicFilters, requested, buf, len) != 1 ||
+                count == 0)
+        {
+            drop(c, true);
+            return false;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            std::string filter = str(topicFilters[i]);
+
+            if (requested[i] < 0 || requested[i] > 2 || !validFilter(filter) ||
+                    !addSubscription(c->session, filter, (requested[i] > 1) ? 1 : requested[i]))
+                granted[i] = 0x80;
+            else
+                granted[i] = (requested[i] > 1) ? 1 : requested[i];
+        }
+        send(c->id, out, MQTTSerialize_suback(out, sizeof(out), id, count, granted));
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (granted[i] != 0x80)
+                sendRetained(c->session, str(topicFilters[i]), granted[i]);
+        }
+        return true;
+    }
+
+    bool unsubscribe(Connection* c, unsigned char* buf, int len)
+    {
+        MQTTString topicFilters[MQTTBROKER_MAX_FILTERS];
+        unsigned char out[4];
+        unsigned char dup;
+        unsigned short id;
+        int count = 0;
+
+        if (MQTTDeserialize_unsubscribe(&dup, &id, MQTTBROKER_MAX_FILTERS, &count, topicFilters, buf, len) != 1)
+        {
+            drop(c, true);
+            return false;
+        }
+        for (int i = 0; i < count; ++i)
+            removeSubscription(c->session, str(topicFilters[i]));
+        send(c->id, out, MQTTSerialize_unsuback(out, sizeof(out), id));
+        return true;
+    }
+
+    bool publish(Connection* c, unsigned char* buf, int len)
+    {
+        MQTTString topicName = MQTTString_initializer;
+        unsigned char* payload;
+        int payloadlen;
+        unsigned char dup, retained;
+        unsigned short id;
+        int qos;
+        unsigned char out[4];
+
+        if (MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topicName, &payload, &payloadlen, buf, len) != 1 ||
+                qos > 2 || topicName.lenstring.len == 0 ||
+                memchr(topicName.lenstring.data, '+', topicName.lenstring.len) ||
+                memchr(topicName.lenstring.data, '#', topicName.lenstring.len))
+        {
+            drop(c, true);
+            return false;
+        }
+        ++stats.published;
+
+        if (qos == 2)
+        {
+            // delivered once, however often the client repeats it before PUBREL
+            if (c->session->incomingQoS2.insert(id).second)
+                route(topicName, payload, payloadlen, qos, retained);
+            send(c->id, out, MQTTSerialize_ack(out, sizeof(out), PUBREC, 0, id));
+        }
+        else
+        {
+            route(topicName, payload, payloadlen, qos, retained);
+            if (qos == 1)
+                send(c->id, out, MQTTSerialize_puback(out, sizeof(out), id));
+        }
+        return true;
+    }
+
+    // deliver a publish to every session with a matching subscription
+    void route(MQTTString& topicName, unsigned char* payload, int payloadlen, int qos, bool retain)
+    {
+        std::string topic = str(topicName);
+        std::vector<unsigned char> packet0, packet1;
+        int idOffset = 0;
+        int n;
+
+        if (retain)
+        {
+            if (payloadlen == 0)
+                retained.erase(topic);
+            else
+            {
+                Retained& r = retained[topic];
+                r.payload.assign((char*)payload, payloadlen);
+                r.qos = (qos > 1) ? 1 : qos;
+            }
+        }
+
+        matches.resize(filters.size() + 1);
+        n = trie.match(topicName, &matches[0], filters.size());
+        std::map<std::string, int>::iterator exact = exacts.find(topic);
+        if (exact != exacts.end())
+            matches[n++] = exact->second;
+
+        // a session with several matching subscriptions gets one copy, at the highest QoS
+        ++generation;
+        targets.clear();
+        for (int i = 0; i < n; ++i)
+        {
+            Filter* f = filters[matches[i]];
+            for (unsigned int j = 0; j < f->subscribers.size(); ++j)
+            {
+                Session* s = f->subscribers[j].first;
+                if (s->generation != generation)
+                {
+                    s->generation = generation;
+                    s->qos = f->subscribers[j].second;
+                    targets.push_back(s);
+                }
+                else if (f->subscribers[j].second > s->qos)
+                    s->qos = f->subscribers[j].second;
+            }
+        }
+
+        // forwarded publishes are not marked retained, only those sent on subscribing are
+        for (unsigned int i = 0; i < targets.size(); ++i)
+        {
+            Session* s = targets[i];
+
+            if (qos == 0 || s->qos == 0)
+            {
+                if (s->conn < 0)
+                    continue;       // QoS 0 is not kept for offline clients
+                if (packet0.empty())
+                    serialize(packet0, topicName, payload, payloadlen, 0, false, idOffset);
+                send(s->conn, &packet0[0], packet0.size());
+                ++stats.delivered;
+            }
+            else
+            {
+                if (packet1.empty())
+                    serialize(packet1, topicName, payload, payloadlen, 1, false, idOffset);
+                deliver(s, std::string((char*)&packet1[0], packet1.size()), idOffset);
+            }
+        }
+    }
+
+    void serialize(std::vector<unsigned char>& packet, MQTTString& topicName, unsigned char* payload, int payloadlen,
+            int qos, bool retain, int& idOffset)
+    {
+        int len = MQTTPacket_len(MQTTV5Serialize_publishLength(qos, topicName, 0, payloadlen));
+
+        packet.resize(len);
+        MQTTSerialize_publish(&packet[0], len, 0, qos, retain, 0, topicName, payload, payloadlen);
+        idOffset = len - payloadlen - 2;
+    }
+
+    // send a QoS 1 publish if the window has room, otherwise queue it
+    void deliver(Session* s, const std::string& packet, int idOffset)
+    {
+        if (s->conn >= 0 && s->inflight.size() < MQTTBROKER_MAX_INFLIGHT && s->queue.empty())
+            sendInflight(s, packet, idOffset);
+        else if (s->queue.size() < MQTTBROKER_MAX_QUEUED)
+        {
+            s->queue.push_back(packet);
+            ++stats.queued;
+        }
+        else
+            ++stats.dropped;
+    }
+
+    void sendInflight(Session* s, const std::string& packet, int idOffset)
+    {
+        unsigned short id = s->lastId;
+
+        do
+            id = (id == 65535) ? 1 : id + 1;
+        while (s->inflight.count(id));
+        s->lastId = id;
+
+        std::string& copy = s->inflight[id] = packet;
+        copy[idOffset] = (char)(id >> 8);
+        copy[idOffset + 1] = (char)(id & 0xFF);
+        send(s->conn, (unsigned char*)copy.data(), copy.size());
+        ++stats.delivered;
+    }
+
+    // move queued publishes into the window
+    void pump(Session* s)
+    {
+        while (s->conn >= 0 && !s->queue.empty() && s->inflight.size() < MQTTBROKER_MAX_INFLIGHT)
+        {
+            std::string packet = s->queue.front();
+            MQTTString topicName = MQTTString_initializer;
+            unsigned char* payload;
+            int payloadlen, qos;
+            unsigned char dup, retain;
+            unsigned short id;
+
+            s->queue.pop_front();
+            MQTTDeserialize_publish(&dup, &qos, &retain, &id, &topicName, &payload, &payloadlen,
+                    (unsigned char*)packet.data(), packet.size());
+            sendInflight(s, packet, payload - (unsigned char*)packet.data() - 2);
+        }
+    }
+
+    void sendRetained(Session* s, const std::string& filter, int granted)
+    {
+        typename std::map<std::string, Retained>::iterator it;
+
+        for (it = retained.begin(); it != retained.end(); ++it)
+        {
+            if (!topicMatches(filter, it->first))
+                continue;
+
+            MQTTString topicName = MQTTString_initializer;
+            std::vector<unsigned char> packet;
+            int qos = (it->second.qos < granted) ? it->second.qos : granted;
+            int idOffset;
+
+            topicName.lenstring.data = (char*)it->first.data();
+            topicName.lenstring.len = it->first.size();
+            serialize(packet, topicName, (unsigned char*)it->second.payload.data(), it->second.payload.size(), qos, true, idOffset);
+            if (qos == 0)
+            {
+                send(s->conn, &packet[0], packet.size());
+                ++stats.delivered;
+            }
+            else
+                deliver(s, std::string((char*)&packet[0], packet.size()), idOffset);
+        }
+    }
+
+    bool addSubscription(Session* s, const std::string& text, int qos)
+    {
+        int index = findFilter(text);
+        Filter* f;
+
+        if (index < 0)
+        {
+            if (!free.empty())
+            {
+                index = free.back();
+                free.pop_back();
+            }
+            else if (filters.size() < 32767)
+            {
+                index = filters.size();
+                filters.push_back(0);
+            }
+            else
+                return false;
+            f = new Filter();
+            f->text = text;
+            if (!wildcard(text))
+                exacts[text] = index;
+            else if (!trie.insert(f->text.c_str(), index) && !(compact() && trie.insert(f->text.c_str(), index)))
+            {
+                delete f;
+                free.push_back(index);
+                return false;
+            }
+            filters[index] = f;
+        }
+        f = filters[index];
+
+        // a repeated subscription replaces the old one
+        s->subscriptions[text] = qos;
+        for (unsigned int i = 0; i < f->subscribers.size(); ++i)
+        {
+            if (f->subscribers[i].first == s)
+            {
+                f->subscribers[i].second = qos;
+                return true;
+            }
+        }
+        f->subscribers.push_back(std::make_pair(s, qos));
+        return true;
+    }
+
+    // a wildcard filter stays in the trie when its last subscriber goes, as other filters'
+    // nodes may point into its text - compact() clears them out when the nodes run short
+    void removeSubscription(Session* s, const std::string& text)
+    {
+        int index = findFilter(text);
+
+        s->subscriptions.erase(text);
+        if (index < 0)
+            return;
+
+        std::vector<std::pair<Session*, int> >& subscribers = filters[index]->subscribers;
+        for (unsigned int i = 0; i < subscribers.size(); ++i)
+        {
+            if (subscribers[i].first == s)
+            {
+                subscribers.erase(subscribers.begin() + i);
+                break;
+            }
+        }
+        if (subscribers.empty() && !wildcard(text))
+        {
+            exacts.erase(text);
+            delete filters[index];
+            filters[index] = 0;
+            free.push_back(index);
+        }
+    }
+
+    // rebuild the trie from the wildcard filters which still have subscribers
+    // returns true if any nodes were freed
+    bool compact()
+    {
+        bool freed = false;
+
+        for (unsigned int i = 0; i < filters.size(); ++i)
+        {
+            if (filters[i] && wildcard(filters[i]->text))
+                trie.remove(filters[i]->text.c_str());
+        }
+        for (unsigned int i = 0; i < filters.size(); ++i)
+        {
+            if (filters[i] == 0 || !wildcard(filters[i]->text))
+                continue;
+            if (filters[i]->subscribers.empty())
+            {
+                delete filters[i];
+                filters[i] = 0;
+                free.push_back(i);
+                freed = true;
+            }
+            else
+                trie.insert(filters[i]->text.c_str(), i);
+        }
+        return freed;
+    }
+
+    int findFilter(const std::string& text)
+    {
+        if (wildcard(text))
+            return trie.find(text.c_str());
+
+        std::map<std::string, int>::iterator it = exacts.find(text);
+        return (it == exacts.end()) ? -1 : it->second;
+    }
+
+    static bool wildcard(const std::string& filter)
+    {
+        return filter.find_first_of("+#") != std::string::npos;
+    }
+
+    void removeSession(Session* s)
+    {
+        while (!s->subscriptions.empty())
+            removeSubscription(s, s->subscriptions.begin()->first);
+        sessions.erase(s->clientID);
+        delete s;
+    }
+
+    // close a connection from this side
+    void drop(Connection* c, bool publishWill)
+    {
+        int id = c->id;
+
+        end(c, publishWill);
+        transport.disconnect(id);
+    }
+
+    // forget a connection, keeping its session if it is persistent
+    void end(Connection* c, bool publishWill)
+    {
+        Session* s = c->session;
+
+        connections.erase(c->id);
+        if (s)
+        {
+            s->conn = -1;
+            if (publishWill && c->hasWill)
+            {
+                MQTTString topicName = MQTTString_initializer;
+
+                topicName.lenstring.data = (char*)c->willTopic.data();
+                topicName.lenstring.len = c->willTopic.size();
+                route(topicName, (unsigned char*)c->willPayload.data(), c->willPayload.size(), c->willQoS, c->willRetained);
+            }
+            if (s->clean)
+                removeSession(s);
+        }
+        delete c;
+    }
+
+    // '+' and '#' must be whole levels, and '#' the last; the index holds levels of up to
+    // 255 characters
+    static bool validFilter(const std::string& filter)
+    {
+        unsigned int levelLen = 0;
+
+        if (filter.empty() || filter.size() > 65535)
+            return false;
+        for (unsigned int i = 0; i < filter.size(); ++i)
+        {
+            bool levelStart = (i == 0 || filter[i - 1] == '/');
+            bool levelEnd = (i + 1 == filter.size() || filter[i + 1] == '/');
+
+            levelLen = (filter[i] == '/') ? 0 : levelLen + 1;
+            if (levelLen > 255)
+                return false;
+
+            if (filter[i] == '+' && !(levelStart && levelEnd))
+                return false;
+            if (filter[i] == '#' && !(levelStart && i + 1 == filter.size()))
+                return false;
+        }
+        return true;
+    }
+
+    static bool topicMatches(const std::string& filter, const std::string& topic)
+    {
+        unsigned int f = 0, t = 0;
+
+        while (f < filter.size())
+        {
+            if (filter[f] == '#')
+                return true;
+            if (filter[f] == '+')
+            {
+                while (t < topic.size() && topic[t] != '/')
+                    ++t;
+                ++f;
+            }
+            else
+            {
+                if (t >= topic.size() || filter[f] != topic[t])
+                    return false;
+                ++f;
+                ++t;
+            }
+            if (f == filter.size())
+                break;
+            if (filter[f] == '/' && t == topic.size() && f + 2 == filter.size() && filter[f + 1] == '#')
+                return true;    // "a/#" also matches "a"
+        }
+        return t == topic.size();
+    }
+
+    Transport& transport;
+    unsigned long now;
+    unsigned long generation;
+    unsigned long autoId;
+
+    std::map<int, Connection*> connections;
+    std::map<std::string, Session*> sessions;
+    std::map<std::string, Retained> retained;
+
+    // most filters name one topic, and are found by a lookup of the topic - the trie would
+    // compare the topic level with every device's at the same level
+    std::map<std::string, int> exacts;              // filter without wildcards -> index in filters
+    TopicTrie<MQTTBROKER_TRIE_NODES> trie;          // filter with wildcards -> index in filters
+    std::vector<Filter*> filters;
+    std::vector<int> free;                          // unused indexes in filters
+
+    std::vector<int> matches;                       // scratch space for route
+    std::vector<Session*> targets;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *   http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    smoke readings over MQTT-SN on a Yun's BridgeUDP
+ *******************************************************************************/
+
+// Streams the smoke sensor ten times a second to an MQTT-SN gateway, such as mqttsn/SNGateway:
+//   ./mqttsn-gateway -p 1884 -t 1=iot-2/evt/smoke/fmt/json -b localhost:1883
+// Readings go at QoS -1 to predefined topic 1, so they need neither a connection nor a
+// registration, and a lost one is simply replaced by the next.  Once connected, a summary goes
+// every ten seconds at QoS 1 to a registered topic.
+
+#include <Bridge.h>
+#include <BridgeUdp.h>
+#include <Countdown.h>
+#include <MQTTSNClient.h>
+
+#define GATEWAY "192.168.1.10"
+#define GATEWAY_PORT 1884
+#define LOCAL_PORT 1884
+#define SMOKE_PIN 14
+#define SMOKE_TOPIC_ID 1              // predefined at the gateway with -t
+#define SUMMARY_TOPIC "iot-2/evt/summary/fmt/json"
+#define READING_MS 100
+#define SUMMARY_MS 10000
+#define RECONNECT_MS 5000
+
+BridgeUDP udp;
+MQTT::SNClient<BridgeUDP, Countdown, 48, 1> sn(udp, 5000);
+
+Countdown readingTimer, summaryTimer, reconnectTimer;
+unsigned short registerId;
+int peak = 0;
+char summary[32];   // kept until the QoS 1 summary is acknowledged
+bool summarySent = false;
+
+void ackArrived(int msgType, unsigned short msgId, int rc)
+{
+  if (msgType == MQTT::SN_CONNACK && rc == MQTT::SN_ACCEPTED)
+    sn.registerTopic(SUMMARY_TOPIC, registerId);
+  if (msgType == MQTT::SN_PUBACK)
+    summarySent = false;
+  if (rc != MQTT::SN_ACCEPTED)
+  {
+    Serial.print("MQTT-SN type ");
+    Serial.print(msgType, HEX);
+    Serial.print(" rc ");
+    Serial.println(rc);
+  }
+}
+
+void setup()
+{
+  Bridge.begin();
+  Serial.begin(9600);
+  sn.setAckHandler(ackArrived);
+  if (sn.begin(GATEWAY, GATEWAY_PORT, LOCAL_PORT) != MQTT::SUCCESS)
+    Serial.println("No UDP socket");
+  readingTimer.countdown_ms(READING_MS);
+  summaryTimer.countdown_ms(SUMMARY_MS);
+}
+
+void loop()
+{
+  sn.poll();
+  if (sn.state() == sn.DISCONNECTED && reconnectTimer.left_ms() == 0)
+  {
+    reconnectTimer.countdown_ms(RECONNECT_MS);
+    sn.connect("yun-smoke", 60);
+  }
+
+  if (readingTimer.expired())
+  {
+    char reading[8];
+    int smoke = analogRead(SMOKE_PIN);
+
+    readingTimer.countdown_ms(READING_MS);
+    if (smoke > peak)
+      peak = smoke;
+    itoa(smoke, reading, 10);
+    sn.publish((unsigned short)SMOKE_TOPIC_ID, reading, strlen(reading), MQTT::SN_QOSM1, false, MQTT::SN_TOPIC_PREDEFINED);
+  }
+
+  if (summaryTimer.expired())
+  {
+    summaryTimer.countdown_ms(SUMMARY_MS);
+    if (sn.topicId(SUMMARY_TOPIC) != 0 && !summarySent)
+    {
+      strcpy(summary, "{\"peak\":");
+      itoa(peak, summary + strlen(summary), 10);
+      strcat(summary, "}");
+      summarySent = (sn.publish(SUMMARY_TOPIC, summary, strlen(summary), MQTT::SN_QOS1) == MQTT::SUCCESS);
+      if (summarySent)
+        peak = 0;
+    }
+  }
+}
@@ -0,0 +1,528 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    MQTT-SN gateway stand-in for testing MQTT::SNClient
+ *******************************************************************************/
+
+/*
+ * A gateway for MQTT::SNClient, enough to test it against: CONNECT, REGISTER, PUBLISH at QoS -1,
+ * 0 and 1, PINGREQ and DISCONNECT, for any number of clients told apart by their address.  Topic
+ * ids are numbered from 1 for the whole gateway, and are valid for a client once it has
+ * registered them.  Each publish received is printed to stdout and, with -b, published at QoS 0
+ * to an MQTT broker on one connection, which is made again when it fails.  A client which sends
+ * nothing for one and a half times its keepalive is dropped.  Built and run from this directory:
+ *
+ *   for f in ../MQTT*.c; do gcc -O2 -c -I.. $f; done
+ *   g++ -O2 -I.. SNGateway.cpp MQTT*.o -o mqttsn-gateway
+ *   ./mqttsn-gateway -p 1884 -t 1=iot-2/evt/smoke/fmt/json -b localhost:1883
+ *
+ * Options: -p the UDP port, 1884 by default; -t a predefined topic id, as many as needed; -b the
+ * broker; -l the percentage of datagrams to drop as if lost, both ways, to exercise the client's
+ * retries.  Output is one CSV line per publish: time_ms,client,topic,qos,retained,dup,payload
+ * Log lines go to stderr.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+
+static unsigned long millis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+#include "Countdown.h"
+#include "MQTTSNClient.h"
+
+#define MAX_PACKET_SIZE 1500
+#define CONNECT_TIMEOUT_MS 5000
+
+using namespace MQTT;
+
+
+/**
+ * The MQTT connection publishes are forwarded on, with blocking writes: the gateway is for
+ * testing, and a broker on the same host or network.
+ */
+class Forwarder
+{
+public:
+
+    Forwarder() : fd(-1), port(1883)
+    { }
+
+    void setBroker(const char* spec)
+    {
+        const char* colon = strrchr(spec, ':');
+
+        host.assign(spec, colon ? colon - spec : strlen(spec));
+        if (colon)
+            port = atoi(colon + 1);
+    }
+
+    bool enabled()
+    {
+        return !host.empty();
+    }
+
+    void publish(const std::string& topic, const unsigned char* payload, int payloadlen, bool retained)
+    {
+        unsigned char buf[MAX_PACKET_SIZE + 256];
+        MQTTString topicName = MQTTString_initializer;
+        int len;
+
+        if (!enabled() || (fd < 0 && !connect()))
+            return;
+        topicName.cstring = (char*)topic.c_str();
+        len = MQTTSerialize_publish(buf, sizeof(buf), 0, 0, retained, 0, topicName, (unsigned char*)payload, payloadlen);
+        if (len <= 0 || send(fd, buf, len, MSG_NOSIGNAL) != len)
+        {
+            fprintf(stderr, "mqttsn-gateway: lost the broker\n");
+            disconnect();
+        }
+    }
+
+    // read and drop whatever the broker sends, noticing when it closes the connection
+    void drain()
+    {
+        unsigned char buf[256];
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            fprintf(stderr, "mqttsn-gateway: lost the broker\n");
+            disconnect();
+        }
+    }
+
+    int fd;
+
+private:
+
+    bool connect()
+    {
+        struct addrinfo hints, *res, *ai;
+        MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
+        unsigned char buf[64];
+        unsigned char sessionPresent, connack_rc;
+        struct pollfd p;
+        char service[8];
+        int len;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        sprintf(service, "%d", port);
+        if (getaddrinfo(host.c_str(), service, &hints, &res) != 0)
+            return false;
+        for (ai = res; ai && fd < 0; ai = ai->ai_next)
+        {
+            if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+                continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+                disconnect();
+        }
+        freeaddrinfo(res);
+        if (fd < 0)
+        {
+            fprintf(stderr, "mqttsn-gateway: cannot reach the broker at %s:%d\n", host.c_str(), port);
+            return false;
+        }
+
+        options.clientID.cstring = (char*)"mqttsn-gateway";
+        options.keepAliveInterval = 0;
+        len = MQTTSerialize_connect(buf, sizeof(buf), &options);
+        p.fd = fd;
+        p.events = POLLIN;
+        if (send(fd, buf, len, MSG_NOSIGNAL) != len || ::poll(&p, 1, CONNECT_TIMEOUT_MS) != 1 ||
+                recv(fd, buf, sizeof(buf), 0) < 4 || MQTTDeserialize_connack(&sessionPresent, &connack_rc, buf, 4) != 1 || connack_rc != 0)
+        {
+            fprintf(stderr, "mqttsn-gateway: the broker refused the connection\n");
+            disconnect();
+            return false;
+        }
+        fprintf(stderr, "mqttsn-gateway: connected to the broker at %s:%d\n", host.c_str(), port);
+        return true;
+    }
+
+    void disconnect()
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+    std::string host;
+    int port;
+};
+
+
+class Gateway
+{
+public:
+
+    Gateway() : lossPercent(0), fd(-1), start(millis())
+    { }
+
+    bool begin(int port)
+    {
+        struct sockaddr_in6 addr;
+        int off = 0;
+
+        if ((fd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+            return false;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        return bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    }
+
+    // id=topic
+    bool predefine(const char* spec)
+    {
+        const char* eq = strchr(spec, '=');
+        int id = atoi(spec);
+
+        if (eq == 0 || id <= 0 || id > 0xFFFF)
+            return false;
+        predefined[id] = eq + 1;
+        return true;
+    }
+
+    int run()
+    {
+        while (true)
+        {
+            struct pollfd fds[2];
+            int nfds = 1;
+
+            fds[0].fd = fd;
+            fds[0].events = POLLIN;
+            if (forwarder.fd >= 0)
+            {
+                fds[1].fd = forwarder.fd;
+                fds[1].events = POLLIN;
+                nfds = 2;
+            }
+            if (::poll(fds, nfds, 1000) < 0 && errno != EINTR)
+                return 1;
+            if (fds[0].revents & POLLIN)
+                receive();
+            if (nfds == 2 && fds[1].revents)
+                forwarder.drain();
+            expire();
+        }
+    }
+
+    int lossPercent;
+    Forwarder forwarder;
+
+private:
+
+    struct Session
+    {
+        std::string clientID;
+        unsigned short duration;
+        unsigned long last;                         // millis() of the last packet from the client
+        std::map<unsigned short, bool> registered;  // the topic ids the client has registered
+        unsigned short lastMsgid;                   // of the last QoS 1 publish, to spot a resend
+    };
+
+    typedef std::map<std::string, Session> Sessions;
+
+    void receive()
+    {
+        unsigned char buf[MAX_PACKET_SIZE];
+        struct sockaddr_storage from;
+        socklen_t fromlen = sizeof(from);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&from, &fromlen);
+
+        if (n <= 0 || lost())
+            return;
+        packet(buf, n, from, fromlen);
+    }
+
+    bool lost()
+    {
+        return lossPercent > 0 && rand() % 100 < lossPercent;
+    }
+
+    void packet(unsigned char* buf, int len, struct sockaddr_storage& from, socklen_t fromlen)
+    {
+        unsigned char* ptr = buf;
+        unsigned char* end = buf + len;
+        std::string client = address(from);
+        Sessions::iterator s = sessions.find(client);
+        int packetlen = *ptr++;
+        int type;
+
+        if (packetlen == 0x01 && len >= 4)
+            packetlen = readInt(&ptr);
+        if (packetlen != len || ptr == end)
+        {
+            fprintf(stderr, "mqttsn-gateway: %s: bad length %d for a %d byte datagram\n", client.c_str(), packetlen, len);
+            return;
+        }
+        type = *ptr++;
+        if (s != sessions.end())
+            s->second.last = millis();
+
+        switch (type)
+        {
+            case SN_CONNECT:
+            {
+                Session session;
+
+                if (end - ptr < 4 || ptr[1] != SN_PROTOCOL_ID)
+                    break;
+                session.duration = (ptr[2] << 8) | ptr[3];
+                session.clientID.assign((char*)ptr + 4, end - ptr - 4);
+                session.last = millis();
+                session.lastMsgid = 0;
+                if (s != sessions.end() && !(ptr[0] & SN_FLAG_CLEAN))
+                    session.registered = s->second.registered;
+                sessions[client] = session;
+                fprintf(stderr, "mqttsn-gateway: %s connected from %s, keepalive %d s\n", session.clientID.c_str(), client.c_str(),
+                        session.duration);
+                reply(from, fromlen, SN_CONNACK, SN_ACCEPTED);
+                break;
+            }
+            case SN_REGISTER:
+            {
+                unsigned short msgid, id;
+                std::string name;
+
+                if (end - ptr < 5)
+                    break;
+                ptr += 2;
+                msgid = readInt(&ptr);
+                name.assign((char*)ptr, end - ptr);
+                if (s == sessions.end())
+                {
+                    ack(from, fromlen, SN_REGACK, 0, msgid, SN_NOT_SUPPORTED);
+                    break;
+                }
+                if (ids.count(name) == 0)
+                {
+                    id = ids.size() + 1;
+                    ids[name] = id;
+                    names[id] = name;
+                }
+                id = ids[name];
+                s->second.registered[id] = true;
+                ack(from, fromlen, SN_REGACK, id, msgid, SN_ACCEPTED);
+                break;
+            }
+            case SN_PUBLISH:
+                publish(s, ptr, end, from, fromlen);
+                break;
+            case SN_PINGREQ:
+                if (s != sessions.end())
+                    reply(from, fromlen, SN_PINGRESP, -1);
+                break;
+            case SN_DISCONNECT:
+                if (s == sessions.end())
+                    break;
+                fprintf(stderr, "mqttsn-gateway: %s disconnected\n", s->second.clientID.c_str());
+                sessions.erase(s);
+                reply(from, fromlen, SN_DISCONNECT, -1);
+                break;
+            default:
+                fprintf(stderr, "mqttsn-gateway: %s: message type 0x%02x is not supported\n", client.c_str(), type);
+                break;
+        }
+    }
+
+    void publish(Sessions::iterator s, unsigned char* ptr, unsigned char* end, struct sockaddr_storage& from, socklen_t fromlen)
+    {
+        int flags, qos, topicType;
+        unsigned short topicId, msgid;
+        std::string topic;
+        bool connected = (s != sessions.end());
+
+        if (end - ptr < 5)
+            return;
+        flags = *ptr++;
+        topicId = readInt(&ptr);
+        msgid = readInt(&ptr);
+        qos = (flags & SN_FLAG_QOS) >> 5;
+        topicType = flags & SN_FLAG_TOPIC_TYPE;
+
+        if (qos == 3)
+            qos = -1;
+        else if (qos == 2)
+        {
+            ack(from, fromlen, SN_PUBACK, topicId, msgid, SN_NOT_SUPPORTED);
+            return;
+        }
+        else if (!connected)
+        {   // it has to connect again
+            reply(from, fromlen, SN_DISCONNECT, -1);
+            return;
+        }
+
+        if (topicType == SN_TOPIC_SHORT)
+        {
+            topic += (char)(topicId >> 8);
+            topic += (char)(topicId & 0xFF);
+        }
+        else if (topicType == SN_TOPIC_PREDEFINED && predefined.count(topicId))
+            topic = predefined[topicId];
+        else if (topicType == SN_TOPIC_NORMAL && qos >= 0 && s->second.registered.count(topicId))
+            topic = names[topicId];
+        if (topic.empty())
+        {
+            ack(from, fromlen, SN_PUBACK, topicId, msgid, SN_INVALID_TOPIC_ID);
+            return;
+        }
+
+        if (qos == 1 && (flags & SN_FLAG_DUP) && msgid == s->second.lastMsgid)
+            ;   // a resend of one which was forwarded, whose PUBACK was lost
+        else
+        {
+            printf("%lu,%s,%s,%d,%d,%d,%.*s\n", millis() - start, connected ? s->second.clientID.c_str() : address(from).c_str(),
+                    topic.c_str(), qos, (flags & SN_FLAG_RETAIN) != 0, (flags & SN_FLAG_DUP) != 0, (int)(end - ptr), ptr);
+            fflush(stdout);
+            forwarder.publish(topic, ptr, end - ptr, (flags & SN_FLAG_RETAIN) != 0);
+        }
+        if (qos == 1)
+        {
+            s->second.lastMsgid = msgid;
+            ack(from, fromlen, SN_PUBACK, topicId, msgid, SN_ACCEPTED);
+        }
+    }
+
+    // a REGACK or PUBACK
+    void ack(struct sockaddr_storage& to, socklen_t tolen, int type, unsigned short topicId, unsigned short msgid, int rc)
+    {
+        unsigned char buf[7];
+        unsigned char* ptr = buf;
+
+        *ptr++ = sizeof(buf);
+        *ptr++ = type;
+        writeInt(&ptr, topicId);
+        writeInt(&ptr, msgid);
+        *ptr++ = rc;
+        sendTo(to, tolen, buf, sizeof(buf));
+    }
+
+    // a packet with a return code, or with no body when rc is -1
+    void reply(struct sockaddr_storage& to, socklen_t tolen, int type, int rc)
+    {
+        unsigned char buf[3] = {2, (unsigned char)type, (unsigned char)rc};
+
+        if (rc >= 0)
+            buf[0] = 3;
+        sendTo(to, tolen, buf, buf[0]);
+    }
+
+    void sendTo(struct sockaddr_storage& to, socklen_t tolen, unsigned char* buf, int len)
+    {
+        if (!lost())
+            sendto(fd, buf, len, 0, (struct sockaddr*)&to, tolen);
+    }
+
+    // drop the clients which have been silent for one and a half times their keepalive
+    void expire()
+    {
+        unsigned long now = millis();
+
+        for (Sessions::iterator s = sessions.begin(); s != sessions.end();)
+        {
+            if (s->second.duration > 0 && now - s->second.last > s->second.duration * 1500UL)
+            {
+                fprintf(stderr, "mqttsn-gateway: %s timed out\n", s->second.clientID.c_str());
+                sessions.erase(s++);
+            }
+            else
+                ++s;
+        }
+    }
+
+    static std::string address(struct sockaddr_storage& addr)
+    {
+        char host[INET6_ADDRSTRLEN], buf[INET6_ADDRSTRLEN + 8];
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        const char* h = host;
+
+        inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+        if (strncmp(h, "::ffff:", 7) == 0)
+            h += 7;
+        sprintf(buf, "%s:%d", h, ntohs(in6->sin6_port));
+        return buf;
+    }
+
+    int fd;
+    unsigned long start;
+    Sessions sessions;
+    std::map<std::string, unsigned short> ids;
+    std::map<unsigned short, std::string> names;
+    std::map<unsigned short, std::string> predefined;
+};
+
+
+int main(int argc, char** argv)
+{
+    static Gateway gateway;
+    int port = 1884, opt;
+
+    while ((opt = getopt(argc, argv, "p:t:b:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 't':
+                if (!gateway.predefine(optarg))
+                {
+                    fprintf(stderr, "mqttsn-gateway: -t wants id=topic, not %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'b':
+                gateway.forwarder.setBroker(optarg);
+                break;
+            case 'l':
+                gateway.lossPercent = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-p port] [-t id=topic]... [-b host[:port]] [-l loss_percent]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (!gateway.begin(port))
+    {
+        perror("mqttsn-gateway");
+        return 1;
+    }
+    fprintf(stderr, "mqttsn-gateway: listening on UDP port %d\n", port);
+    printf("time_ms,client,topic,qos,retained,dup,payload\n");
+    fflush(stdout);
+    return gateway.run();
+}
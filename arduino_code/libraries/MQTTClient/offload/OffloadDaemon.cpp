@@ -0,0 +1,648 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    Linux side daemon for MQTT::OffloadClient
+ *******************************************************************************/
+
+/*
+ * The other half of MQTT::OffloadClient.  The sketch starts this program as a Bridge process and
+ * writes OffloadFrames to its stdin; it keeps the MQTT session with MQTT::AsyncClient over a
+ * socket and writes connection status, acks and messages back to stdout for the sketch to poll.
+ * It reconnects with a backoff of 1 s doubling up to 60 s, subscribes again after each reconnect,
+ * and holds publishes while the broker is unreachable.  It exits when the sketch goes, as its
+ * stdin is then closed.  Built from this directory:
+ *
+ *   for f in ../MQTT*.c; do gcc -O2 -c -I.. $f; done
+ *   g++ -O2 -I.. OffloadDaemon.cpp MQTT*.o -o mqtt-offload
+ *
+ * For the Yun, build it with the OpenWrt SDK's mips-openwrt-linux-g++ in the same way, and copy
+ * it to /usr/bin/mqtt-offload, the path OffloadClient::begin() starts by default.
+ * Log lines go to stderr.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+static unsigned long millis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+#define MQTTCLIENT_QOS2 1
+#include "Countdown.h"
+#include "MQTTAsyncClient.h"
+#include "MQTTOffloadClient.h"
+
+#define MAX_PACKET_SIZE 1100
+#define MAX_SLOTS 16            // subscriptions, as many as the sketch's handler slots can number
+#define MAX_INFLIGHT 16
+#define MAX_QUEUED 1000         // publishes held while the broker is unreachable
+#define CONNECT_TIMEOUT_MS 5000
+#define MIN_BACKOFF_MS 1000
+#define MAX_BACKOFF_MS 60000
+
+
+/**
+ * A Network for MQTT::AsyncClient over a non-blocking socket.  available() counts a closed or
+ * failed socket as readable, so that the client's read finds the error and closes the session
+ * instead of waiting for the keepalive to time out.
+ */
+class LinuxIPStack
+{
+public:
+
+    LinuxIPStack() : fd(-1)
+    { }
+
+    int connect(const char* host, int port)
+    {
+        struct addrinfo hints, *res, *ai;
+        char service[8];
+
+        disconnect();
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        sprintf(service, "%d", port);
+        if (getaddrinfo(host, service, &hints, &res) != 0)
+            return 0;
+        for (ai = res; ai && fd < 0; ai = ai->ai_next)
+        {
+            struct pollfd p;
+            int err = 0, on = 1;
+            socklen_t len = sizeof(err);
+
+            if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+                continue;
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS)
+                err = errno;
+            else
+            {
+                p.fd = fd;
+                p.events = POLLOUT;
+                if (::poll(&p, 1, CONNECT_TIMEOUT_MS) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                    err = ETIMEDOUT;
+            }
+            if (err != 0)
+                disconnect();
+        }
+        freeaddrinfo(res);
+        return fd >= 0;
+    }
+
+    int available()
+    {
+        struct pollfd p;
+        int n = 0;
+
+        if (fd < 0)
+            return 0;
+        if (ioctl(fd, FIONREAD, &n) == 0 && n > 0)
+            return n;
+        p.fd = fd;
+        p.events = POLLIN;
+        return (::poll(&p, 1, 0) == 1) ? 1 : 0;     // nothing to read, but readable: closed or failed
+    }
+
+    int read(unsigned char* buffer, int len, int /*timeout*/)    // never waits: AsyncClient polls
+    {
+        ssize_t rc = recv(fd, buffer, len, 0);
+
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return 0;
+        return (rc > 0) ? rc : -1;
+    }
+
+    int write(unsigned char* buffer, int len, int timeout)
+    {
+        struct pollfd p;
+        ssize_t rc;
+
+        p.fd = fd;
+        p.events = POLLOUT;
+        if (::poll(&p, 1, timeout) != 1)
+            return 0;
+        rc = send(fd, buffer, len, MSG_NOSIGNAL);
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return 0;
+        return (rc >= 0) ? rc : -1;
+    }
+
+    int disconnect()
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+        return 1;
+    }
+
+    int fd;
+};
+
+
+typedef MQTT::AsyncClient<LinuxIPStack, Countdown, MAX_PACKET_SIZE, MAX_SLOTS, MAX_INFLIGHT> Client;
+
+
+class Offload
+{
+public:
+
+    Offload() : client(ipstack), maxFrame(64), wanted(false), up(false), attempt(0), backoff(MIN_BACKOFF_MS), pendingSlot(-1)
+    {
+        instance = this;
+        client.setAckHandler(acked);
+        client.setDefaultMessageHandler(arrived);
+        for (int i = 0; i < MAX_SLOTS; ++i)
+            slots[i].used = false;
+    }
+
+    int run()
+    {
+        std::vector<unsigned char> in;
+        unsigned char buf[512];
+
+        fcntl(0, F_SETFL, O_NONBLOCK);
+        while (true)
+        {
+            struct pollfd fds[2];
+            int nfds = 1;
+            unsigned long timeout = client.next_ms();
+
+            if (timeout > 1000)
+                timeout = 1000;
+            if (wanted && client.state() == Client::DISCONNECTED)
+            {
+                long left = (long)(attempt - millis());
+                timeout = (left > 0 && (unsigned long)left < timeout) ? left : (left > 0) ? timeout : 0;
+            }
+            fds[0].fd = 0;
+            fds[0].events = POLLIN;
+            if (ipstack.fd >= 0)
+            {
+                fds[1].fd = ipstack.fd;
+                fds[1].events = POLLIN;
+                nfds = 2;
+            }
+            ::poll(fds, nfds, timeout);
+
+            if (fds[0].revents)
+            {
+                ssize_t n = ::read(0, buf, sizeof(buf));
+
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+                    break;      // the sketch has gone
+                if (n > 0)
+                {
+                    size_t start = 0;
+
+                    in.insert(in.end(), buf, buf + n);
+                    while (in.size() - start > 0 && in.size() - start > in[start])
+                    {
+                        if (in[start] > 0)
+                            frame(&in[start + 1], in[start]);
+                        start += in[start] + 1;
+                    }
+                    in.erase(in.begin(), in.begin() + start);
+                }
+            }
+
+            if (client.state() != Client::DISCONNECTED)
+                client.poll();
+            if (client.state() == Client::DISCONNECTED && ipstack.fd >= 0)
+                lost();
+            if (wanted && client.state() == Client::DISCONNECTED && (long)(millis() - attempt) >= 0)
+                connect();
+            pump();
+        }
+        if (client.state() != Client::DISCONNECTED)
+            client.disconnect();
+        ipstack.disconnect();
+        return 0;
+    }
+
+private:
+
+    struct Slot
+    {
+        bool used;
+        std::string filter;
+        int qos;
+    };
+
+    struct Outgoing
+    {
+        std::string topic;
+        std::string payload;
+        int qos;
+        bool retained;
+        unsigned short sketchId;    // the id the sketch gave it, for the ack
+        unsigned short id;          // the id the client gave it, while in flight
+    };
+
+    struct Request
+    {
+        int type;                   // SUBSCRIBE or UNSUBSCRIBE
+        int slot;
+        std::string filter;
+    };
+
+    // one frame from the sketch
+    void frame(unsigned char* body, int len)
+    {
+        unsigned char* end = body + len;
+        unsigned char* p = body + 1;
+
+        switch (body[0])
+        {
+            case MQTT::OFFLOAD_HELLO:
+                if (len >= 2)
+                    maxFrame = body[1];
+                break;
+            case MQTT::OFFLOAD_CONNECT:
+            {
+                MQTTPacket_connectData initial = MQTTPacket_connectData_initializer;
+
+                if (len < 7)
+                    break;
+                port = (p[0] << 8) | p[1];
+                options = initial;
+                options.keepAliveInterval = (p[2] << 8) | p[3];
+                options.cleansession = p[4];
+                options.MQTTVersion = p[5];
+                p += 6;
+                if (!string(p, end, host) || !string(p, end, clientID) || !string(p, end, username) || !string(p, end, password))
+                    break;
+                options.clientID.cstring = (char*)clientID.c_str();
+                options.username.cstring = username.empty() ? 0 : (char*)username.c_str();
+                options.password.cstring = password.empty() ? 0 : (char*)password.c_str();
+                if (client.state() != Client::DISCONNECTED)
+                    client.disconnect();
+                ipstack.disconnect();
+                wanted = true;
+                backoff = MIN_BACKOFF_MS;
+                attempt = millis();
+                break;
+            }
+            case MQTT::OFFLOAD_DISCONNECT:
+                wanted = false;
+                if (client.state() != Client::DISCONNECTED)
+                    client.disconnect();
+                ipstack.disconnect();
+                break;
+            case MQTT::OFFLOAD_TOPIC:
+                if (len >= 2)
+                    topics[body[1]].assign((char*)body + 2, len - 2);
+                break;
+            case MQTT::OFFLOAD_PUBLISH:
+            case MQTT::OFFLOAD_PUBLISH_NAMED:
+            {
+                Outgoing o;
+                std::string topic;
+
+                if (len < 5)
+                    break;
+                o.sketchId = (p[0] << 8) | p[1];
+                o.qos = p[2] & 3;
+                o.retained = (p[2] >> 2) & 1;
+                p += 3;
+                if (body[0] == MQTT::OFFLOAD_PUBLISH)
+                {
+                    if (topics.count(*p) == 0)
+                    {
+                        fprintf(stderr, "mqtt-offload: publish to unknown topic id %d\n", *p);
+                        ack(o.qos == 2 ? PUBCOMP : PUBACK, o.sketchId, 0x80);
+                        break;
+                    }
+                    o.topic = topics[*p++];
+                }
+                else if (!string(p, end, o.topic))
+                    break;
+                o.payload.assign((char*)p, end - p);
+                if (outbox.size() >= MAX_QUEUED)
+                {
+                    ack(o.qos == 2 ? PUBCOMP : PUBACK, o.sketchId, 0x80);
+                    break;
+                }
+                outbox.push_back(o);
+                break;
+            }
+            case MQTT::OFFLOAD_SUBSCRIBE:
+                if (len < 4 || body[1] >= MAX_SLOTS)
+                    break;
+                slots[body[1]].used = true;
+                slots[body[1]].qos = body[2];
+                slots[body[1]].filter.assign((char*)body + 3, len - 3);
+                request(SUBSCRIBE, body[1]);
+                break;
+            case MQTT::OFFLOAD_UNSUBSCRIBE:
+                if (len < 2 || body[1] >= MAX_SLOTS || !slots[body[1]].used)
+                    break;
+                request(UNSUBSCRIBE, body[1]);
+                slots[body[1]].used = false;
+                break;
+        }
+    }
+
+    static bool string(unsigned char*& p, unsigned char* end, std::string& s)
+    {
+        if (p >= end || p + 1 + *p > end)
+            return false;
+        s.assign((char*)p + 1, *p);
+        p += 1 + *p;
+        return true;
+    }
+
+    void request(int type, int slot)
+    {
+        Request r;
+
+        r.type = type;
+        r.slot = slot;
+        r.filter = slots[slot].filter;
+        requests.push_back(r);
+    }
+
+    void connect()
+    {
+        fprintf(stderr, "mqtt-offload: connecting to %s:%d\n", host.c_str(), port);
+        attempt = millis() + backoff;
+        backoff = (backoff * 2 > MAX_BACKOFF_MS) ? MAX_BACKOFF_MS : backoff * 2;
+        if (!ipstack.connect(host.c_str(), port) || client.connect(options) != MQTT::SUCCESS)
+        {
+            ipstack.disconnect();
+            status(MQTT::OFFLOAD_LOST);
+        }
+    }
+
+    // the session has closed: the client has already reported what was outstanding
+    void lost()
+    {
+        ipstack.disconnect();
+        pendingSlot = -1;
+        if (up)
+        {
+            fprintf(stderr, "mqtt-offload: connection lost\n");
+            status(MQTT::OFFLOAD_LOST);
+        }
+        up = false;
+    }
+
+    // send what can be sent now
+    void pump()
+    {
+        if (!client.isConnected())
+            return;
+
+        while (!requests.empty() && !client.isBusy())
+        {
+            Request r = requests.front();
+            int rc;
+
+            requests.pop_front();
+            pendingSlot = r.slot;
+            if (r.type == SUBSCRIBE)
+            {
+                if (!slots[r.slot].used || slots[r.slot].filter != r.filter)
+                    continue;   // unsubscribed since
+                rc = client.subscribe(slots[r.slot].filter.c_str(), (MQTT::QoS)slots[r.slot].qos, arrived);
+            }
+            else
+                rc = client.unsubscribe(r.filter.c_str());
+            if (rc != MQTT::SUCCESS)
+                ack((r.type == SUBSCRIBE) ? SUBACK : UNSUBACK, r.slot, 0x80);
+        }
+
+        while (!outbox.empty() && client.isConnected())
+        {
+            Outgoing& o = outbox.front();
+            int rc;
+
+            if (o.qos == 0)
+            {
+                rc = client.publish(o.topic.c_str(), (void*)o.payload.data(), o.payload.size(), MQTT::QOS0, o.retained);
+                if (rc != MQTT::SUCCESS)
+                    break;
+                outbox.pop_front();
+                continue;
+            }
+            if (client.inflightCount() >= MAX_INFLIGHT)
+                break;
+            // the client keeps pointers to the topic and payload until the ack
+            inflight.push_back(o);
+            outbox.pop_front();
+            Outgoing& f = inflight.back();
+            rc = client.publish(f.topic.c_str(), (void*)f.payload.data(), f.payload.size(), f.id, (MQTT::QoS)f.qos, f.retained);
+            if (rc != MQTT::SUCCESS)
+            {
+                outbox.push_front(f);
+                inflight.pop_back();
+                break;
+            }
+        }
+    }
+
+    static void acked(int type, unsigned short id, int rc)
+    {
+        instance->onAck(type, id, rc);
+    }
+
+    void onAck(int type, unsigned short id, int rc)
+    {
+        switch (type)
+        {
+            case CONNACK:
+                if (rc == 0)
+                {
+                    fprintf(stderr, "mqtt-offload: connected\n");
+                    up = true;
+                    backoff = MIN_BACKOFF_MS;
+                    requests.clear();
+                    for (int i = 0; i < MAX_SLOTS; ++i)
+                    {
+                        if (slots[i].used)
+                            request(SUBSCRIBE, i);
+                    }
+                    status(0);
+                }
+                else
+                    status((rc == MQTT::FAILURE) ? MQTT::OFFLOAD_LOST : rc);
+                break;
+            case SUBACK:
+            case UNSUBACK:
+                if (pendingSlot >= 0)
+                    ack(type, pendingSlot, (rc == MQTT::FAILURE) ? 0x80 : rc);
+                pendingSlot = -1;
+                break;
+            case PUBACK:
+            case PUBCOMP:
+                for (std::list<Outgoing>::iterator it = inflight.begin(); it != inflight.end(); ++it)
+                {
+                    if (it->id != id)
+                        continue;
+                    if (rc == MQTT::SUCCESS)
+                        ack(type, it->sketchId, 0);
+                    else
+                    {
+                        it->id = 0;
+                        outbox.push_front(*it);     // sent again after the reconnect
+                    }
+                    inflight.erase(it);
+                    break;
+                }
+                break;
+        }
+    }
+
+    static void arrived(MQTT::MessageData& md)
+    {
+        instance->onMessage(md);
+    }
+
+    void onMessage(MQTT::MessageData& md)
+    {
+        MQTTString& name = md.topicName;
+        std::string topic(name.lenstring.data, name.lenstring.len);
+        int len = 4 + topic.size() + (int)md.message.payloadlen;
+        unsigned char buf[256];
+
+        for (int i = 0; i < MAX_SLOTS; ++i)
+        {
+            if (!slots[i].used || !matches(slots[i].filter, topic))
+                continue;
+            if (topic.size() > 255 || len + 1 > maxFrame)
+            {
+                fprintf(stderr, "mqtt-offload: dropped a %d byte message on %s, larger than the sketch's frame\n",
+                        (int)md.message.payloadlen, topic.c_str());
+                return;
+            }
+            buf[0] = len;
+            buf[1] = MQTT::OFFLOAD_MESSAGE;
+            buf[2] = i;
+            buf[3] = md.message.qos | (md.message.retained << 2) | (md.message.dup << 3);
+            buf[4] = topic.size();
+            memcpy(&buf[5], topic.data(), topic.size());
+            memcpy(&buf[5 + topic.size()], md.message.payload, md.message.payloadlen);
+            output(buf, len + 1);
+            return;
+        }
+    }
+
+    void status(int rc)
+    {
+        unsigned char buf[] = {2, MQTT::OFFLOAD_STATUS, (unsigned char)rc};
+        output(buf, sizeof(buf));
+    }
+
+    void ack(int type, unsigned short id, int rc)
+    {
+        unsigned char buf[] = {5, MQTT::OFFLOAD_ACK, (unsigned char)type, (unsigned char)(id >> 8), (unsigned char)id, (unsigned char)rc};
+        output(buf, sizeof(buf));
+    }
+
+    static void output(const unsigned char* buf, int len)
+    {
+        while (len > 0)
+        {
+            ssize_t rc = ::write(1, buf, len);
+
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                exit(0);    // the sketch has gone
+            buf += rc;
+            len -= rc;
+        }
+    }
+
+    static bool matches(const std::string& filter, const std::string& topic)
+    {
+        unsigned int f = 0, t = 0;
+
+        while (f < filter.size())
+        {
+            if (filter[f] == '#')
+                return true;
+            if (filter[f] == '+')
+            {
+                while (t < topic.size() && topic[t] != '/')
+                    ++t;
+                ++f;
+            }
+            else
+            {
+                if (t >= topic.size() || filter[f] != topic[t])
+                    return false;
+                ++f;
+                ++t;
+            }
+            if (f == filter.size())
+                break;
+            if (filter[f] == '/' && t == topic.size() && f + 2 == filter.size() && filter[f + 1] == '#')
+                return true;    // "a/#" also matches "a"
+        }
+        return t == topic.size();
+    }
+
+    static Offload* instance;
+
+    LinuxIPStack ipstack;
+    Client client;
+    int maxFrame;
+
+    bool wanted;                    // connect until the sketch says disconnect
+    bool up;                        // the sketch has been told the connection is up
+    std::string host, clientID, username, password;
+    int port;
+    MQTTPacket_connectData options;
+    unsigned long attempt;          // when to try connecting next
+    unsigned long backoff;
+
+    std::map<int, std::string> topics;
+    Slot slots[MAX_SLOTS];
+    std::deque<Request> requests;
+    int pendingSlot;                // the slot of the outstanding SUBSCRIBE or UNSUBSCRIBE
+    std::deque<Outgoing> outbox;
+    std::list<Outgoing> inflight;
+};
+
+Offload* Offload::instance = 0;
+
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    Offload offload;
+    return offload.run();
+}
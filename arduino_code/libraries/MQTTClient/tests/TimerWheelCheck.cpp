@@ -0,0 +1,167 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    host check of the timer wheel
+ *******************************************************************************/
+
+/*
+ * Arms, stops and runs random timers in TimerWheels of a few shapes on a simulated millis(),
+ * which starts just before it wraps.  After every step next_ms() must equal the time to the
+ * earliest armed timer, found by looking at all of them, and run() must have called the
+ * handlers of exactly the timers which are due - a timer armed for a tick run() has already
+ * handled is due at the next one.  The clock moves in random steps and in steps
+ * of next_ms(), so that it lands on the cascade boundaries of every level.
+ * Built and run on the host, from this directory:
+ *
+ *   g++ -O2 -I.. TimerWheelCheck.cpp -o TimerWheelCheck
+ *   ./TimerWheelCheck
+ *
+ * Output is one CSV line per wheel: bits,levels,steps,fired, and the exit status is 0 if
+ * every check held.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned long now_ms;
+
+unsigned long millis()
+{
+    return now_ms;
+}
+
+#include "TimerWheel.h"
+
+#define TIMERS 40
+#define STEPS 200000
+
+static bool armed[TIMERS];
+static unsigned long expires[TIMERS];
+static int fired_count;
+
+static void fired(void* arg)
+{
+    int i = (int)(long)arg;
+
+    if (!armed[i] || (long)(expires[i] - now_ms) > 0)
+    {
+        printf("timer %d called %ld ms early\n", i, (long)(expires[i] - now_ms));
+        exit(1);
+    }
+    armed[i] = false;
+    ++fired_count;
+}
+
+// mostly short timers, some past what the top level reaches
+static unsigned long randomDelay(unsigned long reach)
+{
+    switch (rand() % 4)
+    {
+    case 0: return rand() % 16;
+    case 1: return rand() % 300;
+    case 2: return rand() % reach;
+    default: return rand() % (reach * 4);
+    }
+}
+
+template<int BITS, int LEVELS>
+static int check()
+{
+    const unsigned long reach = 1UL << (BITS * LEVELS);
+    TimerWheel<BITS, LEVELS> wheel;
+    WheelTimer* timers[TIMERS];
+    unsigned long handled = now_ms - 1;     // the last tick run() has handled
+    int steps;
+
+    fired_count = 0;
+    for (int i = 0; i < TIMERS; ++i)
+    {
+        timers[i] = new WheelTimer(fired, (void*)(long)i);
+        armed[i] = false;
+    }
+
+    for (steps = 0; steps < STEPS; ++steps)
+    {
+        int i = rand() % TIMERS;
+        int action = rand() % 8;
+
+        if (action == 0)
+        {
+            wheel.stop(*timers[i]);
+            armed[i] = false;
+        }
+        else if (action <= 2)
+        {
+            unsigned long ms = randomDelay(reach);
+
+            wheel.start(*timers[i], ms);
+            armed[i] = true;
+            expires[i] = now_ms + ms;
+        }
+
+        unsigned long next = wheel.next_ms();
+        unsigned long earliest = TimerWheel<BITS, LEVELS>::NONE;
+        for (int j = 0; j < TIMERS; ++j)
+        {
+            if (!armed[j])
+                continue;
+            long left = (long)(expires[j] - now_ms);
+            unsigned long ms = (left > 0) ? left : 0;
+            if (earliest == TimerWheel<BITS, LEVELS>::NONE || ms < earliest)
+                earliest = ms;
+        }
+        if (next != earliest)
+        {
+            printf("%d,%d: next_ms %lu, earliest %lu, at step %d, now %lu\n", BITS, LEVELS, next, earliest, steps, now_ms);
+            return 1;
+        }
+
+        // sleep as next_ms allows, or less
+        if (next != TimerWheel<BITS, LEVELS>::NONE && rand() % 2)
+            now_ms += next;
+        else
+            now_ms += rand() % 40;
+        wheel.run();
+        for (int j = 0; j < TIMERS; ++j)
+            if (armed[j] && (long)(expires[j] - now_ms) <= 0 && (long)(now_ms - handled) > 0)
+            {
+                printf("%d,%d: timer %d not called %ld ms after it was due\n", BITS, LEVELS, j, (long)(now_ms - expires[j]));
+                return 1;
+            }
+        handled = now_ms;
+    }
+
+    for (int i = 0; i < TIMERS; ++i)
+    {
+        wheel.stop(*timers[i]);
+        delete timers[i];
+    }
+    printf("%d,%d,%d,%d\n", BITS, LEVELS, steps, fired_count);
+    return 0;
+}
+
+int main()
+{
+    int rc = 0;
+
+    srand(1);
+    now_ms = (unsigned long)-100000L;
+    rc |= check<4, 4>();
+    now_ms = (unsigned long)-5000L;
+    rc |= check<2, 3>();
+    now_ms = (unsigned long)-3000L;
+    rc |= check<5, 2>();
+    now_ms = (unsigned long)-70000L;
+    rc |= check<3, 4>();
+    return rc;
+}
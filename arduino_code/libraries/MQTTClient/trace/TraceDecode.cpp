@@ -0,0 +1,140 @@
+/*******************************************************************************
+ * Copyright (c) 2014, 2015 IBM Corp.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * and Eclipse Distribution License v1.0 which accompany this distribution.
+ *
+ * The Eclipse Public License is available at
+ *    http://www.eclipse.org/legal/epl-v10.html
+ * and the Eclipse Distribution License is available at
+ *   http://www.eclipse.org/org/documents/edl-v10.php.
+ *
+ * Contributors:
+ *    host decoder for MQTT::Trace dumps
+ *******************************************************************************/
+
+/*
+ * Prints the packets in a dump written by Client::dumpTrace or AsyncClient::dumpTrace.  The dump
+ * can be a Bridge file copied off the Yun, or a capture of the serial port: anything before the
+ * "MQTR" magic is skipped, and each dump found in the input is printed in turn.  Built and run
+ * on the host, from this directory:
+ *
+ *   for f in ../MQTT*.c; do gcc -O2 -c -I.. $f; done
+ *   g++ -O2 -I.. TraceDecode.cpp MQTT*.o -o TraceDecode
+ *   scp root@arduino.local:/tmp/mqtt.trace . && ./TraceDecode mqtt.trace
+ *
+ * Output is one CSV line per packet, oldest first:
+ * dump,seq,clock_us,delta_us,age_us,dir,packet,qos,dup,retained,id,length
+ * where seq counts from the first packet recorded, delta_us is the time since the previous
+ * packet and age_us how long before the dump the packet was recorded.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+extern "C"
+{
+#include "MQTTPacket.h"
+#include "MQTTFormat.h"
+}
+
+#define TRACE_HEADER_SIZE 16
+
+
+static unsigned long get(const unsigned char* buf, int bytes)
+{
+    unsigned long value = 0;
+
+    for (int i = bytes - 1; i >= 0; --i)
+        value = value << 8 | buf[i];
+    return value;
+}
+
+
+static const char* name(int type)
+{
+    return (type > 0 && type <= DISCONNECT) ? MQTTPacket_getName(type) : "AUTH";
+}
+
+
+// the clock is an unsigned long on the device, 32 bits on the AVR
+static unsigned long elapsed(unsigned long from, unsigned long to)
+{
+    return (to - from) & 0xFFFFFFFFUL;
+}
+
+
+/**
+ * Print the dump starting at buf
+ * @return the number of bytes it took, or 0 if it is truncated or not a version 1 dump
+ */
+static long decode(int dump, const unsigned char* buf, long len)
+{
+    if (len < TRACE_HEADER_SIZE || buf[4] != 1)
+        return 0;
+
+    int record_size = buf[5];
+    int kept = get(&buf[6], 2);
+    unsigned long total = get(&buf[8], 4);
+    unsigned long now = get(&buf[12], 4);
+    unsigned long previous = 0;
+    long size = TRACE_HEADER_SIZE + (long)kept * record_size;
+
+    if (record_size < 10 || len < size)
+    {
+        fprintf(stderr, "dump %d truncated, %ld of %ld bytes\n", dump, len, size);
+        return 0;
+    }
+    if (total > (unsigned long)kept)
+        fprintf(stderr, "dump %d: %lu earlier packets were overwritten\n", dump, total - kept);
+
+    for (int i = 0; i < kept; ++i)
+    {
+        const unsigned char* r = &buf[TRACE_HEADER_SIZE + i * record_size];
+        unsigned long clock = get(r, 4);
+        int header = r[8];
+
+        printf("%d,%lu,%lu,%lu,%lu,%s,%s,%d,%d,%d,%lu,%lu\n", dump, total - kept + i, clock,
+                (i == 0) ? 0 : elapsed(previous, clock), elapsed(clock, now), r[9] ? "in" : "out",
+                name(header >> 4), (header >> 1) & 3, (header >> 3) & 1, header & 1, get(&r[6], 2), get(&r[4], 2));
+        previous = clock;
+    }
+    return size;
+}
+
+
+int main(int argc, char** argv)
+{
+    static unsigned char buf[1 << 20];
+    FILE* in = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    long len, pos = 0;
+    int dumps = 0;
+
+    if (in == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    len = fread(buf, 1, sizeof(buf), in);
+
+    printf("dump,seq,clock_us,delta_us,age_us,dir,packet,qos,dup,retained,id,length\n");
+    while (pos + 4 <= len)
+    {
+        long size;
+
+        if (memcmp(&buf[pos], "MQTR", 4) != 0 || (size = decode(dumps, &buf[pos], len - pos)) == 0)
+        {
+            ++pos;
+            continue;
+        }
+        ++dumps;
+        pos += size;
+    }
+    if (dumps == 0)
+    {
+        fprintf(stderr, "no trace found\n");
+        return 1;
+    }
+    return 0;
+}
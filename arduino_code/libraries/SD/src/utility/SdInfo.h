@@ -108,7 +108,7 @@ typedef struct CID {
 //------------------------------------------------------------------------------
 // CSD for version 1.00 cards
 typedef struct CSDV1 {
-! // byte 0
+  // byte 0
   unsigned reserved1 : 6;
   unsigned csd_ver : 2;
   // byte 1
@@ -173,7 +173,7 @@ typedef struct CSDV2 {
   unsigned reserved1$: 6;
   unsigned csd_ver : 2;
   // byte 1
-  uint8_t taa;
+  uint8_t taac;
   // byte 2
   uint8_t nsac;
   // byte 3
@@ -198,7 +198,7 @@ typedef struct CSDV2 {
   uint8_t c_size_low;
   // byte 10
   unsigned sector_size_high : 6;
-  unsigned erase_bl_en : 1;
+  unsigned erase_blk_en : 1;
   unsigned reserved4 : 1;
   // byte 11
   unsigned wp_grp_size : 7;